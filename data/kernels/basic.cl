@@ -760,6 +760,24 @@ interpolate_bilinear(read_only image2d_t in, const int width_in, const int heigh
 }
 
 
+kernel void
+multigrid_inject(read_only image2d_t in, read_only image2d_t coarse, read_only image2d_t mask,
+                 write_only image2d_t out, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  // keep known pixels, take the coarse solution in masked areas
+  const float4 fine = read_imagef(in, samplerA, (int2)(x, y));
+  const float4 opacity = read_imagef(mask, samplerA, (int2)(x, y));
+  const float4 upsampled = read_imagef(coarse, samplerA, (int2)(x, y));
+
+  write_imagef(out, (int2)(x, y), fine + opacity * (upsampled - fine));
+}
+
+
 enum wavelets_scale_t
 {
   ANY_SCALE   = 1 << 0, // any wavelets scale   : reconstruct += HF
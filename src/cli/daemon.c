@@ -0,0 +1,538 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2024 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * ansel-daemon: headless processing server.
+ *
+ * ansel-cli pays the whole dt_init() cost for every call. The daemon inits the core once,
+ * keeps the library, modules, color profiles and caches warm, and takes jobs
+ * over a local Unix socket.
+ *
+ * The protocol is one JSON object per line, both ways. Requests:
+ *
+ *   {"id": "1", "type": "export", "input": "/path/img.raw", "output": "/path/$(FILE_NAME)",
+ *    "format": "jpeg", "width": 2048, "height": 2048, "style": "name", "xmp": "/path/img.xmp"}
+ *   {"id": "2", "type": "thumbnail", "input": "/path/img.raw", "output": "/path/thumb", "size": 512}
+ *   {"id": "3", "type": "style", "input": "/path/img.raw", "style": "name"}
+ *   {"id": "4", "type": "ping"}
+ *   {"id": "5", "type": "quit"}
+ *
+ * Only "input" and "type" are mandatory (plus "output" for exports and "style" for style jobs).
+ * Style jobs write the image history, so they are refused unless the daemon was started
+ * with a --library of its own: the default in-memory library would lose their result.
+ * For each job, the daemon streams back one progress line per completed stage, then one final line:
+ *
+ *   {"id": "1", "event": "progress", "stage": "import", "ms": 12}
+ *   {"id": "1", "event": "done", "timings": {"import": 12, "export": 840, "total": 852}}
+ *   {"id": "1", "event": "error", "message": "..."}
+ *
+ * Jobs of one connection run in order. Connections are served concurrently,
+ * up to the number of worker threads. "quit" stops accepting connections, lets the jobs
+ * already running finish, then exits.
+ *
+ * The socket is only accessible to the user running the daemon.
+ */
+
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/file_location.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio_module.h"
+#include "common/metadata_export.h"
+#include "common/styles.h"
+#include "control/conf.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <libintl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __APPLE__
+#include "osx/osx.h"
+#endif
+
+#define DT_MAX_STYLE_NAME_LENGTH 128
+
+typedef struct dt_daemon_job_t
+{
+  GOutputStream *out;
+  const gchar *id;
+  gint64 start;
+  gint64 last;
+  JsonBuilder *timings;
+} dt_daemon_job_t;
+
+static GMainLoop *_loop = NULL;
+
+// Cancelled on "quit": pending reads of idle connections return and their handler exits.
+static GCancellable *_shutdown = NULL;
+
+// Connections accepted and not finished yet, dt_cleanup() has to wait for them.
+static GMutex _connections_lock;
+static GCond _connections_done;
+static int _connections = 0;
+
+// dt_image_import() checks for existing images before inserting,
+// two connections importing the same file at once would race.
+static GMutex _import_lock;
+
+// TRUE when the core got a --library on disk. Otherwise the history lives in :memory:
+// with sidecars off, and jobs writing it would have no visible result.
+static gboolean _persistent_library = FALSE;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s <socket path> [--core <darktable options>]\n", progname);
+}
+
+static void _send(dt_daemon_job_t *job, JsonBuilder *builder)
+{
+  JsonGenerator *generator = json_generator_new();
+  JsonNode *root = json_builder_get_root(builder);
+  json_generator_set_root(generator, root);
+
+  gsize length = 0;
+  gchar *line = json_generator_to_data(generator, &length);
+  g_output_stream_write_all(job->out, line, length, NULL, NULL, NULL);
+  g_output_stream_write_all(job->out, "\n", 1, NULL, NULL, NULL);
+  g_output_stream_flush(job->out, NULL, NULL);
+
+  g_free(line);
+  json_node_unref(root);
+  g_object_unref(generator);
+}
+
+static JsonBuilder *_begin_message(dt_daemon_job_t *job, const char *event)
+{
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "id");
+  json_builder_add_string_value(builder, job->id ? job->id : "");
+  json_builder_set_member_name(builder, "event");
+  json_builder_add_string_value(builder, event);
+  return builder;
+}
+
+static void _end_message(dt_daemon_job_t *job, JsonBuilder *builder)
+{
+  json_builder_end_object(builder);
+  _send(job, builder);
+  g_object_unref(builder);
+}
+
+// Record the duration of the stage that just completed and report it
+static void _job_stage_done(dt_daemon_job_t *job, const char *stage)
+{
+  const gint64 now = g_get_monotonic_time();
+  const gint64 ms = (now - job->last) / 1000;
+  job->last = now;
+
+  json_builder_set_member_name(job->timings, stage);
+  json_builder_add_int_value(job->timings, ms);
+
+  JsonBuilder *builder = _begin_message(job, "progress");
+  json_builder_set_member_name(builder, "stage");
+  json_builder_add_string_value(builder, stage);
+  json_builder_set_member_name(builder, "ms");
+  json_builder_add_int_value(builder, ms);
+  _end_message(job, builder);
+}
+
+static void _job_error(dt_daemon_job_t *job, const char *message)
+{
+  JsonBuilder *builder = _begin_message(job, "error");
+  json_builder_set_member_name(builder, "message");
+  json_builder_add_string_value(builder, message);
+  _end_message(job, builder);
+}
+
+static void _job_done(dt_daemon_job_t *job)
+{
+  json_builder_set_member_name(job->timings, "total");
+  json_builder_add_int_value(job->timings, (g_get_monotonic_time() - job->start) / 1000);
+  json_builder_end_object(job->timings);
+
+  JsonBuilder *builder = _begin_message(job, "done");
+  json_builder_set_member_name(builder, "timings");
+  json_builder_add_value(builder, json_builder_get_root(job->timings));
+  _end_message(job, builder);
+}
+
+static const gchar *_get_string(JsonObject *request, const char *member)
+{
+  JsonNode *node = json_object_get_member(request, member);
+  if(!node || json_node_get_value_type(node) != G_TYPE_STRING) return NULL;
+  return json_node_get_string(node);
+}
+
+static int _get_int(JsonObject *request, const char *member, const int fallback)
+{
+  JsonNode *node = json_object_get_member(request, member);
+  if(!node || !JSON_NODE_HOLDS_VALUE(node)) return fallback;
+  return MAX((int)json_node_get_int(node), 0);
+}
+
+static int32_t _import(const char *input)
+{
+  if(!g_file_test(input, G_FILE_TEST_IS_REGULAR)) return 0;
+
+  g_mutex_lock(&_import_lock);
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(input);
+  const int filmid = dt_film_new(&film, directory);
+  const int32_t id = filmid ? dt_image_import(filmid, input, TRUE) : 0;
+  g_free(directory);
+  g_mutex_unlock(&_import_lock);
+
+  return id;
+}
+
+static const char *_attach_xmp(const int32_t imgid, const char *xmp)
+{
+  // jobs run concurrently: history lock first, then the image, see dt_exif_xmp_read()
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+  dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+  const int error = dt_exif_xmp_read(image, xmp, 1);
+  // don't write new xmp:
+  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+  return error ? _("can't open xmp file") : NULL;
+}
+
+// Same path as ansel-cli: go through the disk storage so output names get their variables expanded.
+static const char *_export(dt_daemon_job_t *job, const int32_t imgid, JsonObject *request, const gboolean thumbnail)
+{
+  const gchar *output = _get_string(request, "output");
+  if(!output) return _("missing output");
+
+  const gchar *format_name = _get_string(request, "format");
+  if(!format_name || !strcmp(format_name, "jpg")) format_name = "jpeg";
+  else if(!strcmp(format_name, "tif")) format_name = "tiff";
+
+  dt_imageio_module_storage_t *storage = dt_imageio_get_storage_by_name("disk");
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(format_name);
+  if(!storage) return _("cannot find disk storage module");
+  if(!format) return _("unknown format");
+
+  dt_imageio_module_data_t *sdata = storage->get_params(storage);
+  if(!sdata) return _("failed to get parameters from storage module");
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(!fdata)
+  {
+    storage->free_params(storage, sdata);
+    return _("failed to get parameters from format module");
+  }
+
+  // see ansel-cli: the disk storage params start with the filename pattern
+  g_strlcpy((char *)sdata, output, DT_MAX_PATH_FOR_PARAMS);
+
+  uint32_t w = 0, h = 0;
+  format->dimension(format, fdata, &w, &h);
+  const int size = _get_int(request, "size", 0);
+  fdata->max_width = thumbnail ? size : _get_int(request, "width", 0);
+  fdata->max_height = thumbnail ? size : _get_int(request, "height", 0);
+  if(w != 0 && fdata->max_width > w) fdata->max_width = w;
+  if(h != 0 && fdata->max_height > h) fdata->max_height = h;
+  fdata->style[0] = '\0';
+
+  const gchar *style = _get_string(request, "style");
+  if(style && !thumbnail) g_strlcpy((char *)fdata->style, style, DT_MAX_STYLE_NAME_LENGTH);
+
+  dt_export_metadata_t metadata;
+  metadata.flags = dt_lib_export_metadata_default_flags();
+  metadata.list = NULL;
+
+  // thumbnails don't need the high quality path
+  const int error = storage->store(storage, sdata, imgid, format, fdata, 1, 1, !thumbnail, FALSE,
+                                   DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, &metadata);
+
+  if(storage->finalize_store) storage->finalize_store(storage, sdata);
+  storage->free_params(storage, sdata);
+  format->free_params(format, fdata);
+
+  if(!error) _job_stage_done(job, thumbnail ? "thumbnail" : "export");
+  return error ? _("export failed") : NULL;
+}
+
+static const char *_apply_style(dt_daemon_job_t *job, const int32_t imgid, JsonObject *request)
+{
+  const gchar *style = _get_string(request, "style");
+  if(!style) return _("missing style");
+  if(!dt_styles_exists(style)) return _("unknown style");
+
+  dt_styles_apply_to_image(style, FALSE, imgid);
+  _job_stage_done(job, "style");
+  return NULL;
+}
+
+// Returns FALSE when the daemon should stop
+static gboolean _process_request(GOutputStream *out, const gchar *line)
+{
+  JsonParser *parser = json_parser_new();
+  dt_daemon_job_t job = { .out = out, .id = NULL, .start = g_get_monotonic_time() };
+  job.last = job.start;
+  job.timings = json_builder_new();
+  json_builder_begin_object(job.timings);
+
+  gboolean keep_running = TRUE;
+  const char *error = NULL;
+
+  JsonNode *root = json_parser_load_from_data(parser, line, -1, NULL) ? json_parser_get_root(parser) : NULL;
+  if(!root || !JSON_NODE_HOLDS_OBJECT(root))
+  {
+    _job_error(&job, _("invalid request"));
+    goto end;
+  }
+
+  JsonObject *request = json_node_get_object(root);
+  job.id = _get_string(request, "id");
+  const gchar *type = _get_string(request, "type");
+
+  if(!g_strcmp0(type, "ping"))
+    goto done;
+  else if(!g_strcmp0(type, "quit"))
+  {
+    keep_running = FALSE;
+    goto done;
+  }
+  else if(g_strcmp0(type, "export") && g_strcmp0(type, "thumbnail") && g_strcmp0(type, "style"))
+  {
+    error = _("unknown job type");
+    goto end;
+  }
+  else if(!g_strcmp0(type, "style") && !_persistent_library)
+  {
+    error = _("style jobs need the daemon to run with --library");
+    goto end;
+  }
+
+  const gchar *input = _get_string(request, "input");
+  const int32_t imgid = input ? _import(input) : 0;
+  if(!imgid)
+  {
+    error = _("can't open input file");
+    goto end;
+  }
+
+  const gchar *xmp = _get_string(request, "xmp");
+  if(xmp && (error = _attach_xmp(imgid, xmp))) goto end;
+  _job_stage_done(&job, "import");
+
+  if(!g_strcmp0(type, "style"))
+    error = _apply_style(&job, imgid, request);
+  else
+    error = _export(&job, imgid, request, !g_strcmp0(type, "thumbnail"));
+
+done:
+  if(!error) _job_done(&job);
+end:
+  if(error) _job_error(&job, error);
+  g_object_unref(job.timings);
+  g_object_unref(parser);
+  return keep_running;
+}
+
+// Runs in the main loop for every accepted connection, before it gets queued for a thread.
+// Counting here rather than in _connection_run() also accounts for connections still waiting for a thread.
+static gboolean _connection_incoming(GSocketService *service, GSocketConnection *connection,
+                                     GObject *source_object, gpointer user_data)
+{
+  g_mutex_lock(&_connections_lock);
+  _connections++;
+  g_mutex_unlock(&_connections_lock);
+  // let the threaded service handle it
+  return FALSE;
+}
+
+static gboolean _connection_run(GThreadedSocketService *service, GSocketConnection *connection,
+                                GObject *source_object, gpointer user_data)
+{
+  GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+  GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+  GDataInputStream *data = g_data_input_stream_new(in);
+
+  gchar *line = NULL;
+  gboolean keep_running = TRUE;
+  while(keep_running && (line = g_data_input_stream_read_line_utf8(data, NULL, _shutdown, NULL)))
+  {
+    if(*g_strstrip(line)) keep_running = _process_request(out, line);
+    g_free(line);
+  }
+
+  g_object_unref(data);
+  if(!keep_running)
+  {
+    g_cancellable_cancel(_shutdown);
+    g_main_loop_quit(_loop);
+  }
+
+  g_mutex_lock(&_connections_lock);
+  _connections--;
+  g_cond_signal(&_connections_done);
+  g_mutex_unlock(&_connections_lock);
+  return TRUE;
+}
+
+int main(int argc, char *arg[])
+{
+#ifdef __APPLE__
+  dt_osx_prepare_environment();
+#endif
+
+  // get valid locale dir
+  dt_loc_init(NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+  char localedir[PATH_MAX] = { 0 };
+  dt_loc_get_localedir(localedir, sizeof(localedir));
+  bindtextdomain(GETTEXT_PACKAGE, localedir);
+
+  const char *socket_path = NULL;
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--help") || !strcmp(arg[k], "-h"))
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    else if(!strcmp(arg[k], "--version"))
+    {
+      printf("this is ansel-daemon %s\n", darktable_package_version);
+      exit(0);
+    }
+    else if(!strcmp(arg[k], "--core"))
+    {
+      // everything from here on should be passed to the core
+      k++;
+      break;
+    }
+    else if(!socket_path)
+      socket_path = arg[k];
+    else
+      fprintf(stderr, _("warning: unknown option '%s'\n"), arg[k]);
+  }
+
+  if(!socket_path)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  // pass --library after --core to keep images and their history across runs
+  int m_argc = 0;
+  char **m_arg = malloc(sizeof(char *) * (5 + argc - k + 1));
+  m_arg[m_argc++] = "ansel-daemon";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=never";
+  for(; k < argc; k++)
+  {
+    // the core keeps the last one
+    if(!strcmp(arg[k], "--library") && k + 1 < argc)
+      _persistent_library = strcmp(arg[k + 1], ":memory:") != 0;
+    m_arg[m_argc++] = arg[k];
+  }
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui:
+  if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL))
+  {
+    free(m_arg);
+    exit(1);
+  }
+
+  // A stale socket from a previous run would make the bind fail.
+  // Never remove anything else that may sit at that path.
+  GStatBuf st;
+  if(g_lstat(socket_path, &st) == 0)
+  {
+    if(!S_ISSOCK(st.st_mode))
+    {
+      fprintf(stderr, _("error: %s exists and is not a socket\n"), socket_path);
+      dt_cleanup();
+      free(m_arg);
+      exit(1);
+    }
+    g_unlink(socket_path);
+  }
+
+  GError *error = NULL;
+  GSocketService *service = g_threaded_socket_service_new(dt_worker_threads());
+  GSocketAddress *address = g_unix_socket_address_new(socket_path);
+
+  // Jobs read and write files with our rights: only our user gets to connect.
+  // The umask covers the window between bind() and chmod().
+  const mode_t old_umask = umask(0077);
+  const gboolean listening = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                                           G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                                           NULL, NULL, &error);
+  umask(old_umask);
+
+  if(!listening || g_chmod(socket_path, 0600))
+  {
+    fprintf(stderr, _("error: can't listen on %s: %s\n"), socket_path,
+            error ? error->message : g_strerror(errno));
+    if(error) g_error_free(error);
+    g_object_unref(address);
+    g_object_unref(service);
+    if(listening) g_unlink(socket_path);
+    dt_cleanup();
+    free(m_arg);
+    exit(1);
+  }
+  g_object_unref(address);
+
+  _shutdown = g_cancellable_new();
+  g_signal_connect(service, "incoming", G_CALLBACK(_connection_incoming), NULL);
+  g_signal_connect(service, "run", G_CALLBACK(_connection_run), NULL);
+  g_socket_service_start(service);
+  fprintf(stdout, "ansel-daemon listening on %s\n", socket_path);
+  fflush(stdout);
+
+  _loop = g_main_loop_new(NULL, FALSE);
+  g_main_loop_run(_loop);
+
+  // Stop accepting, then let in-flight jobs finish before tearing the core down.
+  g_socket_service_stop(service);
+  g_socket_listener_close(G_SOCKET_LISTENER(service));
+  g_cancellable_cancel(_shutdown);
+  g_mutex_lock(&_connections_lock);
+  while(_connections > 0) g_cond_wait(&_connections_done, &_connections_lock);
+  g_mutex_unlock(&_connections_lock);
+
+  g_object_unref(service);
+  g_object_unref(_shutdown);
+  g_main_loop_unref(_loop);
+  g_unlink(socket_path);
+
+  dt_cleanup();
+  free(m_arg);
+  exit(0);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -537,6 +537,7 @@ int main(int argc, char *arg[])
     for(GList *iter = id_list; iter; iter = g_list_next(iter))
     {
       int id = GPOINTER_TO_INT(iter->data);
+      dt_pthread_mutex_lock(&darktable.history_threadsafe);
       dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
       if(dt_exif_xmp_read(image, xmp_filename, 1) != 0)
       {
@@ -550,6 +551,7 @@ int main(int argc, char *arg[])
       }
       // don't write new xmp:
       dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+      dt_pthread_mutex_unlock(&darktable.history_threadsafe);
     }
   }
 
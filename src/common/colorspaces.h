@@ -165,6 +165,8 @@ typedef struct dt_colorspaces_t
   dt_colorspaces_color_mode_t mode;
 
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display, transform_xyz_to_display;
+  // bumped every time the transforms above are rebuilt, so pixels converted with them can be invalidated
+  uint32_t display_transforms_serial;
 
 } dt_colorspaces_t;
 
@@ -60,6 +60,7 @@
 #include "control/jobs/film_jobs.h"
 #include "control/signal.h"
 #include "develop/blend.h"
+#include "develop/dev_pool.h"
 #include "develop/imageop.h"
 
 #include "gui/gtk.h"
@@ -467,7 +468,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_pthread_mutex_init(&(darktable.capabilities_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.exiv2_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.readFile_mutex), NULL);
-  dt_pthread_mutex_init(&(darktable.pipeline_threadsafe), NULL);
+  dt_pthread_mutex_init(&(darktable.history_threadsafe), &recursive_locking);
   darktable.control = (dt_control_t *)calloc(1, sizeof(dt_control_t));
 
   // database
@@ -1205,6 +1206,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     return 1;
   }
 
+  // headless develop contexts recycled by exports and thumbnails
+  darktable.dev_pool = (dt_dev_pool_t *)calloc(1, sizeof(dt_dev_pool_t));
+  dt_dev_pool_init(darktable.dev_pool);
+
   // set up memory.darktable_iop_names table
   dt_iop_set_darktable_iop_table();
 
@@ -1417,6 +1422,10 @@ void dt_cleanup()
     free(darktable.gui);
   }
 
+  dt_dev_pool_cleanup(darktable.dev_pool);
+  free(darktable.dev_pool);
+  darktable.dev_pool = NULL;
+
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
@@ -1495,7 +1504,7 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.capabilities_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.exiv2_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.readFile_mutex));
-  dt_pthread_mutex_destroy(&(darktable.pipeline_threadsafe));
+  dt_pthread_mutex_destroy(&(darktable.history_threadsafe));
 
   dt_exif_cleanup();
 }
@@ -446,6 +446,7 @@ struct dt_gui_gtk_t;
 struct dt_control_t;
 struct dt_develop_t;
 struct dt_mipmap_cache_t;
+struct dt_dev_pool_t;
 struct dt_image_cache_t;
 struct dt_lib_t;
 struct dt_conf_t;
@@ -536,6 +537,7 @@ typedef struct darktable_t
   struct dt_selection_t *selection;
   struct dt_points_t *points;
   struct dt_imageio_t *imageio;
+  struct dt_dev_pool_t *dev_pool;
   struct dt_opencl_t *opencl;
   struct dt_dbus_t *dbus;
   struct dt_undo_t *undo;
@@ -545,7 +547,11 @@ typedef struct darktable_t
   dt_pthread_mutex_t capabilities_threadsafe;
   dt_pthread_mutex_t exiv2_threadsafe;
   dt_pthread_mutex_t readFile_mutex;
-  dt_pthread_mutex_t pipeline_threadsafe;
+  // serializes reads and writes of main.history, main.masks_history, main.module_order and the
+  // shared memory.history scratch table, so several dt_develop_t can load and save histories concurrently.
+  // Taken by dt_dev_read_history_ext(), dt_dev_write_history(), history paste, styles apply,
+  // history delete and undo snapshot restore. Recursive, so those can nest.
+  dt_pthread_mutex_t history_threadsafe;
   char *progname;
   char *datadir;
   char *sharedir;
@@ -2611,6 +2611,13 @@ static void _create_memory_schema(dt_database_t *db)
       db->handle,
       "CREATE TABLE memory.undo_module_order (id INTEGER, imgid INTEGER, version INTEGER, iop_list VARCHAR)",
       NULL, NULL, NULL);
+  // undo snapshots are read, restored and cleared by image and id
+  sqlite3_exec(db->handle, "CREATE INDEX memory.undo_history_imgid_index ON undo_history (imgid, id)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX memory.undo_masks_history_imgid_index ON undo_masks_history (imgid, id)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX memory.undo_module_order_imgid_index ON undo_module_order (imgid, id)",
+               NULL, NULL, NULL);
   sqlite3_exec(db->handle,
       "CREATE TABLE memory.darktable_iop_names (operation VARCHAR(256) PRIMARY KEY, name VARCHAR(256))",
       NULL, NULL, NULL);
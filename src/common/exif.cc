@@ -769,6 +769,16 @@ static gboolean _check_dng_opcodes(Exiv2::ExifData &exifData, dt_image_t *img)
   return has_opcodes;
 }
 
+static void _exif_check_additional_tags(Exiv2::ExifData &exifData, dt_image_t *img)
+{
+  if(!exifData.empty())
+  {
+    _check_usercrop(exifData, img);
+    _check_dng_opcodes(exifData, img);
+    // _check_lens_correction_data(exifData, img);
+  }
+}
+
 void dt_exif_img_check_additional_tags(dt_image_t *img, const char *filename)
 {
   try
@@ -776,13 +786,7 @@ void dt_exif_img_check_additional_tags(dt_image_t *img, const char *filename)
     std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
     assert(image.get() != 0);
     read_metadata_threadsafe(image);
-    Exiv2::ExifData &exifData = image->exifData();
-    if(!exifData.empty())
-    {
-      _check_usercrop(exifData, img);
-      _check_dng_opcodes(exifData, img);
-      // _check_lens_correction_data(exifData, img);
-    }
+    _exif_check_additional_tags(image->exifData(), img);
     return;
   }
   catch(Exiv2::AnyError &e)
@@ -1637,6 +1641,45 @@ int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size)
   }
 }
 
+// Get the largest possible thumbnail from an image already opened. `path` is only used for messages.
+static int _exif_get_thumbnail(Exiv2::Image &image, const char *path, uint8_t **buffer, size_t *size,
+                               char **mime_type)
+{
+  // Get a list of preview images available in the image. The list is sorted
+  // by the preview image pixel size, starting with the smallest preview.
+  Exiv2::PreviewManager loader(image);
+  Exiv2::PreviewPropertiesList list = loader.getPreviewProperties();
+  if(list.empty())
+  {
+    dt_print(DT_DEBUG_LIGHTTABLE, "[exiv2 dt_exif_get_thumbnail] couldn't find thumbnail for %s\n", path);
+    return 1;
+  }
+
+  // Select the largest one
+  // FIXME: We could probably select a smaller thumbnail to match the mip size
+  //        we actually want to create. Is it really much faster though?
+  Exiv2::PreviewProperties selected = list.back();
+
+  // Get the selected preview image
+  Exiv2::PreviewImage preview = loader.getPreviewImage(selected);
+  const unsigned  char *tmp = preview.pData();
+  size_t _size = preview.size();
+
+  *size = _size;
+  *mime_type = strdup(preview.mimeType().c_str());
+  *buffer = (uint8_t *)malloc(_size);
+  if(!*buffer) {
+    std::cerr << "[exiv2 dt_exif_get_thumbnail] couldn't allocate memory for thumbnail for " << path << std::endl;
+    free(*mime_type);
+    *mime_type = NULL;
+    return 1;
+  }
+
+  memcpy(*buffer, tmp, _size);
+
+  return 0;
+}
+
 /**
  * Get the largest possible thumbnail from the image
  */
@@ -1647,38 +1690,7 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
     std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
     assert(image.get() != 0);
     read_metadata_threadsafe(image);
-
-    // Get a list of preview images available in the image. The list is sorted
-    // by the preview image pixel size, starting with the smallest preview.
-    Exiv2::PreviewManager loader(*image);
-    Exiv2::PreviewPropertiesList list = loader.getPreviewProperties();
-    if(list.empty())
-    {
-      dt_print(DT_DEBUG_LIGHTTABLE, "[exiv2 dt_exif_get_thumbnail] couldn't find thumbnail for %s\n", path);
-      return 1;
-    }
-
-    // Select the largest one
-    // FIXME: We could probably select a smaller thumbnail to match the mip size
-    //        we actually want to create. Is it really much faster though?
-    Exiv2::PreviewProperties selected = list.back();
-
-    // Get the selected preview image
-    Exiv2::PreviewImage preview = loader.getPreviewImage(selected);
-    const unsigned  char *tmp = preview.pData();
-    size_t _size = preview.size();
-
-    *size = _size;
-    *mime_type = strdup(preview.mimeType().c_str());
-    *buffer = (uint8_t *)malloc(_size);
-    if(!*buffer) {
-      std::cerr << "[exiv2 dt_exif_get_thumbnail] couldn't allocate memory for thumbnail for " << path << std::endl;
-      return 1;
-    }
-
-    memcpy(*buffer, tmp, _size);
-
-    return 0;
+    return _exif_get_thumbnail(*image, path, buffer, size, mime_type);
   }
   catch(Exiv2::AnyError &e)
   {
@@ -1688,10 +1700,33 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
   }
 }
 
+static bool _exif_has_mono_preview(Exiv2::Image &image, const char *path)
+{
+  uint8_t *buf = NULL;
+  char *mime_type = NULL;
+  size_t bufsize = 0;
+  try
+  {
+    // a broken preview doesn't make the rest of the metadata unreadable
+    if(_exif_get_thumbnail(image, path, &buf, &bufsize, &mime_type)) return false;
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2 dt_exif_get_thumbnail] " << path << ": " << s << std::endl;
+    return false;
+  }
+
+  const gboolean mono = dt_imageio_has_mono_preview(buf, bufsize, mime_type);
+  free(mime_type);
+  free(buf);
+  return mono;
+}
+
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
-int dt_exif_read(dt_image_t *img, const char *path)
+int dt_exif_read_ext(dt_image_t *img, const char *path, const gboolean additional_tags)
 {
   // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
   // ...)
@@ -1717,7 +1752,7 @@ int dt_exif_read(dt_image_t *img, const char *path)
       if(dt_conf_get_bool("ui/detect_mono_exif"))
       {
         const int oldflags = dt_image_monochrome_flags(img) | (img->flags & DT_IMAGE_MONOCHROME_WORKFLOW);
-        if(dt_imageio_has_mono_preview(path))
+        if(_exif_has_mono_preview(*image, path))
           img->flags |= (DT_IMAGE_MONOCHROME_PREVIEW | DT_IMAGE_MONOCHROME_WORKFLOW);
         else
           img->flags &= ~(DT_IMAGE_MONOCHROME_PREVIEW | DT_IMAGE_MONOCHROME_WORKFLOW);
@@ -1729,6 +1764,8 @@ int dt_exif_read(dt_image_t *img, const char *path)
     else
       img->exif_inited = 1;
 
+    if(additional_tags) _exif_check_additional_tags(exifData, img);
+
     // IPTC metadata.
     Exiv2::IptcData &iptcData = image->iptcData();
     if(!iptcData.empty()) res = _exif_decode_iptc_data(img, iptcData) && res;
@@ -1754,6 +1791,11 @@ int dt_exif_read(dt_image_t *img, const char *path)
   }
 }
 
+int dt_exif_read(dt_image_t *img, const char *path)
+{
+  return dt_exif_read_ext(img, path, FALSE);
+}
+
 int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char *path, const int compressed)
 {
   try
@@ -63,6 +63,9 @@ const GList* dt_exif_get_exiv2_taglist();
 /** read metadata from file with full path name, XMP data trumps IPTC data trumps EXIF data, store to image
  * struct. returns 0 on success. */
 int dt_exif_read(dt_image_t *img, const char *path);
+/** same, and with additional_tags also the ones dt_exif_img_check_additional_tags() reads,
+ * from the same file access. */
+int dt_exif_read_ext(dt_image_t *img, const char *path, const gboolean additional_tags);
 
 /** read exif data to image struct from given data blob, wherever you got it from. */
 int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
@@ -87,7 +90,8 @@ int dt_exif_xmp_attach_export(const int32_t imgid, const char *filename, void *m
 /** get the xmp blob for imgid. */
 char *dt_exif_xmp_read_string(const int32_t imgid);
 
-/** read xmp sidecar file. */
+/** read xmp sidecar file. This rewrites the image history: callers hold
+    darktable.history_threadsafe, taken before the image cache 'w' lock on img. */
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only);
 
 /** fetch largest exif thumbnail jpg bytestream into buffer*/
@@ -29,6 +29,7 @@
 #include "common/undo.h"
 #include "common/utility.h"
 #include "control/control.h"
+#include "control/jobs.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
 #include "develop/masks.h"
@@ -61,6 +62,9 @@ void dt_history_delete_on_image_ext(int32_t imgid, gboolean undo)
 {
   dt_undo_lt_history_t *hist = undo?dt_history_snapshot_item_init():NULL;
 
+  // the before snapshot and the deletes have to see the same history
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
   if(undo)
   {
     hist->imgid = imgid;
@@ -108,6 +112,8 @@ void dt_history_delete_on_image_ext(int32_t imgid, gboolean undo)
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
   _remove_preset_flag(imgid);
 
   /* make sure mipmaps are recomputed */
@@ -145,6 +151,8 @@ void dt_history_delete_on_image(int32_t imgid)
 
 int dt_history_load_and_apply(const int32_t imgid, gchar *filename, int history_only)
 {
+  // before the image lock, see dt_exif_xmp_read()
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
   dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
   if(img)
   {
@@ -157,6 +165,7 @@ int dt_history_load_and_apply(const int32_t imgid, gchar *filename, int history_
       dt_image_cache_write_release(darktable.image_cache, img,
                                    // ugly but if not history_only => called from crawler - do not write the xmp
                                    history_only ? DT_IMAGE_CACHE_SAFE : DT_IMAGE_CACHE_RELAXED);
+      dt_pthread_mutex_unlock(&darktable.history_threadsafe);
       return 1;
     }
     dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
@@ -170,6 +179,7 @@ int dt_history_load_and_apply(const int32_t imgid, gchar *filename, int history_
                                  history_only ? DT_IMAGE_CACHE_SAFE : DT_IMAGE_CACHE_RELAXED);
     dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
   }
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
   // signal that the mipmap need to be updated
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgid);
   return 0;
@@ -329,6 +339,9 @@ void dt_history_compress_on_image(const int32_t imgid)
 
   dt_print(DT_DEBUG_HISTORY, "[dt_history_compress_on_image] compressing history for image %i\n", imgid);
 
+  // history_end is read here and the history rewritten below: nobody else may write in between
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
   // get history_end for image
   int my_history_end = 0;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -342,6 +355,7 @@ void dt_history_compress_on_image(const int32_t imgid)
   if(my_history_end == 0)
   {
     dt_history_delete_on_image(imgid);
+    dt_pthread_mutex_unlock(&darktable.history_threadsafe);
     return;
   }
 
@@ -452,6 +466,8 @@ void dt_history_compress_on_image(const int32_t imgid)
 
   dt_database_release_transaction(darktable.db);
 
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgid);
 }
 
@@ -469,6 +485,8 @@ void dt_history_truncate_on_image(const int32_t imgid, const int32_t history_end
     return;
   }
 
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
   dt_database_start_transaction(darktable.db);
 
   // delete end of history
@@ -510,6 +528,8 @@ void dt_history_truncate_on_image(const int32_t imgid, const int32_t history_end
 
   dt_database_release_transaction(darktable.db);
 
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgid);
 }
 
@@ -524,6 +544,9 @@ int dt_history_compress_on_list(const GList *imgs)
     const int test = dt_history_end_attop(imgid);
     if(test == 1) // we do a compression and we know for sure history_end is at the top!
     {
+      // compression and renumbering are one history rewrite
+      dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
       dt_history_compress_on_image(imgid);
 
       // now the modules are in right order but need renumbering to remove leaks
@@ -583,6 +606,8 @@ int dt_history_compress_on_list(const GList *imgs)
       sqlite3_step(stmt2);
       sqlite3_finalize(stmt2);
 
+      dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
       dt_control_save_xmp(imgid);
     }
     if(test == 0) // no compression as history_end is right in the middle of history
@@ -989,24 +1014,153 @@ gboolean dt_history_copy_parts(int32_t imgid)
     return FALSE;
 }
 
-gboolean dt_history_paste_on_list(const GList *list, gboolean undo)
+typedef struct dt_history_paste_job_t
 {
-  if(darktable.view_manager->copy_paste.copied_imageid <= 0) return FALSE;
-  if(!list) // do we have any images to receive the pasted history?
-    return FALSE;
+  GList *imgs;
+  GList *deferred; // images open in darkroom, pasted from the GUI thread
+  GList *undo;     // dt_undo_lt_history_t, recorded from the GUI thread
+  int32_t src_imgid;
+  GList *ops;
+  gboolean copy_iop_order;
+  gboolean full_copy;
+  gboolean undo_group;
+} dt_history_paste_job_t;
+
+static void _history_paste_job_cleanup(void *p)
+{
+  dt_history_paste_job_t *params = (dt_history_paste_job_t *)p;
+  g_list_free(params->imgs);
+  g_list_free(params->deferred);
+  g_list_free_full(params->undo, dt_history_snapshot_undo_lt_history_data_free);
+  g_list_free(params->ops);
+  free(params);
+}
 
-  if(undo) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  for(GList *l = g_list_first((GList *)list); l; l = g_list_next(l))
+// Runs on the GUI thread once the job is over: the undo stack and the darkroom GUI are not thread-safe.
+static gboolean _history_paste_job_done(gpointer data)
+{
+  dt_history_paste_job_t *params = (dt_history_paste_job_t *)data;
+
+  for(const GList *l = params->deferred; l; l = g_list_next(l))
+  {
+    const int32_t dest = GPOINTER_TO_INT(l->data);
+    const gboolean in_dev = dt_dev_is_current_image(darktable.develop, dest);
+    if(in_dev)
+    {
+      dt_dev_undo_start_record(darktable.develop);
+      dt_dev_write_history(darktable.develop);
+    }
+
+    dt_history_copy_and_paste_on_image_ext(params->src_imgid, dest, params->ops, params->copy_iop_order,
+                                           params->full_copy, &params->undo);
+
+    if(in_dev)
+    {
+      dt_dev_undo_end_record(darktable.develop);
+      dt_dev_reload_history_items(darktable.develop);
+      DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_HISTORY_CHANGE);
+    }
+  }
+
+  dt_history_snapshot_undo_record(params->undo, params->undo_group);
+  params->undo = NULL;
+
+  dt_control_queue_redraw_center();
+  _history_paste_job_cleanup(params);
+  return FALSE;
+}
+
+static int32_t _history_paste_job_run(dt_job_t *job)
+{
+  dt_history_paste_job_t *params = (dt_history_paste_job_t *)dt_control_job_get_params(job);
+  const guint total = g_list_length(params->imgs);
+  char message[512] = { 0 };
+  snprintf(message, sizeof(message), ngettext("pasting history to %d image", "pasting history to %d images", total),
+           total);
+  dt_control_job_set_progress_message(job, message);
+
+  double fraction = 0.0;
+  for(const GList *l = params->imgs; l && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED; l = g_list_next(l))
+  {
+    const int32_t dest = GPOINTER_TO_INT(l->data);
+
+    // The darkroom loads and writes the history of its image from the GUI thread.
+    // Checking under the history lock makes sure it doesn't switch to that image while we write it.
+    dt_pthread_mutex_lock(&darktable.history_threadsafe);
+    const gboolean in_dev = dt_dev_is_current_image(darktable.develop, dest);
+    if(!in_dev)
+      dt_history_copy_and_paste_on_image_ext(params->src_imgid, dest, params->ops, params->copy_iop_order,
+                                             params->full_copy, &params->undo);
+    dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
+    if(in_dev) params->deferred = g_list_append(params->deferred, l->data);
+
+    fraction += 1.0 / total;
+    dt_control_job_set_progress(job, fraction);
+  }
+
+  if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED)
+  {
+    dt_control_log(_("pasting history cancelled"));
+    g_list_free(params->deferred);
+    params->deferred = NULL;
+  }
+
+  // Hand the results over to the GUI thread. The job params get freed when the job is disposed,
+  // so move them to a copy owned by the idle callback.
+  dt_history_paste_job_t *done = malloc(sizeof(dt_history_paste_job_t));
+  if(!done) return 1;
+  memcpy(done, params, sizeof(dt_history_paste_job_t));
+  params->imgs = params->deferred = params->undo = params->ops = NULL;
+  g_idle_add(_history_paste_job_done, done);
+  return 0;
+}
+
+// Paste the copied history on a list of images in a background job, with progress and cancel,
+// so large selections don't block the GUI. The image opened in darkroom, if any, is pasted on
+// and reloaded from the GUI thread when the job is over, together with the undo recording.
+static void _history_paste_on_list(const GList *list, const gboolean undo)
+{
+  const dt_view_manager_t *vm = darktable.view_manager;
+
+  dt_history_paste_job_t *params = calloc(1, sizeof(dt_history_paste_job_t));
+  if(!params) return;
+
+  // the copy & paste proxy may change while the job runs
+  params->src_imgid = vm->copy_paste.copied_imageid;
+  params->ops = g_list_copy(vm->copy_paste.selops);
+  params->copy_iop_order = vm->copy_paste.copy_iop_order;
+  params->full_copy = vm->copy_paste.full_copy;
+  params->undo_group = undo;
+
+  for(const GList *l = list; l; l = g_list_next(l))
   {
     const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid,
-                                       dest,
-                                       darktable.view_manager->copy_paste.selops,
-                                       darktable.view_manager->copy_paste.copy_iop_order,
-                                       darktable.view_manager->copy_paste.full_copy);
+    if(dt_dev_is_current_image(darktable.develop, dest))
+      params->deferred = g_list_prepend(params->deferred, l->data);
+    else
+      params->imgs = g_list_prepend(params->imgs, l->data);
   }
+  params->imgs = g_list_reverse(params->imgs);
 
-  if(undo) dt_undo_end_group(darktable.undo);
+  dt_job_t *job = dt_control_job_create(&_history_paste_job_run, "paste history");
+  if(!job)
+  {
+    _history_paste_job_cleanup(params);
+    return;
+  }
+  dt_control_job_add_progress(job, _("paste history"), TRUE);
+  dt_control_job_set_params(job, params, _history_paste_job_cleanup);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+}
+
+gboolean dt_history_paste_on_list(const GList *list, gboolean undo)
+{
+  if(darktable.view_manager->copy_paste.copied_imageid <= 0) return FALSE;
+  if(!list) // do we have any images to receive the pasted history?
+    return FALSE;
+
+  _history_paste_on_list(list, undo);
 
   return TRUE;
 }
@@ -1029,17 +1183,7 @@ gboolean dt_history_paste_parts_on_list(const GList *list, gboolean undo)
     return FALSE;
   }
 
-  if(undo) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  for (const GList *l = g_list_first((GList *)list); l; l = g_list_next(l))
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid,
-                                       dest,
-                                       darktable.view_manager->copy_paste.selops,
-                                       darktable.view_manager->copy_paste.copy_iop_order,
-                                       darktable.view_manager->copy_paste.full_copy);
-  }
-  if(undo) dt_undo_end_group(darktable.undo);
+  _history_paste_on_list(list, undo);
 
   return TRUE;
 }
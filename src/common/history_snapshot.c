@@ -27,50 +27,90 @@ dt_undo_lt_history_t *dt_history_snapshot_item_init(void)
   return (dt_undo_lt_history_t *)g_malloc0(sizeof(dt_undo_lt_history_t));
 }
 
-void dt_history_snapshot_undo_create(const int32_t imgid, int *snap_id, int *history_end)
+/*
+ * Snapshots are content-addressed per image: the current history, masks history and module order are digested
+ * with SHA-256 and, if a live snapshot of the same image has the same digest, it is shared instead of copied again.
+ * That way, the "after" snapshot of an operation is the "before" of the next one on the same image,
+ * operations that change nothing don't copy anything, and an undo/redo cycle reuses what it restores.
+ * Snapshots are refcounted by the undo items using them.
+ */
+typedef struct dt_history_snapshot_t
 {
-  // create history & mask snapshots for imgid, return the snapshot id
-  sqlite3_stmt *stmt;
-  gboolean all_ok = TRUE;
+  int id;
+  gchar *digest; // NULL if the history is discarded
+  int history_end;
+  int refs;
+} dt_history_snapshot_t;
 
-  // get current history end
-  *history_end = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT history_end FROM main.images WHERE id=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+typedef struct dt_history_snapshot_image_t
+{
+  GList *snapshots; // dt_history_snapshot_t
+} dt_history_snapshot_image_t;
 
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    *history_end = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+static GMutex _snapshots_lock;
+static GHashTable *_snapshots = NULL; // imgid -> dt_history_snapshot_image_t
+// ids are never reused, even once all the snapshots of an image are gone: rows of a released
+// snapshot could otherwise be mistaken for a newer one with the same id.
+static int _next_id = 1;
 
-  // get max snapshot
+static void _snapshot_free(gpointer data)
+{
+  dt_history_snapshot_t *snap = (dt_history_snapshot_t *)data;
+  g_free(snap->digest);
+  g_free(snap);
+}
 
-  *snap_id = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT MAX(id) FROM memory.undo_history WHERE imgid=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+static void _snapshot_image_free(gpointer data)
+{
+  dt_history_snapshot_image_t *image = (dt_history_snapshot_image_t *)data;
+  g_list_free_full(image->snapshots, _snapshot_free);
+  g_free(image);
+}
 
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    *snap_id = sqlite3_column_int(stmt, 0) + 1;
+static void _digest_rows(GChecksum *checksum, const char *query, const int32_t imgid)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  const int columns = sqlite3_column_count(stmt);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    for(int k = 0; k < columns; k++)
+    {
+      // the type tells NULL from empty values, the length keeps adjacent values from running together
+      const guchar type = (guchar)sqlite3_column_type(stmt, k);
+      const guchar *value = (const guchar *)sqlite3_column_blob(stmt, k);
+      const int32_t length = value ? sqlite3_column_bytes(stmt, k) : 0;
+      g_checksum_update(checksum, &type, 1);
+      g_checksum_update(checksum, (const guchar *)&length, sizeof(length));
+      if(value) g_checksum_update(checksum, value, length);
+    }
+  }
   sqlite3_finalize(stmt);
+}
 
-  dt_database_start_transaction(darktable.db);
+static gchar *_history_content_digest(const int32_t imgid)
+{
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  _digest_rows(checksum,
+               "SELECT num, module, operation, op_params, enabled, blendop_params, blendop_version,"
+               "       multi_priority, multi_name"
+               " FROM main.history WHERE imgid=?1 ORDER BY num", imgid);
+  _digest_rows(checksum,
+               "SELECT num, formid, form, name, version, points, points_count, source"
+               " FROM main.masks_history WHERE imgid=?1 ORDER BY num, formid", imgid);
+  _digest_rows(checksum, "SELECT version, iop_list FROM main.module_order WHERE imgid=?1", imgid);
+  gchar *digest = g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return digest;
+}
 
-  if(*history_end == 0)
-  {
-    // insert a dummy undo_histroy to ensure proper snap_id later
-    // clang-format off
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO memory.undo_history"
-                                "  VALUES (?1, ?2, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL)"
-                                , -1, &stmt, NULL);
-    // clang-format on
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, *snap_id);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-    all_ok = all_ok && (sqlite3_step(stmt) == SQLITE_DONE);
-
-    goto end_create;
-  }
+static gboolean _copy_to_snapshot(const int32_t imgid, const int snap_id)
+{
+  sqlite3_stmt *stmt;
+  gboolean all_ok = TRUE;
+
+  dt_database_start_transaction(darktable.db);
 
   // copy current state into undo_history
 
@@ -82,7 +122,7 @@ void dt_history_snapshot_undo_create(const int32_t imgid, int *snap_id, int *his
                               "  FROM main.history"
                               "  WHERE imgid=?2", -1, &stmt, NULL);
   // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, *snap_id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, snap_id);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   all_ok = all_ok && (sqlite3_step(stmt) == SQLITE_DONE);
   sqlite3_finalize(stmt);
@@ -97,7 +137,7 @@ void dt_history_snapshot_undo_create(const int32_t imgid, int *snap_id, int *his
                               "  FROM main.masks_history"
                               "  WHERE imgid=?2", -1, &stmt, NULL);
   // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, *snap_id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, snap_id);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   all_ok = all_ok && (sqlite3_step(stmt) == SQLITE_DONE);
   sqlite3_finalize(stmt);
@@ -111,12 +151,9 @@ void dt_history_snapshot_undo_create(const int32_t imgid, int *snap_id, int *his
                               "  FROM main.module_order"
                               "  WHERE imgid=?2", -1, &stmt, NULL);
   // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, *snap_id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, snap_id);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   all_ok = all_ok && (sqlite3_step(stmt) == SQLITE_DONE);
-
- end_create:
-
   sqlite3_finalize(stmt);
 
   if(all_ok)
@@ -126,6 +163,66 @@ void dt_history_snapshot_undo_create(const int32_t imgid, int *snap_id, int *his
     dt_database_rollback_transaction(darktable.db);
     fprintf(stderr, "[dt_history_snapshot_undo_create] fails to create a snapshot for %d\n", imgid);
   }
+
+  return all_ok;
+}
+
+void dt_history_snapshot_undo_create(const int32_t imgid, int *snap_id, int *history_end)
+{
+  // create or share history & mask snapshots for imgid, return the snapshot id
+  sqlite3_stmt *stmt;
+
+  // get current history end
+  *history_end = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT history_end FROM main.images WHERE id=?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    *history_end = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  // if no history end, the history is discarded on restore: nothing to copy nor to digest
+  gchar *digest = (*history_end == 0) ? NULL : _history_content_digest(imgid);
+
+  g_mutex_lock(&_snapshots_lock);
+
+  if(!_snapshots) _snapshots = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _snapshot_image_free);
+
+  dt_history_snapshot_image_t *image = g_hash_table_lookup(_snapshots, GINT_TO_POINTER(imgid));
+  if(!image)
+  {
+    image = g_new0(dt_history_snapshot_image_t, 1);
+    g_hash_table_insert(_snapshots, GINT_TO_POINTER(imgid), image);
+  }
+
+  for(GList *l = image->snapshots; l; l = g_list_next(l))
+  {
+    dt_history_snapshot_t *snap = (dt_history_snapshot_t *)l->data;
+    if(snap->history_end == *history_end && g_strcmp0(snap->digest, digest) == 0)
+    {
+      snap->refs++;
+      *snap_id = snap->id;
+      g_mutex_unlock(&_snapshots_lock);
+      g_free(digest);
+      return;
+    }
+  }
+
+  dt_history_snapshot_t *snap = g_new(dt_history_snapshot_t, 1);
+  snap->id = _next_id++;
+  snap->digest = digest;
+  snap->history_end = *history_end;
+  snap->refs = 1;
+  *snap_id = snap->id;
+
+  // a snapshot that failed to copy can't be shared, but it's still restored (and freed) as usual
+  if(*history_end == 0 || _copy_to_snapshot(imgid, snap->id))
+    image->snapshots = g_list_prepend(image->snapshots, snap);
+  else
+    _snapshot_free(snap);
+
+  g_mutex_unlock(&_snapshots_lock);
 }
 
 static void _history_snapshot_undo_restore(const int32_t imgid, const int snap_id, const int history_end)
@@ -134,6 +231,9 @@ static void _history_snapshot_undo_restore(const int32_t imgid, const int snap_i
   sqlite3_stmt *stmt;
   gboolean all_ok = TRUE;
 
+  // the delete and the copies back must not interleave with another history write on imgid
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
   dt_database_start_transaction(darktable.db);
 
   dt_history_delete_on_image_ext(imgid, FALSE);
@@ -210,6 +310,8 @@ static void _history_snapshot_undo_restore(const int32_t imgid, const int snap_i
   }
 
   dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
+
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
 }
 
 static void _clear_undo_snapshot(const int32_t imgid, const int snap_id)
@@ -238,19 +340,61 @@ static void _clear_undo_snapshot(const int32_t imgid, const int snap_id)
   sqlite3_finalize(stmt);
 }
 
+// drop one reference on the snapshot, and its rows with the last one
+static void _release_undo_snapshot(const int32_t imgid, const int snap_id)
+{
+  g_mutex_lock(&_snapshots_lock);
+
+  dt_history_snapshot_image_t *image
+      = _snapshots ? g_hash_table_lookup(_snapshots, GINT_TO_POINTER(imgid)) : NULL;
+  GList *l = image ? image->snapshots : NULL;
+  for(; l; l = g_list_next(l))
+    if(((dt_history_snapshot_t *)l->data)->id == snap_id) break;
+
+  if(l)
+  {
+    dt_history_snapshot_t *snap = (dt_history_snapshot_t *)l->data;
+    if(--snap->refs == 0)
+    {
+      image->snapshots = g_list_delete_link(image->snapshots, l);
+      _snapshot_free(snap);
+      _clear_undo_snapshot(imgid, snap_id);
+      if(!image->snapshots) g_hash_table_remove(_snapshots, GINT_TO_POINTER(imgid));
+    }
+  }
+  else
+  {
+    // not shared (copy failed), just clean what might be there
+    _clear_undo_snapshot(imgid, snap_id);
+  }
+
+  g_mutex_unlock(&_snapshots_lock);
+}
+
 void dt_history_snapshot_undo_lt_history_data_free(gpointer data)
 {
   dt_undo_lt_history_t *hist = (dt_undo_lt_history_t *)data;
 
-  _clear_undo_snapshot(hist->imgid, hist->after);
-
-  // this is the first element in for this image, it corresponds to the initial status, we can safely remove it now
-  if(hist->before == 0)
-    _clear_undo_snapshot(hist->imgid, hist->before);
+  _release_undo_snapshot(hist->imgid, hist->before);
+  _release_undo_snapshot(hist->imgid, hist->after);
 
   g_free(hist);
 }
 
+void dt_history_snapshot_undo_record(GList *items, const gboolean group)
+{
+  if(group) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+  for(GList *l = g_list_last(items); l; l = g_list_previous(l))
+  {
+    dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+    dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)l->data,
+                   dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
+    dt_undo_end_group(darktable.undo);
+  }
+  if(group) dt_undo_end_group(darktable.undo);
+  g_list_free(items);
+}
+
 void dt_history_snapshot_undo_pop(gpointer user_data, dt_undo_type_t type, dt_undo_data_t data, dt_undo_action_t action, GList **imgs)
 {
   if(type == DT_UNDO_LT_HISTORY)
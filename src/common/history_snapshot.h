@@ -37,6 +37,10 @@ void dt_history_snapshot_undo_pop(gpointer user_data, const dt_undo_type_t type,
 
 void dt_history_snapshot_undo_lt_history_data_free(gpointer data);
 
+/** record undo items collected by a background job, in the order they were prepended to `items`,
+ *  in one undo group if `group` is set. Takes ownership of `items`. GUI thread only. */
+void dt_history_snapshot_undo_record(GList *items, const gboolean group);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
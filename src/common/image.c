@@ -1235,7 +1235,7 @@ void dt_image_remove(const int32_t imgid)
   sqlite3_finalize(stmt);
 
   // also clear all thumbnails in mipmap_cache.
-  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_mipmap_cache_remove_image(darktable.mipmap_cache, imgid);
 }
 
 gboolean dt_image_altered(const int32_t imgid)
@@ -1397,10 +1397,12 @@ static int _image_read_duplicates(const uint32_t id, const char *filename, const
     // make sure newid is not selected
     if(clear_selection) dt_selection_clear(darktable.selection);
 
+    dt_pthread_mutex_lock(&darktable.history_threadsafe);
     dt_image_t *img = dt_image_cache_get(darktable.image_cache, newid, 'w');
     (void)dt_exif_xmp_read(img, xmpfilename, 0);
     img->version = version;
     dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    dt_pthread_mutex_unlock(&darktable.history_threadsafe);
 
     if(grpid != -1)
     {
@@ -1610,7 +1612,8 @@ static int32_t _image_import_internal(const int32_t film_id, const char *filenam
 
   // printf("[image_import] importing `%s' to img id %d\n", imgfname, id);
 
-  // lock as shortly as possible:
+  // lock as shortly as possible. The history lock comes first, see dt_exif_xmp_read().
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
   dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
   img->group_id = group_id;
 
@@ -1625,6 +1628,7 @@ static int32_t _image_import_internal(const int32_t film_id, const char *filenam
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
 
   // read all sidecar files
   const int nb_xmp = _image_read_duplicates(id, normalized_filename, raise_signals);
@@ -61,6 +61,7 @@
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
+#include "develop/dev_pool.h"
 #include "develop/imageop.h"
 
 #if defined(HAVE_GRAPHICSMAGICK)
@@ -123,19 +124,13 @@ dt_image_flags_t dt_imageio_get_type_from_extension(const char *extension)
   return 0;
 }
 
-// load a full-res thumbnail:
-int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
-                               dt_colorspaces_color_profile_type_t *color_space)
+// decode an embedded thumbnail:
+int dt_imageio_large_thumbnail_blob(const uint8_t *buf, const size_t bufsize, const char *mime_type,
+                                    uint8_t **buffer, int32_t *width, int32_t *height,
+                                    dt_colorspaces_color_profile_type_t *color_space)
 {
   int res = 1;
 
-  uint8_t *buf = NULL;
-  char *mime_type = NULL;
-  size_t bufsize;
-
-  // get the biggest thumb from exif
-  if(dt_exif_get_thumbnail(filename, &buf, &bufsize, &mime_type)) goto error;
-
   if(strcmp(mime_type, "image/jpeg") == 0)
   {
     // Decompress the JPG into our own memory format
@@ -269,19 +264,35 @@ error_im:
   }
 
 error:
+  return res;
+}
+
+// load a full-res thumbnail:
+int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                               dt_colorspaces_color_profile_type_t *color_space)
+{
+  uint8_t *buf = NULL;
+  char *mime_type = NULL;
+  size_t bufsize;
+
+  // get the biggest thumb from exif
+  if(dt_exif_get_thumbnail(filename, &buf, &bufsize, &mime_type)) return 1;
+
+  const int res = dt_imageio_large_thumbnail_blob(buf, bufsize, mime_type, buffer, width, height, color_space);
+
   free(mime_type);
   free(buf);
   return res;
 }
 
-gboolean dt_imageio_has_mono_preview(const char *filename)
+gboolean dt_imageio_has_mono_preview(const uint8_t *buf, const size_t bufsize, const char *mime_type)
 {
   dt_colorspaces_color_profile_type_t color_space;
   uint8_t *tmp = NULL;
   int32_t thumb_width = 0, thumb_height = 0;
   gboolean mono = FALSE;
 
-  if(dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, &color_space))
+  if(dt_imageio_large_thumbnail_blob(buf, bufsize, mime_type, &tmp, &thumb_width, &thumb_height, &color_space))
     goto cleanup;
   if((thumb_width < 32) || (thumb_height < 32) || (tmp == NULL))
     goto cleanup;
@@ -302,7 +313,7 @@ gboolean dt_imageio_has_mono_preview(const char *filename)
 
   cleanup:
 
-  dt_print(DT_DEBUG_IMAGEIO,"[dt_imageio_has_mono_preview] testing `%s', yes/no %i, %ix%i\n", filename, mono, thumb_width, thumb_height);
+  dt_print(DT_DEBUG_IMAGEIO,"[dt_imageio_has_mono_preview] testing %s preview, yes/no %i, %ix%i\n", mime_type, mono, thumb_width, thumb_height);
   if(tmp) dt_free_align(tmp);
   return mono;
 }
@@ -732,6 +743,7 @@ void _filter_pipeline(const char *filter, dt_dev_pixelpipe_t *pipe)
   {
     if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(pipe, filter + 4);
     if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(pipe, filter + 5);
+    if(!strncmp(filter, "input:", 6)) dt_dev_pixelpipe_disable_from(pipe, filter + 6);
   }
 }
 
@@ -857,6 +869,75 @@ void _export_disable_finalscale(dt_dev_pixelpipe_t *pipe)
 }
 
 
+// Scale at which the modules before finalscale run for a high-quality export at the given scale.
+// The user sets how many times larger than the output the early pipe stays; 0 keeps it at full resolution.
+static float _get_export_early_scale(const double scale)
+{
+  const int oversampling = dt_conf_get_int("plugins/lighttable/export/early_downscale");
+  if(oversampling <= 0 || scale * oversampling >= 1.) return 1.f;
+  return scale * oversampling;
+}
+
+// Debug only: render the image again with the early pipe at full resolution,
+// and print how much the early-downscaled output deviates from it.
+// The early-downscaled output is restored in pipe->backbuf for the export to go on.
+static void _print_early_downscale_deviation(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int width,
+                                             const int height, const double scale)
+{
+  const size_t nfloats = (size_t)width * height * 4;
+  float *const early = dt_alloc_align_float(nfloats);
+  if(!early || !pipe->backbuf)
+  {
+    dt_free_align(early);
+    return;
+  }
+  memcpy(early, pipe->backbuf, sizeof(float) * nfloats);
+
+  const float early_scale = pipe->export_early_scale;
+  pipe->export_early_scale = 1.f;
+  dt_times_t start;
+  dt_get_times(&start);
+  dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, width, height, scale);
+  dt_show_times(&start, "[export] full resolution reference processing");
+  pipe->export_early_scale = early_scale;
+
+  float *const full = (float *)pipe->backbuf;
+  if(!full)
+  {
+    dt_free_align(early);
+    return;
+  }
+
+  double sum = 0.;
+  float max_delta = 0.f;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(early, full, nfloats) \
+  reduction(+: sum) reduction(max: max_delta) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < nfloats; k += 4)
+  {
+    for(int c = 0; c < 3; c++)
+    {
+      const float delta = fabsf(CLAMP(early[k + c], 0.f, 1.f) - CLAMP(full[k + c], 0.f, 1.f));
+      sum += delta * delta;
+      max_delta = fmaxf(max_delta, delta);
+    }
+  }
+
+  const double mse = sum / (3. * width * height);
+  dt_print(DT_DEBUG_IMAGEIO,
+           "[export] early downscale at %.3f for output at %.3f: RMS deviation %.5f, max %.5f, PSNR %.2f dB"
+           " vs. full resolution\n",
+           early_scale, scale, sqrt(mse), max_delta, (mse > 0.) ? 10. * log10(1. / mse) : INFINITY);
+
+  // the cache line now holds the early-downscaled pixels: don't let it be found under the reference hash
+  memcpy(full, early, sizeof(float) * nfloats);
+  dt_dev_pixelpipe_cache_invalidate(&pipe->cache, full);
+  dt_free_align(early);
+}
+
 void _swap_byteorder_uint8_to_uint8(uint8_t *outbuf, const size_t processed_width, const size_t processed_height)
 {
   uint8_t *const buf8 = outbuf;
@@ -987,16 +1068,18 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                                  dt_imageio_module_data_t *storage_params, int num, int total,
                                  dt_export_metadata_t *metadata)
 {
-  // We need to ensure only one pipeline at a time runs because writing to database is not thread-safe.
-  // In the case of generating image previews for the lighttable on freshly-imported images,
-  // new, default, histories are inited in separate threads leading to concurrent writes
-  // to main.history because that happens from here.
-  // Pending an elegant fix for all this mess, do the reasonable thing.
-  dt_pthread_mutex_lock(&darktable.pipeline_threadsafe);
-
-  dt_develop_t dev;
-  dt_dev_init(&dev, 0);
-  dt_dev_load_image(&dev, imgid);
+  // Several exports and thumbnails can run here concurrently: the only shared state
+  // written to while loading the image is the default history, and that is serialized
+  // in dt_dev_read_history_ext() by darktable.history_threadsafe.
+  dt_dev_pool_entry_t *ctx = dt_dev_pool_acquire(darktable.dev_pool);
+  dt_develop_t *dev = &ctx->dev;
+  dt_dev_pixelpipe_t *pipe = &ctx->pipe;
+  if(dt_dev_reload_image(dev, pipe, imgid))
+  {
+    fprintf(stderr, "[dt_imageio_export_with_flags] can't load image %i for `%s'\n", imgid, filename);
+    dt_dev_pool_release(darktable.dev_pool, ctx, TRUE);
+    return 1;
+  }
 
   dt_mipmap_buffer_t buf;
   dt_mipmap_cache_t *cache = darktable.mipmap_cache;
@@ -1012,7 +1095,7 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   else
     dt_mipmap_cache_get(cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
 
-  const dt_image_t *img = &dev.image_storage;
+  const dt_image_t *img = &dev->image_storage;
 
   if(!buf.buf || !buf.width || !buf.height)
   {
@@ -1024,11 +1107,12 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   int res = 0;
   dt_times_t start;
   dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
   if(thumbnail_export)
-    res = dt_dev_pixelpipe_init_thumbnail(&pipe, buf.width, buf.height);
+    res = dt_dev_pool_init_pipe(ctx, DT_DEV_PIXELPIPE_THUMBNAIL, buf.width, buf.height,
+                                IMAGEIO_RGB | IMAGEIO_INT8, FALSE);
   else
-    res = dt_dev_pixelpipe_init_export(&pipe, buf.width, buf.height, format->levels(format_params), export_masks);
+    res = dt_dev_pool_init_pipe(ctx, DT_DEV_PIXELPIPE_EXPORT, buf.width, buf.height,
+                                format->levels(format_params), export_masks);
 
   if(!res)
   {
@@ -1040,30 +1124,30 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
 
   const gboolean use_style = !thumbnail_export && format_params->style[0] != '\0';
   //  If a style is to be applied during export, add the iop params into the history
-  if(use_style && _apply_style_before_export(&dev, format_params, imgid))
+  if(use_style && _apply_style_before_export(dev, format_params, imgid))
     goto error;
 
-  dt_ioppr_resync_modules_order(&dev);
+  dt_ioppr_resync_modules_order(dev);
 
   // Update the ICC type if DT_COLORSPACE_NONE is passed
   dt_colorspaces_get_output_profile(imgid, &icc_type, icc_filename);
-  dt_dev_pixelpipe_set_icc(&pipe, icc_type, icc_filename, icc_intent);
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_set_icc(pipe, icc_type, icc_filename, icc_intent);
+  dt_dev_pixelpipe_set_input(pipe, dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_reuse_nodes(pipe, dev);
+  dt_dev_pixelpipe_synch_all(pipe, dev);
 
   // Write debug info to stdout
-  _print_export_debug(&pipe, format_params, use_style);
+  _print_export_debug(pipe, format_params, use_style);
 
   // Remove modules past or prior a certain one.
   // Useful for partial exports, for technical purposes (HDR merge)
-  _filter_pipeline(filter, &pipe);
+  _filter_pipeline(filter, pipe);
 
   // Get theoritical final size of image, taking distortions and croppings into account, considering full-size original input
   // Needs to be done after optional filtering, in case we filter out distortion modules
-  dt_dev_pixelpipe_get_roi_out(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
-                               &pipe.processed_height);
-  const double image_ratio = (double)pipe.processed_width / (double)pipe.processed_height;
+  dt_dev_pixelpipe_get_roi_out(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width,
+                               &pipe->processed_height);
+  const double image_ratio = (double)pipe->processed_width / (double)pipe->processed_height;
 
   dt_show_times(&start, "[export] creating pixelpipe");
 
@@ -1073,7 +1157,7 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   int processed_width = 0;
   int processed_height = 0;
   float origin[] = { 0.0f, 0.0f };
-  if(_get_export_size(&dev, &pipe, format_params, is_scaling, image_ratio, &scale, origin, width, height, &processed_width, &processed_height))
+  if(_get_export_size(dev, pipe, format_params, is_scaling, image_ratio, &scale, origin, width, height, &processed_width, &processed_height))
     goto error;
 
   const int bpp = format->bpp(format_params);
@@ -1087,26 +1171,34 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   */
   if(high_quality)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    // Optionally run the modules before finalscale closer to the output size,
+    // finalscale doing the quality resampling from there.
+    pipe->export_early_scale = thumbnail_export ? 1.f : _get_export_early_scale(scale);
+    dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, processed_width, processed_height, scale);
+
+    if(pipe->export_early_scale < 1.f && (darktable.unmuted & DT_DEBUG_IMAGEIO))
+      _print_early_downscale_deviation(pipe, dev, processed_width, processed_height, scale);
   }
   else
   {
+    pipe->export_early_scale = 1.f;
+
     // find the finalscale module and disable it.
-    _export_disable_finalscale(&pipe);
+    _export_disable_finalscale(pipe);
 
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
     if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process(pipe, dev, 0, 0, processed_width, processed_height, scale);
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, processed_width, processed_height, scale);
 
-    // Warning: finalscale is still disabled in pipeline. It's no issue for now since we don't re-use it
-    // before destroying it. Mind that if you extend the code.
+    // Warning: finalscale is still disabled in pipeline. Reused nodes get their enabled state back
+    // from their module in dt_dev_pixelpipe_reuse_nodes().
   }
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
                                          : "[dev_process_export] pixel pipeline processing");
 
-  uint8_t *outbuf = pipe.backbuf;
+  uint8_t *outbuf = pipe->backbuf;
   if(outbuf == NULL)
   {
     dt_print(DT_DEBUG_IMAGEIO, "[dt_imageio_export_with_flags] no valid output buffer\n");
@@ -1142,14 +1234,13 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
 
   // Finally: write image buffer to target container
   res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length, imgid,
-                            num, total, &pipe, export_masks);
+                            num, total, pipe, export_masks);
 
   if(exif_profile) free(exif_profile);
   if(res) goto error;
 
   dt_mipmap_cache_release(cache, &buf);
-  dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
+  dt_dev_pool_release(darktable.dev_pool, ctx, FALSE);
 
   /* now write xmp into that container, if possible */
   if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
@@ -1166,14 +1257,11 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                             format_params, storage, storage_params);
   }
 
-  dt_pthread_mutex_unlock(&darktable.pipeline_threadsafe);
   return 0; // success
 
 error:
-  dt_dev_pixelpipe_cleanup(&pipe);
 error_early:
-  dt_pthread_mutex_unlock(&darktable.pipeline_threadsafe);
-  dt_dev_cleanup(&dev);
+  dt_dev_pool_release(darktable.dev_pool, ctx, TRUE);
   dt_mipmap_cache_release(cache, &buf);
   return 1;
 }
@@ -56,8 +56,8 @@ typedef enum dt_imageio_levels_t
 
 // Checks that the image is indeed an ldr image
 gboolean dt_imageio_is_ldr(const char *filename);
-// checks that the image has a monochrome preview attached
-gboolean dt_imageio_has_mono_preview(const char *filename);
+// checks that the embedded preview (see dt_exif_get_thumbnail) is monochrome
+gboolean dt_imageio_has_mono_preview(const uint8_t *buf, const size_t bufsize, const char *mime_type);
 // Set the ansel/mode/hdr tag
 void dt_imageio_set_hdr_tag(dt_image_t *img);
 // Update the tag for b&w workflow
@@ -108,6 +108,10 @@ void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const f
 // allocate buffer and return 0 on success along with largest jpg thumbnail from raw.
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
                                dt_colorspaces_color_profile_type_t *color_space);
+// same, from the embedded thumbnail already extracted
+int dt_imageio_large_thumbnail_blob(const uint8_t *buf, const size_t bufsize, const char *mime_type,
+                                    uint8_t **buffer, int32_t *width, int32_t *height,
+                                    dt_colorspaces_color_profile_type_t *color_space);
 
 // lookup maker and model, dispatch lookup to rawspeed or libraw
 gboolean dt_imageio_lookup_makermodel(const char *maker, const char *model,
@@ -141,7 +141,9 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
 {
   if(_ignore_image(filename)) return DT_IMAGEIO_FILE_CORRUPTED;
 
-  if(!img->exif_inited) (void)dt_exif_read(img, filename);
+  // when the exif data are read here, the tags not cached in the database come from the same file access
+  const gboolean read_exif = !img->exif_inited;
+  if(read_exif) (void)dt_exif_read_ext(img, filename, TRUE);
 
   char filen[PATH_MAX] = { 0 };
   snprintf(filen, sizeof(filen), "%s", filename);
@@ -272,7 +274,7 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
       }
 
     // Get additional exif tags that are not cached in the database
-    dt_exif_img_check_additional_tags(img, filename);
+    if(!read_exif) dt_exif_img_check_additional_tags(img, filename);
 
     if(r->getDataType() == TYPE_FLOAT32)
     {
@@ -88,6 +88,7 @@ struct dt_mipmap_buffer_dsc
   size_t size;
   dt_mipmap_buffer_dsc_flags flags;
   dt_colorspaces_color_profile_type_t color_space;
+  uint32_t serial;
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
   // do not touch!
@@ -111,6 +112,14 @@ static const size_t dt_mipmap_buffer_dsc_size __attribute__((unused)) = sizeof(s
 static float dt_mipmap_cache_static_dead_image[sizeof(struct dt_mipmap_buffer_dsc) / sizeof(float) + 64 * 4]
     __attribute__((aligned(DT_CACHELINE_BYTES)));
 
+// every new content written in a buffer gets a new serial, see dt_mipmap_buffer_t.serial
+static uint32_t _mipmap_serial = 0;
+
+static inline uint32_t _next_serial(void)
+{
+  return __sync_add_and_fetch(&_mipmap_serial, 1);
+}
+
 static inline void dead_image_8(dt_mipmap_buffer_t *buf)
 {
   if(!buf->buf) return;
@@ -242,6 +251,11 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width,
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const int32_t imgid,
                     const dt_mipmap_size_t size);
+static gboolean _read_f_from_disk(const dt_mipmap_cache_t *cache, struct dt_mipmap_buffer_dsc *dsc,
+                                  const int32_t imgid);
+static void _write_f_to_disk(const dt_mipmap_cache_t *cache, const struct dt_mipmap_buffer_dsc *dsc,
+                             const int32_t imgid);
+static void _f_disk_filename(const dt_mipmap_cache_t *cache, const int32_t imgid, char *filename, size_t size);
 
 // callback for the imageio core to allocate memory.
 // only needed for _F and _FULL buffers, as they change size
@@ -291,6 +305,7 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   dsc->iscale = 1.0f;
   dsc->color_space = DT_COLORSPACE_NONE;
   dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  dsc->serial = _next_serial();
   buf->buf = (uint8_t *)(dsc + 1);
 
   // fprintf(stderr, "full buffer allocating img %u %d x %d = %u bytes (%p)\n", img->id, img->width,
@@ -412,6 +427,7 @@ read_error:
   if(!loaded_from_disk)
     dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
   else dsc->flags = 0;
+  dsc->serial = _next_serial();
 
   // cost is just flat one for the buffer, as the buffers might have different sizes,
   // to make sure quota is meaningful.
@@ -690,6 +706,7 @@ void dt_mipmap_cache_get_with_caller(
       buf->height = dsc->height;
       buf->iscale = dsc->iscale;
       buf->color_space = dsc->color_space;
+      buf->serial = dsc->serial;
       buf->imgid = imgid;
       buf->size = mip;
 
@@ -705,6 +722,7 @@ void dt_mipmap_cache_get_with_caller(
       buf->iscale = 0.0f;
       buf->imgid = UNKNOWN_IMAGE;
       buf->color_space = DT_COLORSPACE_NONE;
+      buf->serial = 0;
       buf->size = DT_MIPMAP_NONE;
       buf->buf = NULL;
     }
@@ -804,7 +822,12 @@ void dt_mipmap_cache_get_with_caller(
       else if(mip == DT_MIPMAP_F)
       {
         ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
-        _init_f(buf, (float *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, imgid);
+        buf->color_space = DT_COLORSPACE_NONE;
+        if(!_read_f_from_disk(cache, dsc, imgid))
+        {
+          _init_f(buf, (float *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, imgid);
+          _write_f_to_disk(cache, dsc, imgid);
+        }
       }
       else
       {
@@ -814,6 +837,12 @@ void dt_mipmap_cache_get_with_caller(
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+      dsc->serial = _next_serial();
+    }
+    else if(mode == 'w')
+    {
+      // the caller is going to write new content
+      dsc->serial = _next_serial();
     }
 
     // image cache is leaving the write lock in place in case the image has been newly allocated.
@@ -849,6 +878,7 @@ void dt_mipmap_cache_get_with_caller(
     buf->height = dsc->height;
     buf->iscale = dsc->iscale;
     buf->color_space = dsc->color_space;
+    buf->serial = dsc->serial;
     buf->imgid = imgid;
     buf->size = mip;
 
@@ -927,6 +957,7 @@ void dt_mipmap_cache_get_with_caller(
     buf->width = buf->height = 0;
     buf->iscale = 0.0f;
     buf->color_space = DT_COLORSPACE_NONE;
+    buf->serial = 0;
   }
 }
 
@@ -1012,6 +1043,21 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const int32_t imgid)
     dt_mipmap_cache_remove_at_size(cache, imgid, k);
   }
 }
+
+void dt_mipmap_cache_remove_image(dt_mipmap_cache_t *cache, const int32_t imgid)
+{
+  dt_mipmap_cache_remove(cache, imgid);
+
+  // the full-size input only depends on the source file and survives history changes,
+  // it goes away with the image. Unlinked even if the disk backend got switched off since.
+  dt_mipmap_cache_evict_at_size(cache, imgid, DT_MIPMAP_F);
+  if(cache->cachedir[0])
+  {
+    char filename[PATH_MAX] = { 0 };
+    _f_disk_filename(cache, imgid, filename, sizeof(filename));
+    g_unlink(filename);
+  }
+}
 void dt_mipmap_cache_evict_at_size(dt_mipmap_cache_t *cache, const int32_t imgid, const dt_mipmap_size_t mip)
 {
   const uint32_t key = get_key(imgid, mip);
@@ -1126,6 +1172,193 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width,
 }
 
 
+/**
+ * On-disk cache of DT_MIPMAP_F.
+ *
+ * Building DT_MIPMAP_F needs the full raw decoded first, which is what makes reopening an image
+ * in darkroom slow before the preview shows up. The buffer only depends on the source file
+ * and the raw loader, not on the history, so we keep it on disk next to the thumbnails,
+ * with what the raw loader sets in the image struct: once restored, the preview pipe can run
+ * without the full raw, and the main pipe decodes it in its own thread.
+ *
+ * Only the useful part of the buffer is stored. The header is validated against the source file
+ * path, size and mtime, and the app version, since it depends on the raw loaders.
+ */
+#define DT_MIPMAP_F_DISK_MAGIC "ANSELMF"
+#define DT_MIPMAP_F_DISK_VERSION 2
+
+// the image flags set by the loaders
+#define DT_MIPMAP_F_DISK_IMAGE_FLAGS (DT_IMAGE_LDR | DT_IMAGE_RAW | DT_IMAGE_HDR | DT_IMAGE_MONOCHROME      \
+                                      | DT_IMAGE_S_RAW | DT_IMAGE_4BAYER | DT_IMAGE_MONOCHROME_BAYER)
+
+typedef struct dt_mipmap_f_disk_header_t
+{
+  char magic[8];
+  int32_t version;
+  char package_version[64];
+  char source[PATH_MAX];
+  int64_t source_size;
+  int64_t source_mtime;
+
+  // buffer
+  uint32_t width, height;
+  float iscale;
+
+  // image struct, as left by the loader
+  int32_t img_width, img_height, p_width, p_height;
+  int32_t crop_x, crop_y, crop_width, crop_height;
+  int32_t flags;
+  dt_image_loader_t loader;
+  dt_iop_buffer_dsc_t buf_dsc;
+  float d65_color_matrix[9];
+  uint16_t raw_black_level;
+  uint16_t raw_black_level_separate[4];
+  uint32_t raw_white_point;
+  uint32_t fuji_rotation_pos;
+  float pixel_aspect_ratio;
+  dt_aligned_pixel_t wb_coeffs;
+  float adobe_XYZ_to_CAM[4][3];
+} dt_mipmap_f_disk_header_t;
+
+static void _f_disk_filename(const dt_mipmap_cache_t *cache, const int32_t imgid, char *filename, size_t size)
+{
+  snprintf(filename, size, "%s.d/f/%" PRIu32 ".bin", cache->cachedir, (uint32_t)imgid);
+}
+
+// Fills the source file identity of the header. Returns FALSE if the source is not available.
+static gboolean _f_disk_source(const int32_t imgid, dt_mipmap_f_disk_header_t *header)
+{
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, header->source, sizeof(header->source), &from_cache, __FUNCTION__);
+  GStatBuf st;
+  if(!header->source[0] || g_stat(header->source, &st)) return FALSE;
+  header->source_size = st.st_size;
+  header->source_mtime = st.st_mtime;
+  return TRUE;
+}
+
+static gboolean _read_f_from_disk(const dt_mipmap_cache_t *cache, struct dt_mipmap_buffer_dsc *dsc,
+                                  const int32_t imgid)
+{
+  if(!cache->cachedir[0] || !dt_conf_get_bool("cache_disk_backend")) return FALSE;
+
+  char filename[PATH_MAX] = { 0 };
+  _f_disk_filename(cache, imgid, filename, sizeof(filename));
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return FALSE;
+
+  gboolean success = FALSE;
+  dt_mipmap_f_disk_header_t header;
+  dt_mipmap_f_disk_header_t current = { { 0 } };
+
+  if(fread(&header, sizeof(header), 1, f) != 1) goto end;
+  if(strncmp(header.magic, DT_MIPMAP_F_DISK_MAGIC, sizeof(header.magic))
+     || header.version != DT_MIPMAP_F_DISK_VERSION
+     || strncmp(header.package_version, darktable_package_version, sizeof(header.package_version)))
+    goto end;
+
+  // the source changed since
+  if(!_f_disk_source(imgid, &current) || strcmp(current.source, header.source)
+     || current.source_size != header.source_size || current.source_mtime != header.source_mtime)
+    goto end;
+
+  const size_t payload = sizeof(float) * 4 * header.width * header.height;
+  if(header.width == 0 || header.height == 0 || payload > dsc->size - sizeof(*dsc)) goto end;
+  if(fread(dsc + 1, payload, 1, f) != 1) goto end;
+
+  dsc->width = header.width;
+  dsc->height = header.height;
+  dsc->iscale = header.iscale;
+  dsc->color_space = DT_COLORSPACE_NONE;
+
+  // restore what the raw loader would have set
+  dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+  img->width = header.img_width;
+  img->height = header.img_height;
+  img->p_width = header.p_width;
+  img->p_height = header.p_height;
+  img->crop_x = header.crop_x;
+  img->crop_y = header.crop_y;
+  img->crop_width = header.crop_width;
+  img->crop_height = header.crop_height;
+  img->flags = (img->flags & ~DT_MIPMAP_F_DISK_IMAGE_FLAGS) | (header.flags & DT_MIPMAP_F_DISK_IMAGE_FLAGS);
+  img->loader = header.loader;
+  img->buf_dsc = header.buf_dsc;
+  memcpy(img->d65_color_matrix, header.d65_color_matrix, sizeof(img->d65_color_matrix));
+  img->raw_black_level = header.raw_black_level;
+  memcpy(img->raw_black_level_separate, header.raw_black_level_separate, sizeof(img->raw_black_level_separate));
+  img->raw_white_point = header.raw_white_point;
+  img->fuji_rotation_pos = header.fuji_rotation_pos;
+  img->pixel_aspect_ratio = header.pixel_aspect_ratio;
+  memcpy(img->wb_coeffs, header.wb_coeffs, sizeof(img->wb_coeffs));
+  memcpy(img->adobe_XYZ_to_CAM, header.adobe_XYZ_to_CAM, sizeof(img->adobe_XYZ_to_CAM));
+  // don't write xmp for this (we only changed db stuff):
+  dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip f for image %" PRIu32 " from disk cache\n", (uint32_t)imgid);
+  success = TRUE;
+
+end:
+  fclose(f);
+  if(!success) g_unlink(filename);
+  return success;
+}
+
+static void _write_f_to_disk(const dt_mipmap_cache_t *cache, const struct dt_mipmap_buffer_dsc *dsc,
+                             const int32_t imgid)
+{
+  if(!cache->cachedir[0] || !dt_conf_get_bool("cache_disk_backend")) return;
+  if(dsc->width <= 8 || dsc->height <= 8) return; // don't write skulls
+
+  dt_mipmap_f_disk_header_t header = { { 0 } };
+  g_strlcpy(header.magic, DT_MIPMAP_F_DISK_MAGIC, sizeof(header.magic));
+  header.version = DT_MIPMAP_F_DISK_VERSION;
+  g_strlcpy(header.package_version, darktable_package_version, sizeof(header.package_version));
+  if(!_f_disk_source(imgid, &header)) return;
+
+  header.width = dsc->width;
+  header.height = dsc->height;
+  header.iscale = dsc->iscale;
+
+  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+  // Embedded profiles and gain maps are not flat data, let the loader handle these images.
+  const gboolean flat = img->profile == NULL && img->dng_gain_maps == NULL;
+  header.img_width = img->width;
+  header.img_height = img->height;
+  header.p_width = img->p_width;
+  header.p_height = img->p_height;
+  header.crop_x = img->crop_x;
+  header.crop_y = img->crop_y;
+  header.crop_width = img->crop_width;
+  header.crop_height = img->crop_height;
+  header.flags = img->flags & DT_MIPMAP_F_DISK_IMAGE_FLAGS;
+  header.loader = img->loader;
+  header.buf_dsc = img->buf_dsc;
+  memcpy(header.d65_color_matrix, img->d65_color_matrix, sizeof(header.d65_color_matrix));
+  header.raw_black_level = img->raw_black_level;
+  memcpy(header.raw_black_level_separate, img->raw_black_level_separate, sizeof(header.raw_black_level_separate));
+  header.raw_white_point = img->raw_white_point;
+  header.fuji_rotation_pos = img->fuji_rotation_pos;
+  header.pixel_aspect_ratio = img->pixel_aspect_ratio;
+  memcpy(header.wb_coeffs, img->wb_coeffs, sizeof(header.wb_coeffs));
+  memcpy(header.adobe_XYZ_to_CAM, img->adobe_XYZ_to_CAM, sizeof(header.adobe_XYZ_to_CAM));
+  dt_image_cache_read_release(darktable.image_cache, img);
+
+  if(!flat) return;
+
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/f", cache->cachedir);
+  if(g_mkdir_with_parents(filename, 0750)) return;
+  _f_disk_filename(cache, imgid, filename, sizeof(filename));
+
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return;
+  const size_t payload = sizeof(float) * 4 * dsc->width * dsc->height;
+  const gboolean error = fwrite(&header, sizeof(header), 1, f) != 1 || fwrite(dsc + 1, payload, 1, f) != 1;
+  fclose(f);
+  if(error) g_unlink(filename);
+}
+
 // dummy functions for `export' to mipmap buffers:
 typedef struct _dummy_data_t
 {
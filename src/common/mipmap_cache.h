@@ -67,6 +67,9 @@ typedef struct dt_mipmap_buffer_t
   float iscale;
   uint8_t *buf;
   dt_colorspaces_color_profile_type_t color_space;
+  // changes every time the content of the buffer is (re)generated or written,
+  // so consumers can tell whether what they derived from it is still current
+  uint32_t serial;
   dt_cache_entry_t *cache_entry;
 } dt_mipmap_buffer_t;
 
@@ -141,6 +144,8 @@ void dt_mipmap_cache_release_with_caller(dt_mipmap_cache_t *cache, dt_mipmap_buf
 // remove thumbnails, so they will be regenerated:
 void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const int32_t imgid);
 void dt_mipmap_cache_remove_at_size(dt_mipmap_cache_t *cache, const int32_t imgid, const dt_mipmap_size_t mip);
+// same, plus the full-size buffer kept on disk, for images removed from the library:
+void dt_mipmap_cache_remove_image(dt_mipmap_cache_t *cache, const int32_t imgid);
 
 // evict thumbnails from cache. They will be written to disc if not existing
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const int32_t imgid);
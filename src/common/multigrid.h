@@ -0,0 +1,143 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+#include "common/fast_guided_filter.h"
+
+/***
+ * DOCUMENTATION
+ *
+ * Coarse-to-fine solver for iterative inpainting
+ *
+ * Inpainting by diffusion propagates the valid data into the masked areas by a few pixels
+ * per iteration, so large masked areas need many full-resolution iterations to fill.
+ * Here, the image and its mask are halved recursively, the coarsest level gets the whole
+ * iteration budget (each iteration there moves data over 2^levels more pixels, for 4^-levels
+ * of the cost), then each finer level is initialized from the upsampled coarser solution
+ * inside the mask and refined with a few sweeps only. That's the nested iteration of full multigrid,
+ * without the residual correction of a V-cycle which doesn't apply to non-linear solvers.
+ *
+ * Known pixels (mask = 0) are never overwritten by the upsampled solution, so the data
+ * fidelity term stays at full resolution.
+ *
+ * Buffers are 4 channels, the mask has 1 opacity per channel.
+ **/
+
+// Smallest side of the coarsest level: below, the wavelets and diffusion kernels
+// are wider than the image and the coarse solution gets meaningless.
+#define DT_MULTIGRID_MIN_SIZE 32
+
+/**
+ * Run `iterations` iterations of the solver in place on `image`, at resolution level `level`
+ * (0 is the input resolution, each level halves it). `finest` is TRUE for the last call
+ * on the full-resolution image, where one-shot effects like noise injection belong.
+ * Return FALSE to abort the whole solve.
+ */
+typedef gboolean (*dt_multigrid_sweep_t)(float *const restrict image, const float *const restrict mask,
+                                         const size_t width, const size_t height, const int level,
+                                         const int iterations, const gboolean finest, void *user_data);
+
+// Number of levels that can be built under `levels` before reaching DT_MULTIGRID_MIN_SIZE
+static inline int dt_multigrid_levels(const size_t width, const size_t height, const int levels)
+{
+  int l = 0;
+  size_t w = width, h = height;
+  while(l < levels && w / 2 >= DT_MULTIGRID_MIN_SIZE && h / 2 >= DT_MULTIGRID_MIN_SIZE)
+  {
+    w /= 2;
+    h /= 2;
+    l++;
+  }
+  return l;
+}
+
+__DT_CLONE_TARGETS__
+static inline void _multigrid_inject(float *const restrict image, const float *const restrict coarse,
+                                     const float *const restrict mask, const size_t size)
+{
+  // keep known pixels, take the coarse solution in masked areas, blend along the feathered edges
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+  dt_omp_firstprivate(image, coarse, mask, size) \
+  schedule(simd:static) aligned(image, coarse, mask:64)
+#endif
+  for(size_t k = 0; k < 4 * size; k++)
+    image[k] += mask[k] * (coarse[k] - image[k]);
+}
+
+static inline gboolean _multigrid_solve_rec(float *const restrict image, const float *const restrict mask,
+                                            const size_t width, const size_t height, const int level,
+                                            const int levels, const int iterations, const int fine_iterations,
+                                            dt_multigrid_sweep_t sweep, void *user_data)
+{
+  if(level == levels)
+    return sweep(image, mask, width, height, level, iterations, level == 0, user_data);
+
+  const size_t ds_width = width / 2;
+  const size_t ds_height = height / 2;
+  float *const restrict ds_image = dt_alloc_align_float(ds_width * ds_height * 4);
+  float *const restrict ds_mask = dt_alloc_align_float(ds_width * ds_height * 4);
+  float *const restrict us_image = dt_alloc_align_float(width * height * 4);
+
+  gboolean success = ds_image && ds_mask && us_image;
+
+  if(success)
+  {
+    interpolate_bilinear(image, width, height, ds_image, ds_width, ds_height, 4);
+    interpolate_bilinear(mask, width, height, ds_mask, ds_width, ds_height, 4);
+
+    success = _multigrid_solve_rec(ds_image, ds_mask, ds_width, ds_height, level + 1, levels, iterations,
+                                   fine_iterations, sweep, user_data);
+  }
+
+  if(success)
+  {
+    interpolate_bilinear(ds_image, ds_width, ds_height, us_image, width, height, 4);
+    _multigrid_inject(image, us_image, mask, width * height);
+    success = sweep(image, mask, width, height, level, fine_iterations, level == 0, user_data);
+  }
+
+  if(ds_image) dt_free_align(ds_image);
+  if(ds_mask) dt_free_align(ds_mask);
+  if(us_image) dt_free_align(us_image);
+
+  return success;
+}
+
+/**
+ * Solve in place on `image` over at most `levels` coarser levels: `iterations` sweeps on the coarsest one,
+ * then `fine_iterations` sweeps on each finer one. With `levels` = 0, this is the plain
+ * single-resolution solver running `iterations` sweeps.
+ */
+static inline gboolean dt_multigrid_solve(float *const restrict image, const float *const restrict mask,
+                                          const size_t width, const size_t height, const int levels,
+                                          const int iterations, const int fine_iterations,
+                                          dt_multigrid_sweep_t sweep, void *user_data)
+{
+  const int max_level = dt_multigrid_levels(width, height, levels);
+  return _multigrid_solve_rec(image, mask, width, height, 0, max_level, iterations, fine_iterations, sweep,
+                              user_data);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
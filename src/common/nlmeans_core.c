@@ -427,6 +427,8 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
   {
     for (int chunk_left = 0; chunk_left < roi_out->width; chunk_left += chk_width)
     {
+      // the pipe throws the output away when cancelled, skip the remaining slices
+      if(dt_dev_pixelpipe_cancelled(params->pipe)) continue;
       // locate our scratch space within the big buffer allocated above
       // we'll offset by chunk_left so that we don't have to subtract on every access
       float *const restrict tmpbuf = dt_get_perthread(scratch_buf, padded_scratch_size);
@@ -651,6 +653,8 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
   {
     for (int chunk_left = 0; chunk_left < roi_out->width; chunk_left += chk_width)
     {
+      // the pipe throws the output away when cancelled, skip the remaining slices
+      if(dt_dev_pixelpipe_cancelled(params->pipe)) continue;
       // locate our scratch space within the big buffer allocated above
       // we'll offset by chunk_left so that we don't have to subtract on every access
       float *const restrict tmpbuf = dt_get_perthread(scratch_buf, padded_scratch_size);
@@ -28,6 +28,7 @@
 #include "common/imageio.h"
 #include "common/tags.h"
 #include "control/control.h"
+#include "control/jobs.h"
 #include "develop/develop.h"
 
 
@@ -548,38 +549,195 @@ gboolean dt_styles_create_from_image(const char *name, const char *description,
   return FALSE;
 }
 
-void dt_styles_apply_to_list(const char *name, const GList *list, gboolean duplicate)
+static int32_t _styles_apply_items_to_image(const char *name, const GList *items, const gboolean duplicate,
+                                            const int32_t imgid, GList **undo);
+static GList *_styles_get_items_to_apply(const int id);
+static void _styles_reload_dev_image(const int32_t imgid);
+
+typedef struct dt_styles_apply_job_t
 {
-  gboolean selected = FALSE;
+  GList *styles; // names
+  GList *imgs;
+  GList *deferred; // images open in darkroom, styled from the GUI thread
+  GList *undo;     // dt_undo_lt_history_t, recorded from the GUI thread
+  gboolean duplicate;
+  gboolean cancelled;
+} dt_styles_apply_job_t;
+
+static void _styles_log_applied(const GList *styles)
+{
+  const guint count = g_list_length((GList *)styles);
+  if(count == 1)
+    dt_control_log(_("style %s successfully applied!"), (const char *)styles->data);
+  else
+    dt_control_log(ngettext("style successfully applied!", "styles successfully applied!", count));
+}
 
-  /* write current history changes so nothing gets lost,
-     do that only in the darkroom as there is nothing to be saved
-     when in the lighttable (and it would write over current history stack) */
-  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
-  if(cv->view(cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+static void _styles_apply_job_cleanup(void *p)
+{
+  dt_styles_apply_job_t *params = (dt_styles_apply_job_t *)p;
+  g_list_free_full(params->styles, g_free);
+  g_list_free(params->imgs);
+  g_list_free(params->deferred);
+  g_list_free_full(params->undo, dt_history_snapshot_undo_lt_history_data_free);
+  free(params);
+}
 
-  /* for each selected image apply style */
-  dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+// Runs on the GUI thread once the job is over: the undo stack, the collection
+// and the darkroom GUI are not thread-safe.
+static gboolean _styles_apply_job_done(gpointer data)
+{
+  dt_styles_apply_job_t *params = (dt_styles_apply_job_t *)data;
 
-  for(const GList *l = list; l; l = g_list_next(l))
+  for(const GList *l = params->deferred; l; l = g_list_next(l))
   {
     const int32_t imgid = GPOINTER_TO_INT(l->data);
-    dt_styles_apply_to_image(name, duplicate, imgid);
-    selected = TRUE;
+    // don't lose the edits done in darkroom while the job was running
+    if(dt_dev_is_current_image(darktable.develop, imgid)) dt_dev_write_history(darktable.develop);
+
+    for(const GList *style = params->styles; style; style = g_list_next(style))
+    {
+      const int id = dt_styles_get_id_by_name((const char *)style->data);
+      if(id == 0) continue;
+      GList *items = _styles_get_items_to_apply(id);
+      const int32_t newimgid = _styles_apply_items_to_image((const char *)style->data, items, params->duplicate,
+                                                            imgid, &params->undo);
+      g_list_free_full(items, dt_style_item_free);
+      _styles_reload_dev_image(newimgid);
+    }
   }
 
-  dt_undo_end_group(darktable.undo);
+  dt_history_snapshot_undo_record(params->undo, TRUE);
+  params->undo = NULL;
 
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+  if(params->duplicate)
+    dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_UNDEF, NULL);
+  dt_control_queue_redraw_center();
+
+  if(params->cancelled)
+    dt_control_log(_("applying styles cancelled"));
+  else
+    _styles_log_applied(params->styles);
+
+  _styles_apply_job_cleanup(params);
+  return FALSE;
+}
+
+static int32_t _styles_apply_job_run(dt_job_t *job)
+{
+  dt_styles_apply_job_t *params = (dt_styles_apply_job_t *)dt_control_job_get_params(job);
+  const guint total = g_list_length(params->imgs);
+  char message[512] = { 0 };
+  snprintf(message, sizeof(message), ngettext("applying styles to %d image", "applying styles to %d images", total),
+           total);
+  dt_control_job_set_progress_message(job, message);
+
+  // read the style items once for all images
+  GList *names = NULL;
+  GList *items = NULL;
+  for(const GList *style = params->styles; style; style = g_list_next(style))
+  {
+    const int id = dt_styles_get_id_by_name((const char *)style->data);
+    if(id == 0) continue;
+    names = g_list_prepend(names, style->data);
+    items = g_list_prepend(items, _styles_get_items_to_apply(id));
+  }
+  names = g_list_reverse(names);
+  items = g_list_reverse(items);
 
-  if(!selected)
+  double fraction = 0.0;
+  for(const GList *l = params->imgs; l && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED; l = g_list_next(l))
   {
-    dt_control_log(_("no image selected!"));
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+
+    // The darkroom loads and writes the history of its image from the GUI thread.
+    // Checking under the history lock makes sure it doesn't switch to that image while we write it.
+    dt_pthread_mutex_lock(&darktable.history_threadsafe);
+    const gboolean in_dev = dt_dev_is_current_image(darktable.develop, imgid);
+    if(!in_dev)
+      for(const GList *n = names, *i = items; n && i; n = g_list_next(n), i = g_list_next(i))
+        _styles_apply_items_to_image((const char *)n->data, (const GList *)i->data, params->duplicate, imgid,
+                                     &params->undo);
+    dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
+    if(in_dev) params->deferred = g_list_append(params->deferred, l->data);
+
+    fraction += 1.0 / total;
+    dt_control_job_set_progress(job, fraction);
   }
-  else
+
+  for(GList *i = items; i; i = g_list_next(i)) g_list_free_full((GList *)i->data, dt_style_item_free);
+  g_list_free(items);
+  g_list_free(names);
+
+  params->cancelled = dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED;
+  if(params->cancelled)
+  {
+    g_list_free(params->deferred);
+    params->deferred = NULL;
+  }
+
+  // Hand the results over to the GUI thread. The job params get freed when the job is disposed,
+  // so move them to a copy owned by the idle callback.
+  dt_styles_apply_job_t *done = malloc(sizeof(dt_styles_apply_job_t));
+  if(!done) return 1;
+  memcpy(done, params, sizeof(dt_styles_apply_job_t));
+  params->styles = params->imgs = params->deferred = params->undo = NULL;
+  g_idle_add(_styles_apply_job_done, done);
+  return 0;
+}
+
+// Apply styles to a list of images in a background job, with progress and cancel, so large selections
+// don't block the GUI. The image opened in darkroom, if any, is styled and reloaded from the GUI thread
+// when the job is over, together with the undo recording.
+static void _styles_apply_to_list(GList *styles, const GList *list, const gboolean duplicate)
+{
+  dt_styles_apply_job_t *params = calloc(1, sizeof(dt_styles_apply_job_t));
+  if(!params) return;
+  params->duplicate = duplicate;
+  for(const GList *style = styles; style; style = g_list_next(style))
+    params->styles = g_list_prepend(params->styles, g_strdup((const char *)style->data));
+  params->styles = g_list_reverse(params->styles);
+
+  for(const GList *l = list; l; l = g_list_next(l))
+  {
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+    if(dt_dev_is_current_image(darktable.develop, imgid))
+      params->deferred = g_list_prepend(params->deferred, l->data);
+    else
+      params->imgs = g_list_prepend(params->imgs, l->data);
+  }
+  params->imgs = g_list_reverse(params->imgs);
+
+  dt_job_t *job = dt_control_job_create(&_styles_apply_job_run, "apply styles");
+  if(!job)
+  {
+    _styles_apply_job_cleanup(params);
+    return;
+  }
+  dt_control_job_add_progress(job, _("apply styles"), TRUE);
+  dt_control_job_set_params(job, params, _styles_apply_job_cleanup);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+}
+
+void dt_styles_apply_to_list(const char *name, const GList *list, gboolean duplicate)
+{
+  /* write current history changes so nothing gets lost,
+     do that only in the darkroom as there is nothing to be saved
+     when in the lighttable (and it would write over current history stack) */
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view(cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+
+  if(!list)
   {
-    dt_control_log(_("style %s successfully applied!"), name);
+    dt_control_log(_("no image selected!"));
+    return;
   }
+
+  GList *styles = g_list_append(NULL, (gpointer)name);
+  _styles_apply_to_list(styles, list, duplicate);
+  g_list_free(styles);
 }
 
 void dt_multiple_styles_apply_to_list(GList *styles, const GList *list, gboolean duplicate)
@@ -606,22 +764,7 @@ void dt_multiple_styles_apply_to_list(GList *styles, const GList *list, gboolean
     return;
   }
 
-  /* for each selected image apply style */
-  dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  for(const GList *l = list; l; l = g_list_next(l))
-  {
-    const int32_t imgid = GPOINTER_TO_INT(l->data);
-    for (GList *style = styles; style; style = g_list_next(style))
-    {
-      dt_styles_apply_to_image((char*)style->data, duplicate, imgid);
-    }
-  }
-  dt_undo_end_group(darktable.undo);
-
-  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_TAG_CHANGED);
-
-  const guint styles_cnt = g_list_length(styles);
-  dt_control_log(ngettext("style successfully applied!", "styles successfully applied!", styles_cnt));
+  _styles_apply_to_list(styles, list, duplicate);
 }
 
 void dt_styles_create_from_list(const GList *list)
@@ -741,159 +884,208 @@ void dt_styles_apply_style_item(dt_develop_t *dev, dt_style_item_t *style_item,
   dt_pthread_mutex_unlock(&dev->history_mutex);
 }
 
-void dt_styles_apply_to_image(const char *name, const gboolean duplicate, const int32_t imgid)
+// read the items of the style, in the order they are applied
+static GList *_styles_get_items_to_apply(const int id)
 {
-  int id = 0;
   sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT num, module, operation, op_params, enabled,"
+                              "  blendop_params, blendop_version, multi_priority, multi_name"
+                              " FROM data.style_items WHERE styleid=?1 "
+                              " ORDER BY operation, multi_priority",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  GList *si_list = NULL;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_style_item_t *style_item = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
+
+    style_item->num = sqlite3_column_int(stmt, 0);
+    style_item->selimg_num = 0;
+    style_item->enabled = sqlite3_column_int(stmt, 4);
+    style_item->multi_priority = sqlite3_column_int(stmt, 7);
+    style_item->name = NULL;
+    style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
+    style_item->multi_name = g_strdup((char *)sqlite3_column_text(stmt, 8));
+    style_item->module_version = sqlite3_column_int(stmt, 1);
+    style_item->blendop_version = sqlite3_column_int(stmt, 6);
+    style_item->params_size = sqlite3_column_bytes(stmt, 3);
+    style_item->params = (void *)malloc(style_item->params_size);
+    memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3), style_item->params_size);
+    style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
+    style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
+    memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5), style_item->blendop_params_size);
+    style_item->iop_order = 0;
+
+    si_list = g_list_prepend(si_list, style_item);
+  }
+  sqlite3_finalize(stmt);
+  return g_list_reverse(si_list);  // list was built in reverse order, so un-reverse it
+}
 
-  if((id = dt_styles_get_id_by_name(name)) != 0)
+static gpointer _style_item_copy(gconstpointer src, gpointer data)
+{
+  const dt_style_item_t *item = (const dt_style_item_t *)src;
+  dt_style_item_t *copy = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
+  memcpy(copy, item, sizeof(dt_style_item_t));
+  copy->name = g_strdup(item->name);
+  copy->operation = g_strdup(item->operation);
+  copy->multi_name = g_strdup(item->multi_name);
+  copy->params = (void *)malloc(item->params_size);
+  memcpy(copy->params, item->params, item->params_size);
+  copy->blendop_params = (void *)malloc(item->blendop_params_size);
+  memcpy(copy->blendop_params, item->blendop_params, item->blendop_params_size);
+  return copy;
+}
+
+// apply the style items to the image, or to a duplicate of it, and return the image styled.
+// `items` is left untouched so it can be reused for the next image.
+// If `undo` is not NULL, the undo step is prepended to it instead of being recorded.
+// Nothing here touches the GUI, so it can run from a job.
+static int32_t _styles_apply_items_to_image(const char *name, const GList *items, const gboolean duplicate,
+                                            const int32_t imgid, GList **undo)
+{
+  int32_t newimgid;
+  /* check if we should make a duplicate before applying style */
+  if(duplicate)
   {
-    int32_t newimgid;
-    /* check if we should make a duplicate before applying style */
-    if(duplicate)
-    {
-      newimgid = dt_image_duplicate(imgid);
-      if(newimgid != -1)
-        dt_history_copy_and_paste_on_image(imgid, newimgid, NULL, TRUE, TRUE);
-    }
-    else
-      newimgid = imgid;
+    newimgid = dt_image_duplicate(imgid);
+    if(newimgid != -1)
+      dt_history_copy_and_paste_on_image_ext(imgid, newimgid, NULL, TRUE, TRUE, undo);
+  }
+  else
+    newimgid = imgid;
 
-    // now deal with the history
-    GList *modules_used = NULL;
+  // now deal with the history
+  GList *modules_used = NULL;
 
-    dt_develop_t _dev_dest = { 0 };
+  dt_develop_t _dev_dest = { 0 };
 
-    dt_develop_t *dev_dest = &_dev_dest;
+  dt_develop_t *dev_dest = &_dev_dest;
 
-    dt_dev_init(dev_dest, FALSE);
+  dt_dev_init(dev_dest, FALSE);
 
-    dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
-    dev_dest->image_storage.id = imgid;
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+  dev_dest->image_storage.id = imgid;
 
-    // now let's deal with the iop-order (possibly merging style & target lists)
-    GList *iop_list = dt_styles_module_order_list(name);
-    if(iop_list)
-    {
-      // the style has an iop-order, we need to merge the multi-instance from target image
-      // get target image iop-order list:
-      GList *img_iop_order_list = dt_ioppr_get_iop_order_list(newimgid, FALSE);
-      // get multi-instance modules if any:
-      GList *mi = dt_ioppr_extract_multi_instances_list(img_iop_order_list);
-      // if some where found merge them with the style list
-      if(mi) iop_list = dt_ioppr_merge_multi_instance_iop_order_list(iop_list, mi);
-      // finally we have the final list for the image
-      dt_ioppr_write_iop_order_list(iop_list, newimgid);
-      g_list_free_full(iop_list, g_free);
-      g_list_free_full(img_iop_order_list, g_free);
-    }
+  // from the module order to the after snapshot, the history of newimgid is read and rewritten in several steps
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
 
-    dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
+  // now let's deal with the iop-order (possibly merging style & target lists)
+  GList *iop_list = dt_styles_module_order_list(name);
+  if(iop_list)
+  {
+    // the style has an iop-order, we need to merge the multi-instance from target image
+    // get target image iop-order list:
+    GList *img_iop_order_list = dt_ioppr_get_iop_order_list(newimgid, FALSE);
+    // get multi-instance modules if any:
+    GList *mi = dt_ioppr_extract_multi_instances_list(img_iop_order_list);
+    // if some where found merge them with the style list
+    if(mi) iop_list = dt_ioppr_merge_multi_instance_iop_order_list(iop_list, mi);
+    // finally we have the final list for the image
+    dt_ioppr_write_iop_order_list(iop_list, newimgid);
+    g_list_free_full(iop_list, g_free);
+    g_list_free_full(img_iop_order_list, g_free);
+  }
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
+  dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
 
-    dt_dev_pop_history_items_ext(dev_dest, dt_dev_get_history_end(dev_dest));
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
+  dt_dev_pop_history_items_ext(dev_dest, dt_dev_get_history_end(dev_dest));
 
-    if (DT_IOP_ORDER_INFO)
-      fprintf(stderr,"\n^^^^^ Apply style on image %i, history size %i\n",imgid, dt_dev_get_history_end(dev_dest));
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
 
-    // go through all entries in style
-    // clang-format off
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT num, module, operation, op_params, enabled,"
-                                "  blendop_params, blendop_version, multi_priority, multi_name"
-                                " FROM data.style_items WHERE styleid=?1 "
-                                " ORDER BY operation, multi_priority",
-                                -1, &stmt, NULL);
-    // clang-format on
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    GList *si_list = NULL;
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      dt_style_item_t *style_item = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
-
-      style_item->num = sqlite3_column_int(stmt, 0);
-      style_item->selimg_num = 0;
-      style_item->enabled = sqlite3_column_int(stmt, 4);
-      style_item->multi_priority = sqlite3_column_int(stmt, 7);
-      style_item->name = NULL;
-      style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
-      style_item->multi_name = g_strdup((char *)sqlite3_column_text(stmt, 8));
-      style_item->module_version = sqlite3_column_int(stmt, 1);
-      style_item->blendop_version = sqlite3_column_int(stmt, 6);
-      style_item->params_size = sqlite3_column_bytes(stmt, 3);
-      style_item->params = (void *)malloc(style_item->params_size);
-      memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3), style_item->params_size);
-      style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
-      style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
-      memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5), style_item->blendop_params_size);
-      style_item->iop_order = 0;
-
-      si_list = g_list_prepend(si_list, style_item);
-    }
-    sqlite3_finalize(stmt);
-    si_list = g_list_reverse(si_list);  // list was built in reverse order, so un-reverse it
+  if (DT_IOP_ORDER_INFO)
+    fprintf(stderr,"\n^^^^^ Apply style on image %i, history size %i\n",imgid, dt_dev_get_history_end(dev_dest));
 
-    dt_ioppr_update_for_style_items(dev_dest, si_list, FALSE);
+  // the items priorities and order get updated for each image, work on a copy
+  GList *si_list = g_list_copy_deep((GList *)items, _style_item_copy, NULL);
 
-    for(GList *l = si_list; l; l = g_list_next(l))
-    {
-      dt_style_item_t *style_item = (dt_style_item_t *)l->data;
-      dt_styles_apply_style_item(dev_dest, style_item, &modules_used);
-    }
+  dt_ioppr_update_for_style_items(dev_dest, si_list, FALSE);
 
-    g_list_free_full(si_list, dt_style_item_free);
+  for(GList *l = si_list; l; l = g_list_next(l))
+  {
+    dt_style_item_t *style_item = (dt_style_item_t *)l->data;
+    dt_styles_apply_style_item(dev_dest, style_item, &modules_used);
+  }
+
+  g_list_free_full(si_list, dt_style_item_free);
+
+  if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv --> look for written history below\n");
+
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
 
-    if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv --> look for written history below\n");
+  dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
+  hist->imgid = newimgid;
+  dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
+  // write history and forms to db
+  dt_dev_write_history_ext(dev_dest->history, dev_dest->iop_order_list, newimgid);
+  dt_dev_write_history_end_ext(dt_dev_get_history_end(dev_dest), newimgid);
 
-    dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
-    hist->imgid = newimgid;
-    dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
+  dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
 
-    // write history and forms to db
-    dt_dev_write_history_ext(dev_dest->history, dev_dest->iop_order_list, newimgid);
-    dt_dev_write_history_end_ext(dt_dev_get_history_end(dev_dest), newimgid);
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
 
-    dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
+  if(undo)
+    *undo = g_list_prepend(*undo, hist);
+  else
+  {
     dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
     dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
                    dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
     dt_undo_end_group(darktable.undo);
+  }
 
-    dt_dev_cleanup(dev_dest);
+  dt_dev_cleanup(dev_dest);
 
-    g_list_free(modules_used);
+  g_list_free(modules_used);
 
-    /* add tag */
-    dt_dev_append_changed_tag(newimgid);
+  /* add tag */
+  dt_dev_append_changed_tag(newimgid);
 
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items(darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-      dt_dev_modules_update_multishow(darktable.develop);
-    }
+  /* update xmp file */
+  dt_control_save_xmp(newimgid);
 
-    /* update xmp file */
-    dt_control_save_xmp(newimgid);
+  /* remove old obsolete thumbnails */
+  dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+  /* update the aspect ratio. recompute only if really needed for performance reasons */
+  if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
+    dt_image_set_aspect_ratio(newimgid, TRUE);
+  else
+    dt_image_reset_aspect_ratio(newimgid, TRUE);
 
-    /* update the aspect ratio. recompute only if really needed for performance reasons */
-    if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
-      dt_image_set_aspect_ratio(newimgid, TRUE);
-    else
-      dt_image_reset_aspect_ratio(newimgid, TRUE);
+  /* redraw center view to update visible mipmaps */
+  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
 
-    /* redraw center view to update visible mipmaps */
-    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
-  }
+  return newimgid;
+}
+
+// if the image is the one in darkroom, reload its history in the GUI. GUI thread only.
+static void _styles_reload_dev_image(const int32_t imgid)
+{
+  if(!dt_dev_is_current_image(darktable.develop, imgid)) return;
+
+  dt_dev_reload_history_items(darktable.develop);
+  dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+  dt_dev_modules_update_multishow(darktable.develop);
+}
+
+void dt_styles_apply_to_image(const char *name, const gboolean duplicate, const int32_t imgid)
+{
+  const int id = dt_styles_get_id_by_name(name);
+  if(id == 0) return;
+
+  GList *items = _styles_get_items_to_apply(id);
+  const int32_t newimgid = _styles_apply_items_to_image(name, items, duplicate, imgid, NULL);
+  g_list_free_full(items, dt_style_item_free);
+
+  /* if current image in develop reload history */
+  _styles_reload_dev_image(newimgid);
 }
 
 void dt_styles_delete_by_name_adv(const char *name, const gboolean raise)
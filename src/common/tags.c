@@ -450,6 +450,53 @@ gboolean dt_tag_attach_images(const guint tagid, const GList *img, const gboolea
   return res;
 }
 
+gboolean dt_tag_attach_images_bulk(const guint tagid, const GList *img)
+{
+  if(!img || tagid == 0) return FALSE;
+
+  gchar *img_list = NULL;
+  for(const GList *images = img; images; images = g_list_next(images))
+    img_list = dt_util_dstrcat(img_list, "%d,", GPOINTER_TO_INT(images->data));
+  img_list[strlen(img_list) - 1] = '\0';
+
+  // only the images that don't have the tag yet
+  sqlite3_stmt *stmt;
+  // clang-format off
+  gchar *query = g_strdup_printf("SELECT id FROM main.images"
+                                 " WHERE id IN (%s)"
+                                 "   AND id NOT IN (SELECT imgid FROM main.tagged_images WHERE tagid = ?1)",
+                                 img_list);
+  // clang-format on
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+
+  GList *untagged = NULL;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    untagged = g_list_prepend(untagged, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_free(img_list);
+
+  // same values as an undoable attach, all inserted at once
+  GList *tags = g_list_prepend(NULL, GINT_TO_POINTER(tagid));
+  gchar *tag_list = NULL;
+  for(GList *images = g_list_reverse(untagged); images; images = g_list_next(images))
+  {
+    gchar *values = _get_tb_added_tag_string_values(GPOINTER_TO_INT(images->data), NULL, tags);
+    tag_list = dt_util_dstrcat(tag_list, "%s,", values);
+    g_free(values);
+  }
+  g_list_free(tags);
+  g_list_free(untagged);
+
+  if(!tag_list) return FALSE;
+
+  tag_list[strlen(tag_list) - 1] = '\0';
+  _bulk_add_tags(tag_list);
+  g_free(tag_list);
+  return TRUE;
+}
+
 gboolean dt_tag_attach(const guint tagid, const int32_t imgid, const gboolean undo_on, const gboolean group_on)
 {
   gboolean res = FALSE;
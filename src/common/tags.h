@@ -89,6 +89,9 @@ gboolean dt_tag_exists(const char *name, guint *tagid);
 /** attach a tag on images list. tagid id of tag to attach. img the list of image
  * id to attach tag to */
 gboolean dt_tag_attach_images(const guint tagid, const GList *img, const gboolean undo_on);
+/** attach a tag on images list without undo, with set-based queries instead of a few per image.
+ * For batch jobs touching many images. \return TRUE if at least one image got the tag */
+gboolean dt_tag_attach_images_bulk(const guint tagid, const GList *img);
 /** attach a tag on images. tagid id of tag to attach. imgid the image
  * id to attach tag to, if < 0 images to act on are used. */
 gboolean dt_tag_attach(const guint tagid, const int32_t imgid, const gboolean undo_on, const gboolean group_on);
@@ -64,6 +64,8 @@
 // short to avoid the impression that the import has gotten stuck.  Setting this too low will impact the
 // overall time for a large import.
 #define PROGRESS_UPDATE_INTERVAL 1
+// How many exported images get their 'darktable|exported' tag in one query.
+#define EXPORT_TAG_BATCH 256
 
 typedef struct dt_control_datetime_t
 {
@@ -1325,6 +1327,10 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   dt_imageio_module_data_t *sdata = settings->sdata;
 
   gboolean tag_change = FALSE;
+  // images waiting for the 'exported' tag, attached in batches
+  GList *exported = NULL;
+  guint exported_count = 0;
+  guint etagid = 0;
 
   // get a thread-safe fdata struct (one jpeg struct per thread etc):
   dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
@@ -1368,9 +1374,6 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
   fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
   g_strlcpy(fdata->style, settings->style, sizeof(fdata->style));
-  // Invariant: the tagid for 'darktable|changed' will not change while this function runs. Is this a
-  // sensible assumption?
-  guint tagid = 0, etagid = 0;
   dt_tag_new("darktable|exported", &etagid);
 
   dt_export_metadata_t metadata;
@@ -1394,10 +1397,16 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     // update the message. initialize_store() might have changed the number of images
     dt_control_job_set_progress_message(job, message);
 
-    // remove 'changed' tag from image
-    if(dt_tag_detach(tagid, imgid, FALSE, FALSE)) tag_change = TRUE;
-    // make sure the 'exported' tag is set on the image
-    if(dt_tag_attach(etagid, imgid, FALSE, FALSE)) tag_change = TRUE;
+    // make sure the 'exported' tag is set on the image. darktable| tags are never written
+    // in the exported files, so it can wait for the next batch.
+    exported = g_list_prepend(exported, GINT_TO_POINTER(imgid));
+    if(++exported_count == EXPORT_TAG_BATCH)
+    {
+      if(dt_tag_attach_images_bulk(etagid, exported)) tag_change = TRUE;
+      g_list_free(exported);
+      exported = NULL;
+      exported_count = 0;
+    }
 
     /* register export timestamp in cache */
     dt_image_cache_set_export_timestamp(darktable.image_cache, imgid);
@@ -1438,6 +1447,10 @@ end:
   // all threads free their fdata
   mformat->free_params(mformat, fdata);
 
+  // tag what remains, also when cancelled
+  if(exported && dt_tag_attach_images_bulk(etagid, exported)) tag_change = TRUE;
+  g_list_free(exported);
+
   // notify the user via the window manager
   dt_ui_notify_user();
 
@@ -18,6 +18,10 @@
 
 #include "control/jobs/develop_jobs.h"
 #include "control/jobs/control_jobs.h"
+#include "common/atomic.h"
+#include "common/image_cache.h"
+#include "common/mipmap_cache.h"
+#include "develop/dev_pool.h"
 
 static int32_t dt_dev_process_preview_job_run(dt_job_t *job)
 {
@@ -49,6 +53,82 @@ dt_job_t *dt_dev_process_image_job_create(dt_develop_t *dev)
   return job;
 }
 
+typedef struct dt_dev_preload_t
+{
+  int32_t imgid;  // the image to preload
+  int32_t anchor; // the image opened in darkroom when the preload was requested
+} dt_dev_preload_t;
+
+// The image opened in darkroom, written from the GUI thread only.
+// Jobs compare it to their anchor instead of reading darktable.develop, which they don't own.
+static dt_atomic_int _preload_anchor;
+
+void dt_dev_preload_set_anchor(const int32_t imgid)
+{
+  dt_atomic_set_int(&_preload_anchor, imgid);
+}
+
+// Don't push the current image out of the cache for a neighbour the user may never open
+static gboolean _preload_fits_budget(const int32_t imgid)
+{
+  const dt_cache_t *cache = &darktable.mipmap_cache->mip_full.cache;
+  // the cache garbage-collects past 80 % of its quota, see dt_cache_get()
+  if(cache->cost + 1 > 0.8f * cache->cost_quota) return FALSE;
+
+  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+  if(!img) return FALSE;
+  const size_t bpp = dt_image_is_raw(img) ? sizeof(float) : 4 * sizeof(float);
+  const size_t size = (size_t)img->width * img->height * bpp;
+  dt_image_cache_read_release(darktable.image_cache, img);
+
+  return size < dt_get_available_mem() / 4;
+}
+
+static int32_t dt_dev_preload_job_run(dt_job_t *job)
+{
+  dt_dev_preload_t *params = dt_control_job_get_params(job);
+
+  // The user already moved on
+  if(dt_atomic_get_int(&_preload_anchor) != params->anchor) return 0;
+  if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) return 0;
+  if(!_preload_fits_budget(params->imgid)) return 0;
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  // Loads DT_MIPMAP_F, then reads the history, which writes the default history on first opening.
+  dt_dev_pool_entry_t *entry = dt_dev_pool_acquire(darktable.dev_pool);
+  const int failed = dt_dev_reload_image(&entry->dev, &entry->pipe, params->imgid);
+  dt_dev_pool_release(darktable.dev_pool, entry, failed);
+
+  // DT_MIPMAP_F may come from the disk cache, the main pipe still needs the full raw
+  if(!failed)
+  {
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+
+  dt_show_times_f(&start, "[dev]", "to preload image %i", params->imgid);
+  return 0;
+}
+
+dt_job_t *dt_dev_preload_job_create(const int32_t imgid, const int32_t anchor)
+{
+  dt_job_t *job = dt_control_job_create(&dt_dev_preload_job_run, "develop preload image %i", imgid);
+  if(!job) return NULL;
+  dt_dev_preload_t *params = (dt_dev_preload_t *)malloc(sizeof(dt_dev_preload_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  params->imgid = imgid;
+  params->anchor = anchor;
+  dt_control_job_set_params(job, params, free);
+  return job;
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
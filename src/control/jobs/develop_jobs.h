@@ -31,6 +31,13 @@ dt_job_t *dt_dev_process_image_job_create(dt_develop_t *dev);
 
 dt_job_t *dt_dev_export_create();
 
+/** decode an image and read its history in background, so opening it in darkroom is fast.
+ *  Skipped if anchor is no longer the one set by dt_dev_preload_set_anchor() by the time the job runs. */
+dt_job_t *dt_dev_preload_job_create(const int32_t imgid, const int32_t anchor);
+
+/** record the image opened in darkroom, UNKNOWN_IMAGE when leaving it. GUI thread only. */
+void dt_dev_preload_set_anchor(const int32_t imgid);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -339,6 +339,64 @@ static size_t _develop_mask_get_post_operations(const dt_develop_blend_params_t
 }
 
 
+// Drawn and parametric masks only depend on the module input, the ROI, the blending params and the drawn forms,
+// unless they read the module output: output channels of the parametric mask, or feathering guided by the output.
+// Return the key under which the mask of the piece can be reused across its runs, or 0 if it can't.
+static uint64_t _develop_blend_mask_hash(const dt_dev_pixelpipe_iop_t *const piece,
+                                         const dt_develop_blend_params_t *const d,
+                                         const _develop_mask_post_processing *const post_operations,
+                                         const size_t post_operations_size, const dt_iop_roi_t *const roi_out)
+{
+  // Exports run once and would keep a full-size mask per module
+  if(!(piece->pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW))) return 0;
+  // Only the module being edited reruns with the same mask, while its own params change
+  if(piece->module != piece->module->dev->gui_module) return 0;
+  if(piece->bypass_cache) return 0;
+  if((d->mask_mode & DEVELOP_MASK_CONDITIONAL) && (d->blendif & DEVELOP_BLENDIF_OUTPUT_MASK)) return 0;
+  for(size_t index = 0; index < post_operations_size; ++index)
+    if(post_operations[index] == DEVELOP_MASK_POST_FEATHER_OUT) return 0;
+
+  uint64_t hash = dt_dev_pixelpipe_get_upstream_hash(piece);
+  hash = dt_hash(hash, (const char *)&piece->blendop_hash, sizeof(uint64_t));
+  return dt_hash(hash, (const char *)roi_out, sizeof(dt_iop_roi_t));
+}
+
+static gboolean _develop_blend_mask_cache_get(const dt_dev_pixelpipe_iop_t *const piece, const uint64_t hash,
+                                              float *const mask, const size_t buffsize)
+{
+  if(hash == 0 || piece->blend_mask == NULL || piece->blend_mask_hash != hash) return FALSE;
+  memcpy(mask, piece->blend_mask, buffsize * sizeof(float));
+  dt_print(DT_DEBUG_MASKS, "[blend] reusing the mask of module %s (%s) for pipe %i\n", piece->module->op,
+           piece->module->multi_name, piece->pipe->type);
+  return TRUE;
+}
+
+static void _develop_blend_mask_cache_set(dt_dev_pixelpipe_iop_t *const piece, const uint64_t hash,
+                                          const float *const mask, const size_t buffsize)
+{
+  dt_free_align(piece->blend_mask);
+  piece->blend_mask = NULL;
+  piece->blend_mask_hash = 0;
+  if(hash == 0) return;
+
+  // Keep one mask per pipe: the pieces that had the focus before may not run again to release theirs.
+  // Pieces of a pipe are processed sequentially, so the others are not in use.
+  for(GList *node = piece->pipe->nodes; node; node = g_list_next(node))
+  {
+    dt_dev_pixelpipe_iop_t *other = (dt_dev_pixelpipe_iop_t *)node->data;
+    if(other == piece || other->blend_mask == NULL) continue;
+    dt_free_align(other->blend_mask);
+    other->blend_mask = NULL;
+    other->blend_mask_hash = 0;
+  }
+
+  piece->blend_mask = dt_alloc_align_float(buffsize);
+  if(piece->blend_mask == NULL) return;
+  memcpy(piece->blend_mask, mask, buffsize * sizeof(float));
+  piece->blend_mask_hash = hash;
+}
+
+
 static inline float *_develop_blend_process_copy_region(const float *const restrict input, const size_t iwidth,
                                                         const size_t xoffs, const size_t yoffs,
                                                         const size_t owidth, const size_t oheight)
@@ -484,6 +542,9 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   // get the clipped opacity value  0 - 1
   const float opacity = fminf(fmaxf(d->opacity / 100.0f, 0.0f), 1.0f);
 
+  // drawn and parametric masks are kept while only the module params change
+  const uint64_t mask_hash = _develop_blend_mask_hash(piece, d, post_operations, post_operations_size, roi_out);
+
   // allocate space for blend mask
   float *const restrict _mask = dt_alloc_align_float(buffsize);
   if(!_mask)
@@ -528,6 +589,10 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       dt_iop_image_fill(mask, value, owidth, oheight, 1);  //mask[k] = value;
     }
   }
+  else if(_develop_blend_mask_cache_get(piece, mask_hash, mask, buffsize))
+  {
+    // same input and blending params as the last run
+  }
   else
   {
     // we blend with a drawn and/or parametric mask
@@ -624,6 +689,8 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
         _develop_blend_process_mask_tone_curve(mask, buffsize, d->contrast, d->brightness, opacity);
       }
     }
+
+    _develop_blend_mask_cache_set(piece, mask_hash, mask, buffsize);
   }
 
   // now apply blending with per-pixel opacity value as defined in mask
@@ -889,6 +956,10 @@ int dt_develop_blend_process_cl(struct dt_iop_module_t *self, struct dt_dev_pixe
   // get the clipped opacity value  0 - 1
   const float opacity = fminf(fmaxf(d->opacity / 100.0f, 0.0f), 1.0f);
 
+  // drawn and parametric masks are kept while only the module params change
+  const uint64_t mask_hash = _develop_blend_mask_hash(piece, d, post_operations, post_operations_size, roi_out);
+  gboolean mask_on_host = FALSE; // TRUE if the final mask is already in _mask
+
   // allocate space for blend mask
   float *_mask = dt_alloc_align_float(buffsize);
   if(!_mask)
@@ -1016,6 +1087,13 @@ int dt_develop_blend_process_cl(struct dt_iop_module_t *self, struct dt_dev_pixe
     err = dt_opencl_write_host_to_device(devid, mask, dev_mask_1, owidth, oheight, sizeof(float));
     if(err != CL_SUCCESS) goto error;
   }
+  else if(_develop_blend_mask_cache_get(piece, mask_hash, mask, buffsize))
+  {
+    // same input and blending params as the last run
+    err = dt_opencl_write_host_to_device(devid, mask, dev_mask_1, owidth, oheight, sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+    mask_on_host = TRUE;
+  }
   else
   {
     // we blend with a drawn and/or parametric mask
@@ -1165,6 +1243,14 @@ int dt_develop_blend_process_cl(struct dt_iop_module_t *self, struct dt_dev_pixe
     // get rid of dev_mask_2
     dt_opencl_release_mem_object(dev_mask_2);
     dev_mask_2 = NULL;
+
+    if(mask_hash)
+    {
+      err = dt_opencl_copy_device_to_host(devid, mask, dev_mask_1, owidth, oheight, sizeof(float));
+      if(err != CL_SUCCESS) goto error;
+      _develop_blend_mask_cache_set(piece, mask_hash, mask, buffsize);
+      mask_on_host = TRUE;
+    }
   }
 
   // get temporary buffer for output image to overcome readonly/writeonly limitation
@@ -1246,7 +1332,7 @@ int dt_develop_blend_process_cl(struct dt_iop_module_t *self, struct dt_dev_pixe
     dt_print(DT_DEBUG_MASKS, "[raster masks] replacing raster mask id 0 for module %s (%s) for pipe %i\n", piece->module->op,
              piece->module->multi_name, piece->pipe->type);
     //  get back final mask from the device to store it for later use
-    if(!(mask_mode & DEVELOP_MASK_RASTER))
+    if(!(mask_mode & DEVELOP_MASK_RASTER) && !mask_on_host)
     {
       err = dt_opencl_copy_device_to_host(devid, mask, dev_mask_1, owidth, oheight, sizeof(float));
       if(err != CL_SUCCESS) goto error;
@@ -360,8 +360,9 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   return 0;
 }
 
-gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t dest_imgid, GList *ops,
-                                       const gboolean copy_iop_order, const gboolean copy_full)
+gboolean dt_history_copy_and_paste_on_image_ext(const int32_t imgid, const int32_t dest_imgid, GList *ops,
+                                                const gboolean copy_iop_order, const gboolean copy_full,
+                                                GList **undo)
 {
   if(imgid == dest_imgid) return 1;
 
@@ -371,6 +372,9 @@ gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t d
     return 1;
   }
 
+  // the snapshots and the merge read and write the destination history in several steps
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
   dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
   hist->imgid = dest_imgid;
   dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
@@ -385,10 +389,18 @@ gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t d
   int ret_val = _history_copy_and_paste_on_image_merge(imgid, dest_imgid, ops, copy_full);
 
   dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
-  dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
-                 dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
-  dt_undo_end_group(darktable.undo);
+
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
+  if(undo)
+    *undo = g_list_prepend(*undo, hist);
+  else
+  {
+    dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+    dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
+                   dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
+    dt_undo_end_group(darktable.undo);
+  }
 
   /* attach changed tag reflecting actual change */
   dt_dev_append_changed_tag(dest_imgid);
@@ -407,6 +419,12 @@ gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t d
   return ret_val;
 }
 
+gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t dest_imgid, GList *ops,
+                                       const gboolean copy_iop_order, const gboolean copy_full)
+{
+  return dt_history_copy_and_paste_on_image_ext(imgid, dest_imgid, ops, copy_iop_order, copy_full, NULL);
+}
+
 GList *dt_history_duplicate(GList *hist)
 {
   GList *result = NULL;
@@ -668,10 +686,7 @@ static int _auto_save_edit(gpointer data)
   dt_get_times(&start);
   dt_toast_log(_("autosaving changes..."));
 
-  dt_pthread_mutex_lock(&dev->history_mutex);
-  dt_dev_write_history_ext(dev->history, dev->iop_order_list, dev->image_storage.id);
-  dt_dev_write_history_end_ext(dt_dev_get_history_end(dev), dev->image_storage.id);
-  dt_pthread_mutex_unlock(&dev->history_mutex);
+  dt_dev_write_history(dev);
 
   dt_control_save_xmp(dev->image_storage.id);
 
@@ -1045,10 +1060,11 @@ void dt_dev_write_history_ext(GList *dev_history, GList *iop_order_list, const i
 
 void dt_dev_write_history(dt_develop_t *dev)
 {
-  // FIXME: [CRITICAL] should lock the image history at the app level
   dt_pthread_mutex_lock(&dev->history_mutex);
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
   dt_dev_write_history_ext(dev->history, dev->iop_order_list, dev->image_storage.id);
   dt_dev_write_history_end_ext(dt_dev_get_history_end(dev), dev->image_storage.id);
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
   dt_pthread_mutex_unlock(&dev->history_mutex);
 }
 
@@ -1469,7 +1485,8 @@ static inline void _dt_dev_load_pipeline_defaults(dt_develop_t *dev)
  * because anyway, read_history_ext() init defaults only if it's the first time we open the image,
  * and then reloads everything from main.history table from database.
  *
- * None of that is thread-safe.
+ * None of that is thread-safe, so callers need to hold darktable.history_threadsafe:
+ * memory.history is a single scratch table shared by all threads.
  *
  **/
 
@@ -1717,6 +1734,12 @@ void dt_dev_read_history_ext(dt_develop_t *dev, const int32_t imgid, gboolean no
   gboolean first_run = FALSE;
   gboolean legacy_params = FALSE;
 
+  // Writing the default history and reading back the stored one is the only part
+  // touching shared database state. Keep it serialized, so concurrent pipelines
+  // (thumbnails, exports, darkroom) see either no history or a complete one.
+  // Everything after that only works on this dev's private modules.
+  dt_pthread_mutex_lock(&darktable.history_threadsafe);
+
   dt_ioppr_set_default_iop_order(dev, imgid);
 
   if(!no_image) _init_default_history(dev, imgid, &first_run, &auto_apply_modules);
@@ -1764,6 +1787,8 @@ void dt_dev_read_history_ext(dt_develop_t *dev, const int32_t imgid, gboolean no
   // Note: until there, we had only blendops. No masks
   dt_masks_read_masks_history(dev, imgid);
 
+  dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+
   // Copy and publish the masks on the raster stack for other modules to find
   for(GList *history = g_list_first(dev->history); history; history = g_list_next(history))
   {
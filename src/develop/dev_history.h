@@ -103,7 +103,11 @@ int dt_history_merge_module_into_history(struct dt_develop_t *dev_dest, struct d
 
 
 /** copy history from imgid and pasts on dest_imgid, merge or overwrite... */
-int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, GList *ops, gboolean copy_iop_order, const gboolean copy_full);
+gboolean dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, GList *ops, gboolean copy_iop_order, const gboolean copy_full);
+/** same, but if `undo` is not NULL the undo step is prepended to it instead of being recorded,
+ *  for background jobs to record from the GUI thread with dt_history_snapshot_undo_record(). */
+gboolean dt_history_copy_and_paste_on_image_ext(int32_t imgid, int32_t dest_imgid, GList *ops, gboolean copy_iop_order,
+                                                const gboolean copy_full, GList **undo);
 
 
 /**
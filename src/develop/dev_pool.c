@@ -0,0 +1,138 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/dev_pool.h"
+#include "common/darktable.h"
+#include "common/debug.h"
+
+// 4 cache lines of 2048×2048 RGBA float, aka what a web-size export needs.
+#define DT_DEV_POOL_MAX_CACHE_SIZE ((size_t)4 * 2048 * 2048 * 4 * sizeof(float))
+
+void dt_dev_pool_init(dt_dev_pool_t *pool)
+{
+  pool->idle = NULL;
+  pool->max_idle = MAX(dt_worker_threads(), 1);
+  pool->max_cache_size = DT_DEV_POOL_MAX_CACHE_SIZE;
+  dt_pthread_mutex_init(&pool->lock, NULL);
+}
+
+static void _entry_destroy(dt_dev_pool_entry_t *entry)
+{
+  if(entry->pipe_inited) dt_dev_pixelpipe_cleanup(&entry->pipe);
+  dt_dev_cleanup(&entry->dev);
+  free(entry);
+}
+
+void dt_dev_pool_cleanup(dt_dev_pool_t *pool)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  g_list_free_full(pool->idle, (GDestroyNotify)_entry_destroy);
+  pool->idle = NULL;
+  dt_pthread_mutex_unlock(&pool->lock);
+  dt_pthread_mutex_destroy(&pool->lock);
+}
+
+dt_dev_pool_entry_t *dt_dev_pool_acquire(dt_dev_pool_t *pool)
+{
+  dt_dev_pool_entry_t *entry = NULL;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  if(pool->idle)
+  {
+    entry = (dt_dev_pool_entry_t *)pool->idle->data;
+    pool->idle = g_list_delete_link(pool->idle, pool->idle);
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  if(!entry)
+  {
+    entry = (dt_dev_pool_entry_t *)calloc(1, sizeof(dt_dev_pool_entry_t));
+    dt_dev_init(&entry->dev, 0);
+    entry->pipe_inited = FALSE;
+    dt_print(DT_DEBUG_DEV, "[dev_pool] new develop context\n");
+  }
+
+  return entry;
+}
+
+int dt_dev_pool_init_pipe(dt_dev_pool_entry_t *entry, const dt_dev_pixelpipe_type_t type, const int32_t width,
+                          const int32_t height, const int levels, const gboolean store_masks)
+{
+  dt_dev_pixelpipe_t *pipe = &entry->pipe;
+
+  if(entry->pipe_inited && pipe->type == type && pipe->levels == levels
+     && pipe->store_all_raster_masks == store_masks)
+  {
+    dt_dev_pixelpipe_reuse(pipe);
+    return 1;
+  }
+
+  if(entry->pipe_inited) dt_dev_pixelpipe_cleanup(pipe);
+
+  int res = 0;
+  if(type == DT_DEV_PIXELPIPE_THUMBNAIL)
+    res = dt_dev_pixelpipe_init_thumbnail(pipe, width, height);
+  else
+    res = dt_dev_pixelpipe_init_export(pipe, width, height, levels, store_masks);
+
+  // the cache struct is allocated even if its lines are not, so cleanup is always needed
+  entry->pipe_inited = TRUE;
+  return res;
+}
+
+static size_t _pipe_cache_size(const dt_dev_pixelpipe_t *pipe)
+{
+  size_t size = 0;
+  for(int k = 0; k < pipe->cache.entries; k++) size += pipe->cache.size[k];
+  return size;
+}
+
+void dt_dev_pool_release(dt_dev_pool_t *pool, dt_dev_pool_entry_t *entry, const gboolean failed)
+{
+  if(!entry) return;
+
+  if(failed)
+  {
+    _entry_destroy(entry);
+    return;
+  }
+
+  // Full-resolution exports grow the cache lines to the size of the image.
+  // Keep the modules, but don't hold on to that much memory.
+  if(entry->pipe_inited && _pipe_cache_size(&entry->pipe) > pool->max_cache_size)
+  {
+    dt_dev_pixelpipe_cleanup(&entry->pipe);
+    entry->pipe_inited = FALSE;
+  }
+
+  dt_pthread_mutex_lock(&pool->lock);
+  if(g_list_length(pool->idle) < pool->max_idle)
+  {
+    pool->idle = g_list_prepend(pool->idle, entry);
+    entry = NULL;
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  if(entry) _entry_destroy(entry);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,75 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include "develop/develop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <glib.h>
+
+/**
+ * Pool of headless develop + pixelpipe contexts for exports and thumbnails.
+ *
+ * Building a dt_develop_t instantiates every iop module, and building a pipe allocates
+ * its cache lines and one node per module. For small outputs, that setup and the matching
+ * teardown cost as much as the processing itself. Contexts are therefore kept after use
+ * and re-pointed to the next image with dt_dev_reload_image() and dt_dev_pixelpipe_reuse_nodes(),
+ * which keep module instances, piece->data and cache buffers when nothing structural changed.
+ *
+ * Contexts are not shared: one thread acquires one context and owns it until released.
+ */
+
+typedef struct dt_dev_pool_entry_t
+{
+  dt_develop_t dev;
+  dt_dev_pixelpipe_t pipe;
+  gboolean pipe_inited;
+} dt_dev_pool_entry_t;
+
+typedef struct dt_dev_pool_t
+{
+  // idle contexts, most recently used first
+  GList *idle;
+  // max number of idle contexts kept around
+  int max_idle;
+  // pipes whose cache lines weigh more than this are not kept, to not hoard memory
+  size_t max_cache_size;
+  dt_pthread_mutex_t lock;
+} dt_dev_pool_t;
+
+void dt_dev_pool_init(dt_dev_pool_t *pool);
+void dt_dev_pool_cleanup(dt_dev_pool_t *pool);
+
+/** get a context ready for dt_dev_reload_image(). Its pipe may be inited already. */
+dt_dev_pool_entry_t *dt_dev_pool_acquire(dt_dev_pool_t *pool);
+
+/** init the pipe of a context for a new image, reusing the previous allocation if it has the same type.
+ *  Same return value as dt_dev_pixelpipe_init_*(). */
+int dt_dev_pool_init_pipe(dt_dev_pool_entry_t *entry, const dt_dev_pixelpipe_type_t type, const int32_t width,
+                          const int32_t height, const int levels, const gboolean store_masks);
+
+/** give a context back. If the processing failed, it is destroyed since its state can't be trusted. */
+void dt_dev_pool_release(dt_dev_pool_t *pool, dt_dev_pool_entry_t *entry, const gboolean failed);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -40,6 +40,7 @@
 #include "develop/imageop.h"
 #include "develop/lightroom.h"
 #include "develop/masks.h"
+#include "develop/tile_cache.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
 
@@ -48,6 +49,9 @@
 #define DT_DEV_AVERAGE_DELAY_COUNT 5
 #define DT_IOP_ORDER_INFO (darktable.unmuted & DT_DEBUG_IOPORDER)
 
+// Tiles of 256×256 px RGBA 8 bits weigh 256 kiB: the budget holds about 7 screens of 4K.
+#define DT_DEV_TILE_CACHE_SIZE ((size_t)256 << 20)
+
 void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
 {
   memset(dev, 0, sizeof(dt_develop_t));
@@ -82,6 +86,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dev->preview_pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
     dt_dev_pixelpipe_init(dev->pipe);
     dt_dev_pixelpipe_init_preview(dev->preview_pipe);
+    dev->tile_cache = (dt_dev_tile_cache_t *)malloc(sizeof(dt_dev_tile_cache_t));
+    dt_dev_tile_cache_init(dev->tile_cache, DT_DEV_TILE_CACHE_SIZE);
     dev->histogram_pre_tonecurve = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
     dev->histogram_pre_levels = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
 
@@ -146,6 +152,16 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->darkroom_skip_mouse_events = 0;
 }
 
+static void _dev_free_modules(dt_develop_t *dev)
+{
+  while(dev->iop)
+  {
+    dt_iop_cleanup_module((dt_iop_module_t *)dev->iop->data);
+    free(dev->iop->data);
+    dev->iop = g_list_delete_link(dev->iop, dev->iop);
+  }
+}
+
 void dt_dev_cleanup(dt_develop_t *dev)
 {
   if(!dev) return;
@@ -171,17 +187,17 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dt_dev_pixelpipe_cleanup(dev->preview_pipe);
     free(dev->preview_pipe);
   }
+  if(dev->tile_cache)
+  {
+    dt_dev_tile_cache_cleanup(dev->tile_cache);
+    free(dev->tile_cache);
+  }
   while(dev->history)
   {
     dt_dev_free_history_item(((dt_dev_history_item_t *)dev->history->data));
     dev->history = g_list_delete_link(dev->history, dev->history);
   }
-  while(dev->iop)
-  {
-    dt_iop_cleanup_module((dt_iop_module_t *)dev->iop->data);
-    free(dev->iop->data);
-    dev->iop = g_list_delete_link(dev->iop, dev->iop);
-  }
+  _dev_free_modules(dev);
   while(dev->alliop)
   {
     dt_iop_cleanup_module((dt_iop_module_t *)dev->alliop->data);
@@ -444,6 +460,135 @@ void dt_dev_process_preview_job(dt_develop_t *dev)
 }
 
 
+// Modules collecting histograms or color picks need the pipe to actually run on the whole viewport.
+static gboolean _dev_pipe_collects_stats(const dt_dev_pixelpipe_t *pipe)
+{
+  for(const GList *node = pipe->nodes; node; node = g_list_next(node))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(!piece->enabled) continue;
+    if((piece->request_histogram & DT_REQUEST_ON)
+       || piece->module->request_color_pick != DT_REQUEST_COLORPICK_OFF)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * Process the main pipe for the (x, y, wd, ht) ROI at scale, through the tile cache.
+ *
+ * Only the bounding box of the tiles missing from the cache is sent to the pipe.
+ * Its output is split into tiles, then the viewport is put together from the tiles into
+ * pipe->output_backbuf. Same return value as dt_dev_pixelpipe_process().
+ */
+static int _dev_process_image_tiled(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const int x, const int y,
+                                    const int wd, const int ht, const float scale)
+{
+  const uint64_t hash = dt_dev_pixelpipe_get_output_hash(pipe);
+  if(!hash || !dev->tile_cache || wd <= 0 || ht <= 0 || _dev_pipe_collects_stats(pipe))
+    return dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale);
+
+  const int T = DT_DEV_TILE_SIZE;
+  const int full_width = pipe->processed_width * scale;
+  const int full_height = pipe->processed_height * scale;
+  const int tx0 = x / T, ty0 = y / T;
+  const int tx1 = (x + wd - 1) / T, ty1 = (y + ht - 1) / T;
+
+  // Bounding box of the missing tiles
+  int mx0 = INT_MAX, my0 = INT_MAX, mx1 = -1, my1 = -1;
+  for(int ty = ty0; ty <= ty1; ty++)
+    for(int tx = tx0; tx <= tx1; tx++)
+      if(!dt_dev_tile_cache_get(dev->tile_cache, dt_dev_tile_cache_key(hash, scale, tx, ty)))
+      {
+        mx0 = MIN(mx0, tx);
+        my0 = MIN(my0, ty);
+        mx1 = MAX(mx1, tx);
+        my1 = MAX(my1, ty);
+      }
+
+  if(mx1 >= 0)
+  {
+    const int rx = mx0 * T;
+    const int ry = my0 * T;
+    const int rw = MIN((mx1 + 1) * T, full_width) - rx;
+    const int rh = MIN((my1 + 1) * T, full_height) - ry;
+
+    dt_print(DT_DEBUG_DEV, "[pixelpipe] main preview: computing %i×%i px of tiles out of %i×%i px\n", rw, rh, wd,
+             ht);
+
+    const int ret = dt_dev_pixelpipe_process(pipe, dev, rx, ry, rw, rh, scale);
+    if(ret) return ret;
+
+    // The pipe may round the requested size: its output stride is backbuf_width, not rw,
+    // and tiles it didn't fully cover are not stored.
+    dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+    const int bw = pipe->backbuf_width;
+    const int bh = pipe->backbuf_height;
+    for(int ty = my0; ty <= my1; ty++)
+      for(int tx = mx0; tx <= mx1; tx++)
+      {
+        const int tw = MIN(T, full_width - tx * T);
+        const int th = MIN(T, full_height - ty * T);
+        if(tw <= 0 || th <= 0) continue;
+        if(tx * T - rx + tw > bw || ty * T - ry + th > bh) continue;
+        dt_dev_tile_cache_put(dev->tile_cache, dt_dev_tile_cache_key(hash, scale, tx, ty), pipe->backbuf, bw,
+                              tx * T - rx, ty * T - ry, tw, th);
+      }
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  }
+  else
+    dt_print(DT_DEBUG_DEV, "[pixelpipe] main preview: all %i×%i px served from tiles\n", wd, ht);
+
+  // what dt_dev_pixelpipe_process() would have set for the viewport
+  const dt_iop_roi_t roi = (dt_iop_roi_t){ x, y, wd, ht, scale };
+  const uint64_t backbuf_hash = dt_dev_pixelpipe_get_backbuf_hash(pipe, dev, &roi);
+
+  // Put the viewport together
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  if(pipe->output_backbuf == NULL || pipe->output_backbuf_width != wd || pipe->output_backbuf_height != ht)
+  {
+    g_free(pipe->output_backbuf);
+    pipe->output_backbuf_width = wd;
+    pipe->output_backbuf_height = ht;
+    pipe->output_backbuf = g_malloc0(sizeof(uint8_t) * 4 * wd * ht);
+  }
+
+  gboolean complete = TRUE;
+  for(int ty = ty0; ty <= ty1; ty++)
+    for(int tx = tx0; tx <= tx1; tx++)
+    {
+      const dt_dev_tile_t *tile = dt_dev_tile_cache_get(dev->tile_cache, dt_dev_tile_cache_key(hash, scale, tx, ty));
+      if(!tile)
+      {
+        // evicted while we were filling the viewport: budget too small for the screen
+        complete = FALSE;
+        continue;
+      }
+      // intersection of the tile with the viewport, in image coordinates
+      const int ix0 = MAX(x, tx * T), iy0 = MAX(y, ty * T);
+      const int ix1 = MIN(x + wd, tx * T + tile->width), iy1 = MIN(y + ht, ty * T + tile->height);
+      for(int j = iy0; j < iy1; j++)
+        memcpy(pipe->output_backbuf + ((size_t)(j - y) * wd + (ix0 - x)) * 4,
+               tile->pixels + ((size_t)(j - ty * T) * tile->width + (ix0 - tx * T)) * 4,
+               (size_t)(ix1 - ix0) * 4);
+    }
+
+  pipe->backbuf = pipe->output_backbuf;
+  pipe->backbuf_width = wd;
+  pipe->backbuf_height = ht;
+  pipe->backbuf_hash = backbuf_hash;
+  pipe->output_imgid = pipe->image.id;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
+  if(!complete)
+  {
+    dt_dev_tile_cache_flush(dev->tile_cache);
+    return dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale);
+  }
+
+  return 0;
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   // -1×-1 px means the dimensions of the main preview in darkroom were not inited yet.
@@ -525,7 +670,7 @@ void dt_dev_process_image_job(dt_develop_t *dev)
     dt_times_t start;
     dt_get_times(&start);
 
-    int ret = dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale);
+    int ret = _dev_process_image_tiled(dev, pipe, x, y, wd, ht, scale);
 
     dt_show_times(&start, "[dev_process_image] pixel pipeline processing");
 
@@ -572,13 +717,12 @@ static inline int _dt_dev_load_raw(dt_develop_t *dev, const int32_t imgid)
   dt_get_times(&start);
 
   // Test we got images. Also that populates the cache for later.
+  // When DT_MIPMAP_F is restored from the disk cache, along with the image properties set by the raw loader,
+  // the full raw is not decoded here: the main pipe will do it in its own thread.
+  // Otherwise, building DT_MIPMAP_F decodes the full raw, and failures give an empty buffer.
   dt_mipmap_buffer_t buf;
-  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
-  gboolean no_valid_image = buf.buf == NULL;
-  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-
   dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
-  gboolean no_valid_thumb = buf.buf == NULL;
+  gboolean no_valid_image = (buf.buf == NULL || buf.width == 0 || buf.height == 0);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
   dt_show_times_f(&start, "[dev]", "to load the image.");
@@ -587,7 +731,7 @@ static inline int _dt_dev_load_raw(dt_develop_t *dev, const int32_t imgid)
   dev->image_storage = *image;
   dt_image_cache_read_release(darktable.image_cache, image);
 
-  return (no_valid_image || no_valid_thumb);
+  return no_valid_image;
 }
 
 float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_factor, int preview)
@@ -648,6 +792,83 @@ int dt_dev_load_image(dt_develop_t *dev, const int32_t imgid)
   return 0;
 }
 
+// A dev can keep its modules only if it holds exactly one base instance per .so,
+// aka if no history or style added extra instances for the previous image.
+static gboolean _dev_modules_reusable(dt_develop_t *dev)
+{
+  if(!dev->iop) return FALSE;
+  if(g_list_length(dev->iop) != g_list_length(darktable.iop)) return FALSE;
+
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    if(module->multi_priority != 0) return FALSE;
+  }
+  return TRUE;
+}
+
+int dt_dev_reload_image(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe, const int32_t imgid)
+{
+  if(!dev->iop) return dt_dev_load_image(dev, imgid);
+
+  // GUI devs have widgets bound to their modules, they need the full path.
+  g_assert(!dev->gui_attached);
+
+  if(_dt_dev_load_raw(dev, imgid)) return 1;
+
+  dt_pthread_mutex_lock(&dev->history_mutex);
+
+  while(dev->history)
+  {
+    dt_dev_free_history_item(((dt_dev_history_item_t *)dev->history->data));
+    dev->history = g_list_delete_link(dev->history, dev->history);
+  }
+  dev->history_end = 0;
+
+  g_list_free_full(dev->forms, (void (*)(void *))dt_masks_free_form);
+  dev->forms = NULL;
+  g_list_free_full(dev->allforms, (void (*)(void *))dt_masks_free_form);
+  dev->allforms = NULL;
+  dev->forms_hash = 0;
+  dev->forms_changed = FALSE;
+
+  g_list_free_full(dev->iop_order_list, free);
+  dev->iop_order_list = NULL;
+
+  dev->proxy.exposure.module = NULL;
+  dev->proxy.chroma_adaptation = NULL;
+  dev->proxy.wb_is_D65 = TRUE;
+  dev->proxy.wb_coeffs[0] = 0.f;
+
+  if(_dev_modules_reusable(dev))
+  {
+    // Params and blending params get reset to the new image defaults
+    // by dt_dev_read_history_ext(), the rest is per-instance state left over by the previous image.
+    for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+    {
+      dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+      module->multi_name[0] = '\0';
+      module->iop_order = 0;
+      module->enabled = module->default_enabled;
+    }
+    dt_print(DT_DEBUG_DEV, "[dev] reusing modules to load image %i\n", imgid);
+  }
+  else
+  {
+    // Pipe nodes reference the module instances and let them cleanup their piece->data,
+    // so they have to go before the modules.
+    if(pipe) dt_dev_pixelpipe_cleanup_nodes(pipe);
+    _dev_free_modules(dev);
+    dev->iop = dt_iop_load_modules(dev);
+  }
+
+  dt_dev_read_history_ext(dev, dev->image_storage.id, FALSE);
+
+  dt_pthread_mutex_unlock(&dev->history_mutex);
+
+  return 0;
+}
+
 void dt_dev_configure_real(dt_develop_t *dev, int wd, int ht)
 {
   // Called only from Darkroom to init and update drawing size
@@ -676,6 +897,7 @@ void dt_dev_reprocess_all(dt_develop_t *dev)
   if(darktable.gui->reset || !dev || !dev->gui_attached) return;
   dt_dev_pixelpipe_cache_flush(&(dev->pipe->cache));
   dt_dev_pixelpipe_cache_flush(&(dev->preview_pipe->cache));
+  if(dev->tile_cache) dt_dev_tile_cache_flush(dev->tile_cache);
   dt_dev_pixelpipe_rebuild(dev);
 }
 
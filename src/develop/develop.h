@@ -152,6 +152,9 @@ typedef struct dt_develop_t
   struct dt_dev_pixelpipe_t *pipe, *preview_pipe;
   dt_pthread_mutex_t pipe_mutex;
 
+  // output tiles of the main pipe, for all zoom levels. GUI only.
+  struct dt_dev_tile_cache_t *tile_cache;
+
   // image under consideration, which
   // is copied each time an image is changed. this means we have some information
   // always cached (might be out of sync, so stars are not reliable), but for the iops
@@ -336,6 +339,12 @@ void dt_dev_refresh_ui_images_real(dt_develop_t *dev);
 #define dt_dev_refresh_ui_images(dev) DT_DEBUG_TRACE_WRAPPER(DT_DEBUG_DEV, dt_dev_refresh_ui_images_real, (dev))
 
 int dt_dev_load_image(dt_develop_t *dev, const int32_t imgid);
+/** re-point a non-GUI dev that already loaded an image to another one.
+ *  Module instances are kept and reset to defaults when the module set is unchanged,
+ *  otherwise they are reloaded from scratch like in dt_dev_load_image().
+ *  `pipe`, if not NULL, is a pipe whose nodes were created from `dev`: its nodes get destroyed
+ *  before the module instances they reference. */
+int dt_dev_reload_image(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe, const int32_t imgid);
 /** checks if provided imgid is the image currently in develop */
 int dt_dev_is_current_image(dt_develop_t *dev, int32_t imgid);
 
@@ -22,6 +22,7 @@
 #include "common/debug.h"
 #include "common/dtpthread.h"
 #include "common/exif.h"
+#include "common/file_location.h"
 #include "common/history.h"
 #include "common/imagebuf.h"
 #include "common/imageio_rawspeed.h"
@@ -49,6 +50,7 @@
 #endif
 
 #include <assert.h>
+#include <glib/gstdio.h>
 #include <gmodule.h>
 #include <math.h>
 #include <complex.h>
@@ -1297,15 +1299,146 @@ static void _init_presets(dt_iop_module_so_t *module_so)
 }
 
 
+/**
+ * Manifest of what _init_module_so() did for each module the last time it ran in full:
+ * the module binary signature, the number of presets it left in data.presets
+ * and the shortcut slots its GUI declared.
+ *
+ * Building a throwaway GUI for every module at startup, just to collect shortcut paths,
+ * and checking all presets for legacy versions takes most of the startup time. None of it changes
+ * unless the module binary, the app or the presets change, so we replay the manifest instead.
+ * The actual GUI of modules is only built when opening the darkroom.
+ */
+#define DT_IOP_MANIFEST_FILE "iop-manifest.ini"
+#define DT_IOP_MANIFEST_HEADER "manifest"
+
+static GKeyFile *_manifest = NULL;
+static GHashTable *_manifest_presets = NULL;
+
+static gchar *_manifest_path(void)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  return g_build_filename(cachedir, DT_IOP_MANIFEST_FILE, NULL);
+}
+
+static int _manifest_count_presets(const char *op)
+{
+  sqlite3_stmt *stmt;
+  int count = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT COUNT(*) FROM data.presets WHERE operation = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+static void _manifest_load(void)
+{
+  _manifest = g_key_file_new();
+  gchar *path = _manifest_path();
+
+  // Invalidate everything on app or blending update
+  if(g_key_file_load_from_file(_manifest, path, G_KEY_FILE_NONE, NULL))
+  {
+    gchar *version = g_key_file_get_string(_manifest, DT_IOP_MANIFEST_HEADER, "version", NULL);
+    const int blend_version = g_key_file_get_integer(_manifest, DT_IOP_MANIFEST_HEADER, "blend_version", NULL);
+    if(g_strcmp0(version, darktable_package_version) || blend_version != dt_develop_blend_version())
+    {
+      g_key_file_free(_manifest);
+      _manifest = g_key_file_new();
+    }
+    g_free(version);
+  }
+  g_free(path);
+
+  g_key_file_set_string(_manifest, DT_IOP_MANIFEST_HEADER, "version", darktable_package_version);
+  g_key_file_set_integer(_manifest, DT_IOP_MANIFEST_HEADER, "blend_version", dt_develop_blend_version());
+
+  // Presets of all modules in one query
+  _manifest_presets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT operation, COUNT(*) FROM data.presets GROUP BY operation", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    g_hash_table_insert(_manifest_presets, g_strdup((const char *)sqlite3_column_text(stmt, 0)),
+                        GINT_TO_POINTER(sqlite3_column_int(stmt, 1)));
+  sqlite3_finalize(stmt);
+}
+
+static void _manifest_save(void)
+{
+  gchar *path = _manifest_path();
+  GError *error = NULL;
+  if(!g_key_file_save_to_file(_manifest, path, &error))
+  {
+    fprintf(stderr, "[iop_manifest] can't write %s: %s\n", path, error->message);
+    g_error_free(error);
+  }
+  g_free(path);
+
+  g_key_file_free(_manifest);
+  _manifest = NULL;
+  g_hash_table_destroy(_manifest_presets);
+  _manifest_presets = NULL;
+}
+
+static gchar *_manifest_signature(dt_iop_module_so_t *module)
+{
+  GStatBuf st;
+  const gchar *filename = g_module_name(module->module);
+  if(!filename || g_stat(filename, &st)) return NULL;
+  return g_strdup_printf("%i:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT, module->version(), (gint64)st.st_mtime,
+                         (gint64)st.st_size);
+}
+
+static gboolean _manifest_is_current(dt_iop_module_so_t *module, const gchar *signature)
+{
+  if(!signature || !g_key_file_has_group(_manifest, module->op)) return FALSE;
+
+  gchar *stored = g_key_file_get_string(_manifest, module->op, "signature", NULL);
+  const gboolean same_so = !g_strcmp0(stored, signature);
+  g_free(stored);
+
+  const int presets = g_key_file_get_integer(_manifest, module->op, "presets", NULL);
+  const gboolean same_presets
+      = (presets == GPOINTER_TO_INT(g_hash_table_lookup(_manifest_presets, module->op)));
+
+  // a run without GUI doesn't record shortcuts
+  const gboolean has_accels = !darktable.gui || g_key_file_has_key(_manifest, module->op, "accels", NULL);
+
+  return same_so && same_presets && has_accels;
+}
+
 static void _init_module_so(void *m)
 {
   dt_iop_module_so_t *module = (dt_iop_module_so_t *)m;
 
-  _init_presets(module);
+  gchar *signature = _manifest_signature(module);
+  const gboolean cached = _manifest_is_current(module, signature);
+
+  if(!cached)
+  {
+    // recorded shortcuts belong to the previous signature. A run without GUI doesn't record new ones,
+    // so drop them now rather than let the next GUI run replay stale slots.
+    g_key_file_remove_key(_manifest, module->op, "accels", NULL);
+    _init_presets(module);
+  }
 
+  if(cached && darktable.gui)
+  {
+    // Restore the shortcut slots. The GUI built later in darkroom will take them over.
+    gsize length = 0;
+    gchar **records = g_key_file_get_string_list(_manifest, module->op, "accels", &length, NULL);
+    for(gsize k = 0; k < length; k++) dt_accels_new_placeholder_shortcut(darktable.gui->accels, records[k]);
+    g_strfreev(records);
+  }
   // do not init accelerators if there is no gui
-  if(darktable.gui)
+  else if(darktable.gui)
   {
+    dt_accels_start_recording(darktable.gui->accels);
+
     // create a gui and have the widgets register their accelerators
     dt_iop_module_t *module_instance = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
 
@@ -1337,13 +1470,28 @@ static void _init_module_so(void *m)
     }
 
     free(module_instance);
+
+    gchar **records = dt_accels_stop_recording(darktable.gui->accels);
+    g_key_file_set_string_list(_manifest, module->op, "accels", (const gchar *const *)records,
+                               records ? g_strv_length(records) : 0);
+    g_strfreev(records);
+  }
+
+  if(!cached && signature)
+  {
+    g_key_file_set_string(_manifest, module->op, "signature", signature);
+    g_key_file_set_integer(_manifest, module->op, "presets", _manifest_count_presets(module->op));
   }
+
+  g_free(signature);
 }
 
 void dt_iop_load_modules_so(void)
 {
+  _manifest_load();
   darktable.iop = dt_module_load_modules("/plugins", sizeof(dt_iop_module_so_t), dt_iop_load_module_so,
                                          _init_module_so, NULL);
+  _manifest_save();
 }
 
 int dt_iop_load_module(dt_iop_module_t *module, dt_iop_module_so_t *module_so, dt_develop_t *dev)
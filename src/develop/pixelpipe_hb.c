@@ -190,15 +190,13 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+// Reset everything that describes the last run, but not the allocations
+static void _pixelpipe_reset_state(dt_dev_pixelpipe_t *pipe)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
   pipe->processed_width = pipe->backbuf_width = pipe->iwidth = 0;
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
-  pipe->nodes = NULL;
-  pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
   pipe->backbuf = NULL;
   pipe->backbuf_scale = 0.0f;
   pipe->backbuf_zoom_x = 0.0f;
@@ -210,6 +208,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->output_imgid = UNKNOWN_IMAGE;
 
   pipe->rawdetail_mask_data = NULL;
+  pipe->rawdetail_mask_hash = 0;
   pipe->want_detail_mask = DT_DEV_DETAIL_MASK_NONE;
 
   pipe->processing = 0;
@@ -219,7 +218,22 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->tiling = 0;
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->bypass_blendif = 0;
+  pipe->export_early_scale = 1.0f;
   pipe->input_timestamp = 0;
+  pipe->work_profile_info = NULL;
+  pipe->input_profile_info = NULL;
+  pipe->output_profile_info = NULL;
+
+  pipe->status = DT_DEV_PIXELPIPE_DIRTY;
+  pipe->last_history_hash = 0;
+}
+
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+{
+  pipe->nodes = NULL;
+  pipe->backbuf_size = size;
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  _pixelpipe_reset_state(pipe);
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
   dt_pthread_mutex_init(&(pipe->backbuf_mutex), NULL);
   dt_pthread_mutex_init(&(pipe->busy_mutex), NULL);
@@ -230,15 +244,32 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->iop_order_list = NULL;
   pipe->forms = NULL;
   pipe->store_all_raster_masks = FALSE;
-  pipe->work_profile_info = NULL;
-  pipe->input_profile_info = NULL;
-  pipe->output_profile_info = NULL;
-
-  pipe->status = DT_DEV_PIXELPIPE_DIRTY;
-  pipe->last_history_hash = 0;
   return 1;
 }
 
+void dt_dev_pixelpipe_reuse(dt_dev_pixelpipe_t *pipe)
+{
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  // cache lines keep their buffers, only their content is dropped
+  dt_dev_pixelpipe_cache_flush(&(pipe->cache));
+  _pixelpipe_reset_state(pipe);
+
+  g_free(pipe->output_backbuf);
+  pipe->output_backbuf = NULL;
+  pipe->output_backbuf_width = 0;
+  pipe->output_backbuf_height = 0;
+  pipe->output_imgid = UNKNOWN_IMAGE;
+
+  dt_dev_clear_rawdetail_mask(pipe);
+
+  if(pipe->forms)
+  {
+    g_list_free_full(pipe->forms, (void (*)(void *))dt_masks_free_form);
+    pipe->forms = NULL;
+  }
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+}
+
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, float *input, int width, int height,
                                 float iscale)
 {
@@ -303,6 +334,8 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
     piece->histogram = NULL;
     g_hash_table_destroy(piece->raster_masks);
     piece->raster_masks = NULL;
+    dt_free_align(piece->blend_mask);
+    piece->blend_mask = NULL;
     free(piece);
   }
   g_list_free(pipe->nodes);
@@ -318,6 +351,40 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   pipe->iop_order_list = NULL;
 }
 
+// Init the per-image state of a node, aka everything but its module and allocations
+static void _init_node(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_module_t *module = piece->module;
+  piece->enabled = module->enabled;
+  piece->request_histogram = DT_REQUEST_ONLY_IN_GUI;
+  piece->histogram_params.roi = NULL;
+  piece->histogram_params.bins_count = 256;
+  piece->histogram_stats.bins_count = 0;
+  piece->histogram_stats.pixels = 0;
+  piece->colors
+      = ((module->default_colorspace(module, pipe, NULL) == IOP_CS_RAW) && (dt_image_is_raw(&pipe->image)))
+            ? 1
+            : 4;
+  piece->iscale = pipe->iscale;
+  piece->iwidth = pipe->iwidth;
+  piece->iheight = pipe->iheight;
+  piece->hash = 0;
+  piece->blendop_hash = 0;
+  piece->global_hash = 0;
+  piece->global_mask_hash = 0;
+  piece->bypass_cache = FALSE;
+  piece->process_cl_ready = 0;
+  piece->process_tiling_ready = 0;
+  memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
+  memset(&piece->processed_roi_out, 0, sizeof(piece->processed_roi_out));
+
+  // dsc_mask is static, single channel float image
+  memset(&piece->dsc_mask, 0, sizeof(piece->dsc_mask));
+  piece->dsc_mask.channels = 1;
+  piece->dsc_mask.datatype = TYPE_FLOAT;
+  piece->dsc_mask.filters = 0;
+}
+
 void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   // check that the pipe was actually properly cleaned up after the last run
@@ -335,44 +402,58 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   {
     dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)calloc(1, sizeof(dt_dev_pixelpipe_iop_t));
-    piece->enabled = module->enabled;
-    piece->request_histogram = DT_REQUEST_ONLY_IN_GUI;
-    piece->histogram_params.roi = NULL;
-    piece->histogram_params.bins_count = 256;
-    piece->histogram_stats.bins_count = 0;
-    piece->histogram_stats.pixels = 0;
-    piece->colors
-        = ((module->default_colorspace(module, pipe, NULL) == IOP_CS_RAW) && (dt_image_is_raw(&pipe->image)))
-              ? 1
-              : 4;
-    piece->iscale = pipe->iscale;
-    piece->iwidth = pipe->iwidth;
-    piece->iheight = pipe->iheight;
     piece->module = module;
     piece->pipe = pipe;
     piece->data = NULL;
-    piece->hash = 0;
-    piece->blendop_hash = 0;
-    piece->global_hash = 0;
-    piece->global_mask_hash = 0;
-    piece->bypass_cache = FALSE;
-    piece->process_cl_ready = 0;
-    piece->process_tiling_ready = 0;
     piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
-    memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
-    memset(&piece->processed_roi_out, 0, sizeof(piece->processed_roi_out));
-
-    // dsc_mask is static, single channel float image
-    memset(&piece->dsc_mask, 0, sizeof(piece->dsc_mask));
-    piece->dsc_mask.channels = 1;
-    piece->dsc_mask.datatype = TYPE_FLOAT;
-    piece->dsc_mask.filters = 0;
+    _init_node(pipe, piece);
 
     dt_iop_init_pipe(piece->module, pipe, piece);
     pipe->nodes = g_list_append(pipe->nodes, piece);
   }
 }
 
+gboolean dt_dev_pixelpipe_reuse_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  // Nodes can be kept only if they map the same module instances, in the same order.
+  // Compare identities, not pointers: a freed module may have its address reused by a new one.
+  gboolean same_modules = pipe->nodes && g_list_length(pipe->nodes) == g_list_length(dev->iop);
+  for(GList *a = pipe->nodes, *b = dev->iop; same_modules && a && b; a = g_list_next(a), b = g_list_next(b))
+  {
+    const dt_iop_module_t *previous = ((dt_dev_pixelpipe_iop_t *)a->data)->module;
+    const dt_iop_module_t *current = (dt_iop_module_t *)b->data;
+    same_modules = !strcmp(previous->op, current->op) && previous->multi_priority == current->multi_priority
+                   && previous->instance == current->instance;
+  }
+
+  if(!same_modules)
+  {
+    dt_dev_pixelpipe_cleanup_nodes(pipe);
+    dt_dev_pixelpipe_create_nodes(pipe, dev);
+    return FALSE;
+  }
+
+  g_list_free(pipe->iop);
+  pipe->iop = g_list_copy(dev->iop);
+  g_list_free_full(pipe->iop_order_list, free);
+  pipe->iop_order_list = dt_ioppr_iop_order_copy_deep(dev->iop_order_list);
+
+  // piece->data stays allocated, its content gets overwritten by commit_params()
+  // in the next dt_dev_pixelpipe_synch_all().
+  for(GList *nodes = pipe->nodes, *modules = dev->iop; nodes && modules;
+      nodes = g_list_next(nodes), modules = g_list_next(modules))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece->module = (dt_iop_module_t *)modules->data;
+    memset(piece->blendop_data, 0, sizeof(dt_develop_blend_params_t));
+    free(piece->histogram);
+    piece->histogram = NULL;
+    g_hash_table_remove_all(piece->raster_masks);
+    _init_node(pipe, piece);
+  }
+  return TRUE;
+}
+
 static uint64_t _default_pipe_hash(dt_dev_pixelpipe_t *pipe)
 {
   // Start with a hash that is unique, image-wise and duplicate-wise.
@@ -400,6 +481,46 @@ static uint64_t _node_hash(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_
 }
 
 
+uint64_t dt_dev_pixelpipe_get_output_hash(dt_dev_pixelpipe_t *pipe)
+{
+  uint64_t hash = _default_pipe_hash(pipe);
+  hash = dt_hash(hash, (const char *)&pipe->processed_width, sizeof(int));
+  hash = dt_hash(hash, (const char *)&pipe->processed_height, sizeof(int));
+
+  for(GList *node = g_list_first(pipe->nodes); node; node = g_list_next(node))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)node->data;
+    if(!piece->enabled) continue;
+    if(piece->module->bypass_cache) return 0;
+
+    hash = dt_hash(hash, (const char *)&piece->hash, sizeof(uint64_t));
+    hash = dt_hash(hash, (const char *)&piece->module->request_mask_display, sizeof(int));
+  }
+  return hash;
+}
+
+uint64_t dt_dev_pixelpipe_get_upstream_hash(const dt_dev_pixelpipe_iop_t *piece)
+{
+  uint64_t hash = 0;
+  for(const GList *node = piece->pipe->nodes; node && node->data != piece; node = g_list_next(node))
+  {
+    const dt_dev_pixelpipe_iop_t *prev = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(prev->enabled) hash = prev->global_hash;
+  }
+  return hash;
+}
+
+uint64_t dt_dev_pixelpipe_get_upstream_params_hash(const dt_dev_pixelpipe_iop_t *piece)
+{
+  uint64_t hash = _default_pipe_hash(piece->pipe);
+  for(const GList *node = piece->pipe->nodes; node && node->data != piece; node = g_list_next(node))
+  {
+    const dt_dev_pixelpipe_iop_t *prev = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(prev->enabled) hash = dt_hash(hash, (const char *)&prev->hash, sizeof(uint64_t));
+  }
+  return hash;
+}
+
 void dt_pixelpipe_get_global_hash(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   /* Traverse the pipeline node by node and compute the cumulative (global) hash of each module.
@@ -1294,6 +1415,10 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
     *pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
   }
 
+  // The module may have returned early because the pipe got cancelled meanwhile:
+  // its output is incomplete, don't spend time picking colors and blending it.
+  if(dt_dev_pixelpipe_cancelled(pipe)) return 1;
+
   // and save the output colorspace
   pipe->dsc.cst = module->output_colorspace(module, pipe, piece);
 
@@ -2173,14 +2298,22 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   assert(tiling.factor_cl > 0.0f);
 
   // Actual pixel processing for this module
+  // Failed or cancelled processing leaves the output cache line half-written under the new hash:
+  // drop it so no later run picks it up.
 #ifdef HAVE_OPENCL
   if (pixelpipe_process_on_GPU(pipe, dev, input, cl_mem_input, input_format, &roi_in, output, cl_mem_output, out_format, roi_out,
                                module, piece, &tiling, &pixelpipe_flow, in_bpp, bpp))
+  {
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
     return 1;
+  }
 #else
   if (pixelpipe_process_on_CPU(pipe, dev, input, input_format, &roi_in, output, out_format, roi_out,
                                module, piece, &tiling, &pixelpipe_flow))
+  {
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
     return 1;
+  }
 #endif
 
   // Get the pipe-global histograms. We want float32 buffers, so we take all outputs
@@ -2262,6 +2395,17 @@ void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
   }
 }
 
+void dt_dev_pixelpipe_disable_from(dt_dev_pixelpipe_t *pipe, const char *op)
+{
+  gboolean found = FALSE;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    found |= piece->enabled && !strcmp(piece->module->op, op);
+    if(found) piece->enabled = 0;
+  }
+}
+
 static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                                      void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                                      const dt_iop_roi_t *roi_out, GList *modules, GList *pieces,
@@ -2463,6 +2607,13 @@ restart:;
   return 0;
 }
 
+uint64_t dt_dev_pixelpipe_get_backbuf_hash(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi)
+{
+  dt_dev_pixelpipe_get_roi_in(pipe, dev, *roi);
+  dt_pixelpipe_get_global_hash(pipe, dev);
+  return _node_hash(pipe, _last_node_in_pipe(pipe), roi, g_list_length(pipe->iop));
+}
+
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
@@ -2692,6 +2843,17 @@ void dt_dev_clear_rawdetail_mask(dt_dev_pixelpipe_t *pipe)
 {
   if(pipe->rawdetail_mask_data) dt_free_align(pipe->rawdetail_mask_data);
   pipe->rawdetail_mask_data = NULL;
+  pipe->rawdetail_mask_hash = 0;
+}
+
+// The detail mask only depends on the buffer it's computed from, which is the output
+// of the writing module or an intermediate step of it, so its global hash identifies it.
+// Return 0 if it can't be trusted.
+static uint64_t _rawdetail_mask_hash(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in)
+{
+  if(piece->bypass_cache || piece->global_hash == 0) return 0;
+  uint64_t hash = dt_hash(piece->global_hash, (const char *)roi_in, sizeof(dt_iop_roi_t));
+  return dt_hash(hash, (const char *)&piece->pipe->want_detail_mask, sizeof(int));
 }
 
 gboolean dt_dev_write_rawdetail_mask(dt_dev_pixelpipe_iop_t *piece, float *const rgb, const dt_iop_roi_t *const roi_in, const int mode)
@@ -2705,6 +2867,9 @@ gboolean dt_dev_write_rawdetail_mask(dt_dev_pixelpipe_iop_t *piece, float *const
   }
   if((p->want_detail_mask & ~DT_DEV_DETAIL_MASK_REQUIRED) != mode) return FALSE;
 
+  const uint64_t hash = _rawdetail_mask_hash(piece, roi_in);
+  if(hash && p->rawdetail_mask_data && p->rawdetail_mask_hash == hash) return FALSE;
+
   dt_dev_clear_rawdetail_mask(p);
 
   const int width = roi_in->width;
@@ -2724,6 +2889,7 @@ gboolean dt_dev_write_rawdetail_mask(dt_dev_pixelpipe_iop_t *piece, float *const
     wb[0] = wb[1] = wb[2] = 1.0f;
   }
   dt_masks_calc_rawdetail_mask(rgb, mask, tmp, width, height, wb);
+  p->rawdetail_mask_hash = hash;
   dt_free_align(tmp);
   dt_print(DT_DEBUG_MASKS, "[dt_dev_write_rawdetail_mask] %i (%ix%i)\n", mode, roi_in->width, roi_in->height);
   return FALSE;
@@ -2748,6 +2914,9 @@ gboolean dt_dev_write_rawdetail_mask_cl(dt_dev_pixelpipe_iop_t *piece, cl_mem in
 
   if((p->want_detail_mask & ~DT_DEV_DETAIL_MASK_REQUIRED) != mode) return FALSE;
 
+  const uint64_t hash = _rawdetail_mask_hash(piece, roi_in);
+  if(hash && p->rawdetail_mask_data && p->rawdetail_mask_hash == hash) return FALSE;
+
   dt_dev_clear_rawdetail_mask(p);
 
   const int width = roi_in->width;
@@ -2803,6 +2972,7 @@ gboolean dt_dev_write_rawdetail_mask_cl(dt_dev_pixelpipe_iop_t *piece, cl_mem in
   }
 
   p->rawdetail_mask_data = mask;
+  p->rawdetail_mask_hash = hash;
   memcpy(&p->rawdetail_mask_roi, roi_in, sizeof(dt_iop_roi_t));
 
   dt_opencl_release_mem_object(out);
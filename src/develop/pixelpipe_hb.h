@@ -97,6 +97,12 @@ typedef struct dt_dev_pixelpipe_iop_t
   gboolean bypass_cache;
 
   GHashTable *raster_masks; // GList* of dt_dev_pixelpipe_raster_mask_t
+
+  // Last drawn and/or parametric blending mask, reused by blend.c as long as
+  // the input, the ROI and the blending params don't change. 0 hash if none.
+  // Only kept for the module focused in darkroom, so at most one per pipe.
+  float *blend_mask;
+  uint64_t blend_mask_hash;
 } dt_dev_pixelpipe_iop_t;
 
 typedef enum dt_dev_pixelpipe_change_t
@@ -169,6 +175,7 @@ typedef struct dt_dev_pixelpipe_t
   // as we have to scale the mask later ke keep roi at that stage
   float *rawdetail_mask_data;
   struct dt_iop_roi_t rawdetail_mask_roi;
+  uint64_t rawdetail_mask_hash; // input of the mask, to skip rewriting an identical one
   int want_detail_mask;
 
   int output_imgid;
@@ -210,6 +217,10 @@ typedef struct dt_dev_pixelpipe_t
   // the masks generated in the pipe for later reusal are inside dt_dev_pixelpipe_iop_t
   gboolean store_all_raster_masks;
 
+  // export only: scale at which the modules before finalscale run, finalscale resampling
+  // from there to the output size. 1.0 runs them at full resolution.
+  float export_early_scale;
+
   // hash of the last history item synchronized with pipeline
   // that's because the sync_top option can't assume only one history
   // item was added since the last synchronization.
@@ -233,6 +244,9 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
 // inits the pixelpipe with given cacheline size and number of entries.
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// resets a pipe that already processed an image, so it can process another one.
+// Cache lines keep their allocations but are flushed.
+void dt_dev_pixelpipe_reuse(dt_dev_pixelpipe_t *pipe);
 // constructs a new input buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -269,6 +283,9 @@ void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe);
 // sync with develop_t history stack from scratch (new node added, have to pop old ones)
 void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
+// same as above, but keeps existing nodes and their piece->data if they map the same modules
+// in the same order. Returns TRUE if nodes were reused.
+gboolean dt_dev_pixelpipe_reuse_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // sync with develop_t history stack by just copying the top item params (same op, new params on top)
 void dt_dev_pixelpipe_synch_all_real(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, const char *caller_func);
 #define dt_dev_pixelpipe_synch_all(pipe, dev) dt_dev_pixelpipe_synch_all_real(pipe, dev, __FUNCTION__)
@@ -286,6 +303,9 @@ int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develo
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
 // disable given op and all that comes before it in the pipe:
 void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op);
+// disable the first enabled instance of given op and all that comes after it,
+// so the pipe outputs what that op gets as input:
+void dt_dev_pixelpipe_disable_from(dt_dev_pixelpipe_t *pipe, const char *op);
 
 
 // TODO: future application: remove/add modules from list, load from disk, user programmable etc
@@ -311,6 +331,34 @@ float *dt_dev_distort_detail_mask(const dt_dev_pixelpipe_t *pipe, float *src, co
 // Need to run after dt_dev_pixelpipe_get_roi_in() has updated processed ROI in/out
 void dt_pixelpipe_get_global_hash(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 
+// Hash of the pipe output content, independent of the ROI: image, module params and order, output size.
+// Returns 0 if a module bypasses the cache, meaning its output can't be identified by its params.
+uint64_t dt_dev_pixelpipe_get_output_hash(dt_dev_pixelpipe_t *pipe);
+
+// The pipe->backbuf_hash that dt_dev_pixelpipe_process() would set for that ROI,
+// for outputs put together without running the pipe.
+uint64_t dt_dev_pixelpipe_get_backbuf_hash(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev,
+                                           const struct dt_iop_roi_t *roi);
+
+// Hash of the input of a piece: the global hash of the last enabled piece before it.
+// Unlike the global hash of the piece itself, it doesn't change with the piece's own parameters,
+// so modules can key the results of an analysis of their input on it.
+uint64_t dt_dev_pixelpipe_get_upstream_hash(const dt_dev_pixelpipe_iop_t *piece);
+
+// Same as dt_dev_pixelpipe_get_upstream_hash() but blind to the ROI and to the pipe type:
+// only the image and the parameters of the enabled upstream modules go in.
+// Use it to share the results of an analysis of the whole input between the preview, full and export pipes.
+uint64_t dt_dev_pixelpipe_get_upstream_params_hash(const dt_dev_pixelpipe_iop_t *piece);
+
+// Cooperative cancellation: TRUE once the pipe has been asked to stop (history changed, image changed, shutdown).
+// Long-running process() functions and shared kernels should poll this between chunks of work
+// (tiles, wavelet scales, solver iterations) and return early. The pipe discards the output of a cancelled
+// module, so it doesn't need to be complete, only safe to free.
+static inline gboolean dt_dev_pixelpipe_cancelled(dt_dev_pixelpipe_t *pipe)
+{
+  return pipe && dt_atomic_get_int(&pipe->shutdown);
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -0,0 +1,121 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/tile_cache.h"
+#include "common/darktable.h"
+
+#include <string.h>
+
+static void _tile_free(gpointer data)
+{
+  dt_dev_tile_t *tile = (dt_dev_tile_t *)data;
+  dt_free_align(tile->pixels);
+  free(tile);
+}
+
+void dt_dev_tile_cache_init(dt_dev_tile_cache_t *cache, const size_t max_size)
+{
+  cache->tiles = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, _tile_free);
+  cache->age = 0;
+  cache->size = 0;
+  cache->max_size = max_size;
+  dt_pthread_mutex_init(&cache->lock, NULL);
+}
+
+void dt_dev_tile_cache_cleanup(dt_dev_tile_cache_t *cache)
+{
+  g_hash_table_destroy(cache->tiles);
+  cache->tiles = NULL;
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+void dt_dev_tile_cache_flush(dt_dev_tile_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  g_hash_table_remove_all(cache->tiles);
+  cache->size = 0;
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+uint64_t dt_dev_tile_cache_key(const uint64_t hash, const float scale, const int tx, const int ty)
+{
+  uint64_t key = dt_hash(hash, (const char *)&scale, sizeof(float));
+  key = dt_hash(key, (const char *)&tx, sizeof(int));
+  return dt_hash(key, (const char *)&ty, sizeof(int));
+}
+
+const dt_dev_tile_t *dt_dev_tile_cache_get(dt_dev_tile_cache_t *cache, const uint64_t key)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_dev_tile_t *tile = (dt_dev_tile_t *)g_hash_table_lookup(cache->tiles, &key);
+  if(tile) tile->age = ++cache->age;
+  dt_pthread_mutex_unlock(&cache->lock);
+  return tile;
+}
+
+// The number of tiles stays in the hundreds, a linear search for the oldest is fine.
+static void _evict_oldest(dt_dev_tile_cache_t *cache)
+{
+  GHashTableIter iter;
+  gpointer value;
+  dt_dev_tile_t *oldest = NULL;
+  g_hash_table_iter_init(&iter, cache->tiles);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    dt_dev_tile_t *tile = (dt_dev_tile_t *)value;
+    if(!oldest || tile->age < oldest->age) oldest = tile;
+  }
+  if(!oldest) return;
+  cache->size -= (size_t)oldest->width * oldest->height * 4;
+  g_hash_table_remove(cache->tiles, &oldest->key);
+}
+
+void dt_dev_tile_cache_put(dt_dev_tile_cache_t *cache, const uint64_t key, const uint8_t *const buf,
+                           const int buf_width, const int x, const int y, const int width, const int height)
+{
+  const size_t size = (size_t)width * height * 4;
+  dt_dev_tile_t *tile = (dt_dev_tile_t *)malloc(sizeof(dt_dev_tile_t));
+  tile->pixels = dt_alloc_align(size);
+  if(!tile->pixels)
+  {
+    free(tile);
+    return;
+  }
+  tile->key = key;
+  tile->width = width;
+  tile->height = height;
+
+  for(int j = 0; j < height; j++)
+    memcpy(tile->pixels + (size_t)j * width * 4, buf + ((size_t)(y + j) * buf_width + x) * 4, (size_t)width * 4);
+
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_dev_tile_t *previous = (dt_dev_tile_t *)g_hash_table_lookup(cache->tiles, &key);
+  if(previous) cache->size -= (size_t)previous->width * previous->height * 4;
+  tile->age = ++cache->age;
+  // the key is stored in the value, which lives as long as the hash table entry
+  g_hash_table_replace(cache->tiles, &tile->key, tile);
+  cache->size += size;
+  while(cache->size > cache->max_size && g_hash_table_size(cache->tiles) > 1) _evict_oldest(cache);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
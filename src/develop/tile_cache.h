@@ -0,0 +1,74 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+/**
+ * Output tiles of the darkroom main pipe, for all zoom levels.
+ *
+ * The main pipe output is split in square tiles aligned on a grid at each zoom scale,
+ * stored in display RGBA 8 bits and keyed by the ROI-independent hash of the pipe,
+ * the scale and the tile coordinates. Panning then only processes the tiles newly exposed,
+ * and going back to a zoom level already seen reuses its tiles.
+ *
+ * Only the main pipe thread uses it, the lock is for flushing from elsewhere.
+ */
+
+#define DT_DEV_TILE_SIZE 256
+
+typedef struct dt_dev_tile_t
+{
+  uint64_t key;
+  uint64_t age;
+  int width, height;
+  uint8_t *pixels; // RGBA, width * height * 4
+} dt_dev_tile_t;
+
+typedef struct dt_dev_tile_cache_t
+{
+  GHashTable *tiles; // key -> dt_dev_tile_t
+  uint64_t age;
+  size_t size;
+  size_t max_size;
+  dt_pthread_mutex_t lock;
+} dt_dev_tile_cache_t;
+
+void dt_dev_tile_cache_init(dt_dev_tile_cache_t *cache, const size_t max_size);
+void dt_dev_tile_cache_cleanup(dt_dev_tile_cache_t *cache);
+void dt_dev_tile_cache_flush(dt_dev_tile_cache_t *cache);
+
+/** key of the tile (tx, ty) of the pipe output identified by hash, at a given scale */
+uint64_t dt_dev_tile_cache_key(const uint64_t hash, const float scale, const int tx, const int ty);
+
+/** get a tile, or NULL. The tile stays valid until the next insertion or flush. */
+const dt_dev_tile_t *dt_dev_tile_cache_get(dt_dev_tile_cache_t *cache, const uint64_t key);
+
+/** copy a tile out of an RGBA 8 bits buffer and store it, evicting the oldest tiles past the size budget */
+void dt_dev_tile_cache_put(dt_dev_tile_cache_t *cache, const uint64_t key, const uint8_t *const buf,
+                           const int buf_width, const int x, const int y, const int width, const int height);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -736,6 +736,9 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
     {
       piece->pipe->tiling = 1;
 
+      /* history changed or the pipe is shutting down: the result is going to be discarded anyway */
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
 
       /* no need to process end-tiles that are smaller than the total overlap area */
@@ -812,6 +815,7 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
     }
   }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
@@ -997,6 +1001,9 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
     {
       piece->pipe->tiling = 1;
 
+      /* history changed or the pipe is shutting down: the result is going to be discarded anyway */
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       /* the output dimensions of the good part of this specific tile */
       const size_t wd = (tx + 1) * tile_wd > roi_out->width ? (size_t)roi_out->width - tx * tile_wd : tile_wd;
       const size_t ht = (ty + 1) * tile_ht > roi_out->height ? (size_t)roi_out->height - ty * tile_ht : tile_ht;
@@ -1146,6 +1153,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
       input = output = NULL;
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
@@ -1373,6 +1381,9 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
     {
       piece->pipe->tiling = 1;
 
+      /* history changed or the pipe is shutting down: the result is going to be discarded anyway */
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
       const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
 
@@ -1506,6 +1517,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
       dt_opencl_finish_sync_pipe(devid, piece->pipe->type);
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
@@ -1748,6 +1760,9 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
     {
       piece->pipe->tiling = 1;
 
+      /* history changed or the pipe is shutting down: the result is going to be discarded anyway */
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       /* the output dimensions of the good part of this specific tile */
       const size_t wd = (tx + 1) * tile_wd > roi_out->width ? (size_t)roi_out->width - tx * tile_wd : tile_wd;
       const size_t ht = (ty + 1) * tile_ht > roi_out->height ? (size_t)roi_out->height - ty * tile_ht : tile_ht;
@@ -1946,6 +1961,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
       dt_opencl_finish_sync_pipe(devid, piece->pipe->type);
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
   if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
@@ -374,6 +374,15 @@ static gboolean _get_image_buffer(GtkWidget *widget, cairo_t *cr, gpointer user_
       const int frows = 5, fcols = 5;
       dt_focus_create_clusters(full_res_focus, frows, fcols, full_res_thumb, full_res_thumb_wd,
                                 full_res_thumb_ht);
+      // the surface is shared with the thumbnails cache, draw on a private copy
+      cairo_surface_t *copy = cairo_image_surface_create(CAIRO_FORMAT_RGB24, thumb->img_width, thumb->img_height);
+      cairo_t *crc = cairo_create(copy);
+      cairo_set_source_surface(crc, thumb->img_surf, 0, 0);
+      cairo_paint(crc);
+      cairo_destroy(crc);
+      cairo_surface_destroy(thumb->img_surf);
+      thumb->img_surf = copy;
+
       // and we draw them on the image
       cairo_t *cri = cairo_create(thumb->img_surf);
       dt_focus_draw_clusters(cri, cairo_image_surface_get_width(thumb->img_surf),
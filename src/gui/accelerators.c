@@ -32,6 +32,7 @@ dt_accels_t * dt_accels_init(char *config_file, GtkWindow *window)
   accels->active_key.accel_mods = 0;
   accels->scroll.callback = NULL;
   accels->scroll.data = NULL;
+  accels->recorder = NULL;
   return accels;
 }
 
@@ -50,6 +51,7 @@ void dt_accels_cleanup(dt_accels_t *accels)
   g_object_unref(accels->lighttable_accels);
 
   g_hash_table_unref(accels->acceleratables);
+  if(accels->recorder) g_ptr_array_free(accels->recorder, TRUE);
 
   g_free(accels->config_file);
   g_free(accels);
@@ -206,11 +208,73 @@ void _add_generic_accel(dt_shortcut_t *shortcut, GtkAccelKey *key)
 }
 
 
+static int _accel_group_to_int(dt_accels_t *accels, GtkAccelGroup *accel_group)
+{
+  if(accel_group == accels->darkroom_accels) return 1;
+  if(accel_group == accels->lighttable_accels) return 2;
+  return 0;
+}
+
+static GtkAccelGroup *_int_to_accel_group(dt_accels_t *accels, const int group)
+{
+  if(group == 1) return accels->darkroom_accels;
+  if(group == 2) return accels->lighttable_accels;
+  return accels->global_accels;
+}
+
+static void _record_accel(dt_accels_t *accels, const dt_shortcut_t *shortcut)
+{
+  if(!accels->recorder) return;
+  // group, default key, default modifiers, lock, path. The path goes last since it may contain anything.
+  g_ptr_array_add(accels->recorder,
+                  g_strdup_printf("%i\t%u\t%u\t%i\t%s", _accel_group_to_int(accels, shortcut->accel_group),
+                                  shortcut->key, (guint)shortcut->mods, shortcut->locked, shortcut->path));
+}
+
 void _insert_accel(dt_accels_t *accels, dt_shortcut_t *shortcut)
 {
   // init an accel_map entry with no keys so Gtk collects them from user config later.
   gtk_accel_map_add_entry(shortcut->path, 0, 0);
   g_hash_table_insert(accels->acceleratables, shortcut->path, shortcut);
+  _record_accel(accels, shortcut);
+}
+
+
+void dt_accels_start_recording(dt_accels_t *accels)
+{
+  if(accels->recorder) g_ptr_array_free(accels->recorder, TRUE);
+  accels->recorder = g_ptr_array_new();
+}
+
+
+gchar **dt_accels_stop_recording(dt_accels_t *accels)
+{
+  if(!accels->recorder) return NULL;
+  g_ptr_array_add(accels->recorder, NULL);
+  gchar **records = (gchar **)g_ptr_array_free(accels->recorder, FALSE);
+  accels->recorder = NULL;
+  return records;
+}
+
+
+void dt_accels_new_placeholder_shortcut(dt_accels_t *accels, const gchar *record)
+{
+  gchar **fields = g_strsplit(record, "\t", 5);
+  if(g_strv_length(fields) == 5 && !g_hash_table_contains(accels->acceleratables, fields[4]))
+  {
+    dt_shortcut_t *shortcut = malloc(sizeof(dt_shortcut_t));
+    shortcut->accel_group = _int_to_accel_group(accels, atoi(fields[0]));
+    shortcut->widget = NULL;
+    shortcut->closure = NULL;
+    shortcut->path = g_strdup(fields[4]);
+    shortcut->signal = "";
+    shortcut->key = (guint)g_ascii_strtoull(fields[1], NULL, 10);
+    shortcut->mods = (GdkModifierType)g_ascii_strtoull(fields[2], NULL, 10);
+    shortcut->type = DT_SHORTCUT_UNSET;
+    shortcut->locked = atoi(fields[3]);
+    _insert_accel(accels, shortcut);
+  }
+  g_strfreev(fields);
 }
 
 
@@ -227,14 +291,21 @@ void dt_accels_new_widget_shortcut(dt_accels_t *accels, GtkWidget *widget, const
   }
   else if(shortcut && shortcut->type != DT_SHORTCUT_UNSET)
   {
-    // If we already have a shortcut object wired to Gtk for this accel path, just update it
+    // If we already have a shortcut object wired to Gtk for this accel path, just update it.
+    // Placeholders restored from a record have no widget yet.
     GtkAccelKey key = { .accel_key = shortcut->key, .accel_mods = shortcut->mods, .accel_flags = 0 };
-    if(shortcut->key > 0) _remove_widget_accel(shortcut, &key);
+    if(shortcut->key > 0 && shortcut->widget) _remove_widget_accel(shortcut, &key);
     shortcut->widget = widget;
+    shortcut->signal = signal;
     if(shortcut->key > 0) _add_widget_accel(shortcut, &key);
   }
-  // else if shortcut && shortcut->type == DT_SHORTCUT_UNSET, we need to wait for the next call to dt_accels_connect_accels()
-  else if(!shortcut)
+  else if(shortcut)
+  {
+    // Not connected yet: take it over, dt_accels_connect_accels() will do the rest
+    shortcut->widget = widget;
+    shortcut->signal = signal;
+  }
+  else
   {
     shortcut = malloc(sizeof(dt_shortcut_t));
     shortcut->accel_group = accel_group;
@@ -262,19 +333,26 @@ void dt_accels_new_action_shortcut(dt_accels_t *accels, void(*action_callback),
   gchar *accel_path = dt_accels_build_path(action_scope, action_name);
 
   dt_shortcut_t *shortcut = (dt_shortcut_t *)g_hash_table_lookup(accels->acceleratables, accel_path);
-  if(shortcut && shortcut->closure->data == data)
+  if(shortcut && shortcut->closure && shortcut->closure->data == data)
   {
     // reference is still up-to-date: nothing to do.
+    g_free(accel_path);
     return;
   }
   else if(shortcut && shortcut->type != DT_SHORTCUT_UNSET)
   {
-    // If we already have a shortcut object wired to Gtk for this accel path, just update it
+    // If we already have a shortcut object wired to Gtk for this accel path, just update it.
+    // Placeholders restored from a record have no closure yet.
     GtkAccelKey key = { .accel_key = shortcut->key, .accel_mods = shortcut->mods, .accel_flags = 0 };
-    if(shortcut->key > 0) _remove_generic_accel(shortcut);
+    if(shortcut->key > 0 && shortcut->closure) _remove_generic_accel(shortcut);
     shortcut->closure = g_cclosure_new(G_CALLBACK(action_callback), data, NULL);
     if(shortcut->key > 0) _add_generic_accel(shortcut, &key);
   }
+  else if(shortcut && !shortcut->closure)
+  {
+    // Not connected yet: take it over, dt_accels_connect_accels() will do the rest
+    shortcut->closure = g_cclosure_new(G_CALLBACK(action_callback), data, NULL);
+  }
   // else if shortcut && shortcut->type == DT_SHORTCUT_UNSET, we need to wait for the next call to dt_accels_connect_accels()
   else if(!shortcut)
   {
@@ -347,10 +425,7 @@ void _connect_accel(gpointer _key, gpointer value, gpointer user_data)
       _add_generic_accel(shortcut, &key);
     // closures can be connected only at one accel at a time, so we don't handle keypad duplicates
   }
-  else
-  {
-    fprintf(stderr, "Invalid shortcut definition for path %s: no widget and no closure given\n", shortcut->path);
-  }
+  // else: placeholder restored from a record, whoever declares that path later will wire it.
 }
 
 
@@ -48,6 +48,10 @@ typedef struct dt_accels_t
   gboolean init; // TRUE if we didn't find a keyboardrc config file at startup and we need to init a new one
   GtkAccelKey active_key;      // between key_pressed and key_release events, store the active key strokes
 
+  // When non-NULL, every new shortcut slot is also serialized in there,
+  // so it can be restored later without building the widget that declared it.
+  GPtrArray *recorder;
+
   // Views can register a global callback to handle scroll events
   // for example while keystrokes are on.
   struct scroll {
@@ -169,6 +173,33 @@ void dt_accels_new_action_shortcut(dt_accels_t *accels, void(*action_callback),
                                    guint key_val, GdkModifierType accel_mods, const gboolean lock);
 
 
+/**
+ * @brief Start serializing every new shortcut slot, until `dt_accels_stop_recording()`.
+ *
+ * @param accels
+ */
+void dt_accels_start_recording(dt_accels_t *accels);
+
+/**
+ * @brief Stop recording shortcut slots.
+ *
+ * @param accels
+ * @return gchar** NULL-terminated list of records declared since `dt_accels_start_recording()`,
+ * to be freed with `g_strfreev()`.
+ */
+gchar **dt_accels_stop_recording(dt_accels_t *accels);
+
+/**
+ * @brief Restore a shortcut slot from a record, without widget nor callback attached.
+ * It gets listed, loaded from user config and connected like any other, and the widget or action declaring
+ * the same path later takes it over.
+ *
+ * @param accels
+ * @param record one of the items returned by `dt_accels_stop_recording()`
+ */
+void dt_accels_new_placeholder_shortcut(dt_accels_t *accels, const gchar *record);
+
+
 /**
  * @brief Force our listener for all key strokes to bypass reserved Gtk keys.
  *
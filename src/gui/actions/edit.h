@@ -205,24 +205,11 @@ static void paste_all_callback()
   }
 
   GList *imgs = g_list_copy(dt_selection_get_list(darktable.selection));
-  gboolean is_darkroom_image_in_list = is_image_in_dev(imgs);
-
-  if(is_darkroom_image_in_list)
-  {
-    dt_dev_undo_start_record(darktable.develop);
-    dt_dev_write_history(darktable.develop);
-  }
 
+  // Pasting runs in a background job. The darkroom image, if in the list, gets its history
+  // saved, pasted on and reloaded from the job completion callback, followed by a redraw.
   dt_history_paste_on_list(imgs, TRUE);
 
-  if(is_darkroom_image_in_list)
-  {
-    dt_dev_undo_end_record(darktable.develop);
-    dt_dev_reload_history_items(darktable.develop);
-    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_HISTORY_CHANGE);
-  }
-
-  dt_control_queue_redraw_center();
   g_list_free(imgs);
 }
 
@@ -235,24 +222,11 @@ static void paste_parts_callback()
   }
 
   GList *imgs = g_list_copy(dt_selection_get_list(darktable.selection));
-  gboolean is_darkroom_image_in_list = is_image_in_dev(imgs);
-
-  if(is_darkroom_image_in_list)
-  {
-    dt_dev_undo_start_record(darktable.develop);
-    dt_dev_write_history(darktable.develop);
-  }
 
+  // Pasting runs in a background job. The darkroom image, if in the list, gets its history
+  // saved, pasted on and reloaded from the job completion callback, followed by a redraw.
   dt_history_paste_parts_on_list(imgs, TRUE);
 
-  if(is_darkroom_image_in_list)
-  {
-    dt_dev_undo_end_record(darktable.develop);
-    dt_dev_reload_history_items(darktable.develop);
-    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_HISTORY_CHANGE);
-  }
-
-  dt_control_queue_redraw_center();
   g_list_free(imgs);
 }
 
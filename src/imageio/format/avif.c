@@ -43,7 +43,11 @@
 #define AVIF_MAX_TILE_SIZE 3072
 #define AVIF_DEFAULT_TILE_SIZE AVIF_MIN_TILE_SIZE * 2
 
-DT_MODULE(1)
+// bound on the number of encodes to converge on the target size
+#define AVIF_TARGET_SIZE_TRIALS 6
+#define AVIF_TARGET_SIZE_MIN_QUALITY 5
+
+DT_MODULE(2)
 
 enum avif_compression_type_e
 {
@@ -63,6 +67,16 @@ enum avif_color_mode_e
   AVIF_COLOR_MODE_GRAYSCALE,
 };
 
+enum avif_effort_e
+{
+  AVIF_EFFORT_FAST = 0,
+  AVIF_EFFORT_BALANCED,
+  AVIF_EFFORT_BEST,
+};
+
+// encoder speed for each effort, AVIF_SPEED_SLOWEST is not recommended
+static const int avif_speed[] = { 9, 6, AVIF_SPEED_SLOWEST + 1 };
+
 typedef struct dt_imageio_avif_t
 {
   dt_imageio_module_data_t global;
@@ -71,6 +85,8 @@ typedef struct dt_imageio_avif_t
   uint32_t compression_type;
   uint32_t quality;
   uint32_t tiling;
+  uint32_t effort;
+  uint32_t target_size; // KiB, 0 to disable
 } dt_imageio_avif_t;
 
 typedef struct dt_imageio_avif_gui_t
@@ -80,6 +96,8 @@ typedef struct dt_imageio_avif_gui_t
   GtkWidget *compression_type;
   GtkWidget *quality;
   GtkWidget *tiling;
+  GtkWidget *effort;
+  GtkWidget *target_size;
 } dt_imageio_avif_gui_t;
 
 static const struct
@@ -198,6 +216,31 @@ void init(dt_imageio_module_format_t *self)
                                 dt_imageio_avif_t,
                                 quality,
                                 int);
+
+  /* effort */
+  luaA_enum(darktable.lua_state.state,
+            enum avif_effort_e);
+  luaA_enum_value(darktable.lua_state.state,
+                  enum avif_effort_e,
+                  AVIF_EFFORT_FAST);
+  luaA_enum_value(darktable.lua_state.state,
+                  enum avif_effort_e,
+                  AVIF_EFFORT_BALANCED);
+  luaA_enum_value(darktable.lua_state.state,
+                  enum avif_effort_e,
+                  AVIF_EFFORT_BEST);
+  dt_lua_register_module_member(darktable.lua_state.state,
+                                self,
+                                dt_imageio_avif_t,
+                                effort,
+                                enum avif_effort_e);
+
+  /* target size */
+  dt_lua_register_module_member(darktable.lua_state.state,
+                                self,
+                                dt_imageio_avif_t,
+                                target_size,
+                                int);
 #endif
 }
 
@@ -205,6 +248,157 @@ void cleanup(dt_imageio_module_format_t *self)
 {
 }
 
+/*
+ * Encode the image at the given quality into output, which the caller frees.
+ */
+static avifResult _encode(const dt_imageio_avif_t *d,
+                          const avifImage *image,
+                          const uint32_t quality,
+                          avifRWData *output)
+{
+  const size_t width = d->global.width;
+  const size_t height = d->global.height;
+
+  avifEncoder *encoder = avifEncoderCreate();
+  if(encoder == NULL)
+    return AVIF_RESULT_OUT_OF_MEMORY;
+
+  encoder->speed = avif_speed[MIN(d->effort, AVIF_EFFORT_BEST)];
+
+  /*
+   * The codec spreads its work over rows and tiles, let it use
+   * all the threads we have.
+   */
+  encoder->maxThreads = darktable.num_openmp_threads;
+
+  switch(d->compression_type)
+  {
+    case AVIF_COMP_LOSSLESS:
+      encoder->minQuantizer = AVIF_QUANTIZER_LOSSLESS;
+      encoder->maxQuantizer = AVIF_QUANTIZER_LOSSLESS;
+
+      break;
+    case AVIF_COMP_LOSSY:
+      encoder->maxQuantizer = 100 - quality;
+      encoder->maxQuantizer = CLAMP(encoder->maxQuantizer, 0, 63);
+
+      encoder->minQuantizer = 64 - quality;
+      encoder->minQuantizer = CLAMP(encoder->minQuantizer, 0, 63);
+      break;
+  }
+
+  /*
+   * Tiling reduces the image quality but it has a negligible impact on
+   * still images.
+   *
+   * The minimum size for a tile is 512x512. We use a default tile size of
+   * 1024x1024.
+   */
+  switch(d->tiling)
+  {
+    case AVIF_TILING_ON:
+    {
+      size_t width_tile_size  = AVIF_DEFAULT_TILE_SIZE;
+      size_t height_tile_size = AVIF_DEFAULT_TILE_SIZE;
+
+      if(width >= 6144)
+      {
+        width_tile_size = AVIF_MIN_TILE_SIZE * 4;
+      }
+      else if (width >= 8192) {
+        width_tile_size = AVIF_MAX_TILE_SIZE;
+      }
+      if(height >= 6144)
+      {
+        height_tile_size = AVIF_MIN_TILE_SIZE * 4;
+      }
+      else if (height >= 8192) {
+        height_tile_size = AVIF_MAX_TILE_SIZE;
+      }
+
+      encoder->tileColsLog2 = floor_log2(width / width_tile_size) / 2;
+      encoder->tileRowsLog2 = floor_log2(height / height_tile_size) / 2;
+    }
+    case AVIF_TILING_OFF:
+      break;
+  }
+
+  dt_print(DT_DEBUG_IMAGEIO,
+           "[avif quality: %u => maxQuantizer: %u, minQuantizer: %u, speed: %i, "
+           "tileColsLog2: %u, tileRowsLog2: %u, threads: %u]\n",
+           quality,
+           encoder->maxQuantizer,
+           encoder->minQuantizer,
+           encoder->speed,
+           encoder->tileColsLog2,
+           encoder->tileRowsLog2,
+           encoder->maxThreads);
+
+  const avifResult result = avifEncoderWrite(encoder, image, output);
+  avifEncoderDestroy(encoder);
+
+  return result;
+}
+
+/*
+ * Bisect the quality, below the user one, for the largest file that fits
+ * the target size. If none fits, keep the smallest we got.
+ */
+static avifResult _encode_target_size(const dt_imageio_avif_t *d,
+                                      const avifImage *image,
+                                      avifRWData *output)
+{
+  const size_t target = (size_t)d->target_size * 1024;
+
+  avifResult result = _encode(d, image, d->quality, output);
+  if(result != AVIF_RESULT_OK || output->size <= target)
+    return result;
+
+  uint32_t lo = AVIF_TARGET_SIZE_MIN_QUALITY;
+  uint32_t hi = d->quality;
+  gboolean fits = FALSE;
+
+  for(int trial = 1; trial < AVIF_TARGET_SIZE_TRIALS && lo < hi; trial++)
+  {
+    // the lowest quality is tried first if nothing fit so far, so we don't run out of trials above the target
+    const uint32_t quality = (trial == 1) ? lo : (lo + hi) / 2;
+
+    avifRWData candidate = AVIF_DATA_EMPTY;
+    result = _encode(d, image, quality, &candidate);
+    if(result != AVIF_RESULT_OK)
+    {
+      avifRWDataFree(&candidate);
+      break;
+    }
+
+    dt_print(DT_DEBUG_IMAGEIO, "[avif target size] quality %u => %zu bytes for %zu\n",
+             quality, candidate.size, target);
+
+    if(candidate.size <= target)
+    {
+      avifRWDataFree(output);
+      *output = candidate;
+      fits = TRUE;
+      lo = quality + 1;
+    }
+    else
+    {
+      if(!fits && candidate.size < output->size)
+      {
+        avifRWDataFree(output);
+        *output = candidate;
+      }
+      else
+        avifRWDataFree(&candidate);
+      hi = quality;
+      if(trial == 1) break; // even the lowest quality is too large
+    }
+  }
+
+  // we have an encoded image in any case
+  return AVIF_RESULT_OK;
+}
+
 int write_image(struct dt_imageio_module_data_t *data,
                 const char *filename,
                 const void *in,
@@ -223,7 +417,7 @@ int write_image(struct dt_imageio_module_data_t *data,
   avifPixelFormat format = AVIF_PIXEL_FORMAT_NONE;
   avifImage *image = NULL;
   avifRGBImage rgb = { .format = AVIF_RGB_FORMAT_RGB, };
-  avifEncoder *encoder = NULL;
+  avifRWData output = AVIF_DATA_EMPTY;
   uint8_t *icc_profile_data = NULL;
   uint32_t icc_profile_len;
   avifResult result;
@@ -473,95 +667,11 @@ int write_image(struct dt_imageio_module_data_t *data,
     g_free(xmp_string);
   }
 
-  encoder = avifEncoderCreate();
-  if(encoder == NULL)
-  {
-    dt_print(DT_DEBUG_IMAGEIO,
-             "Failed to create AVIF encoder for image [%s]\n",
-             filename);
-    rc = 1;
-    goto out;
-  }
-
-  switch(d->compression_type)
-  {
-    case AVIF_COMP_LOSSLESS:
-      /* It isn't recommend to use the extremities */
-      encoder->speed = AVIF_SPEED_SLOWEST + 1;
-
-      encoder->minQuantizer = AVIF_QUANTIZER_LOSSLESS;
-      encoder->maxQuantizer = AVIF_QUANTIZER_LOSSLESS;
-
-      break;
-    case AVIF_COMP_LOSSY:
-      encoder->speed = AVIF_SPEED_DEFAULT;
-
-      encoder->maxQuantizer = 100 - d->quality;
-      encoder->maxQuantizer = CLAMP(encoder->maxQuantizer, 0, 63);
-
-      encoder->minQuantizer = 64 - d->quality;
-      encoder->minQuantizer = CLAMP(encoder->minQuantizer, 0, 63);
-      break;
-  }
-
-  /*
-   * Tiling reduces the image quality but it has a negligible impact on
-   * still images.
-   *
-   * The minimum size for a tile is 512x512. We use a default tile size of
-   * 1024x1024.
-   */
-  switch(d->tiling)
-  {
-    case AVIF_TILING_ON:
-    {
-      size_t width_tile_size  = AVIF_DEFAULT_TILE_SIZE;
-      size_t height_tile_size = AVIF_DEFAULT_TILE_SIZE;
-      size_t max_threads;
-
-      if(width >= 6144)
-      {
-        width_tile_size = AVIF_MIN_TILE_SIZE * 4;
-      }
-      else if (width >= 8192) {
-        width_tile_size = AVIF_MAX_TILE_SIZE;
-      }
-      if(height >= 6144)
-      {
-        height_tile_size = AVIF_MIN_TILE_SIZE * 4;
-      }
-      else if (height >= 8192) {
-        height_tile_size = AVIF_MAX_TILE_SIZE;
-      }
-
-      encoder->tileColsLog2 = floor_log2(width / width_tile_size) / 2;
-      encoder->tileRowsLog2 = floor_log2(height / height_tile_size) / 2;
-
-      /*
-       * This should be set to the final number of tiles, based on
-       * encoder->tileColsLog2 and encoder->tileRowsLog2.
-       */
-      max_threads = (1 << encoder->tileRowsLog2) * (1 << encoder->tileColsLog2);
-
-      encoder->maxThreads = MIN(max_threads, darktable.num_openmp_threads);
-    }
-    case AVIF_TILING_OFF:
-      break;
-  }
-
-  dt_print(DT_DEBUG_IMAGEIO,
-           "[avif quality: %u => maxQuantizer: %u, minQuantizer: %u, "
-           "tileColsLog2: %u, tileRowsLog2: %u, threads: %u]\n",
-           d->quality,
-           encoder->maxQuantizer,
-           encoder->minQuantizer,
-           encoder->tileColsLog2,
-           encoder->tileRowsLog2,
-           encoder->maxThreads);
-
-  avifRWData output = AVIF_DATA_EMPTY;
+  if(d->compression_type == AVIF_COMP_LOSSY && d->target_size > 0)
+    result = _encode_target_size(d, image, &output);
+  else
+    result = _encode(d, image, d->quality, &output);
 
-  result = avifEncoderWrite(encoder, image, &output);
   if(result != AVIF_RESULT_OK)
   {
     dt_print(DT_DEBUG_IMAGEIO,
@@ -606,7 +716,6 @@ int write_image(struct dt_imageio_module_data_t *data,
 out:
   avifRGBImageFreePixels(&rgb);
   avifImageDestroy(image);
-  avifEncoderDestroy(encoder);
   avifRWDataFree(&output);
   free(icc_profile_data);
 
@@ -619,6 +728,42 @@ size_t params_size(dt_imageio_module_format_t *self)
   return sizeof(dt_imageio_avif_t);
 }
 
+void *legacy_params(dt_imageio_module_format_t *self,
+                    const void *const old_params,
+                    const size_t old_params_size,
+                    const int old_version,
+                    const int new_version,
+                    size_t *new_size)
+{
+  if(old_version == 1 && new_version == 2)
+  {
+    typedef struct dt_imageio_avif_v1_t
+    {
+      dt_imageio_module_data_t global;
+      uint32_t bit_depth;
+      uint32_t color_mode;
+      uint32_t compression_type;
+      uint32_t quality;
+      uint32_t tiling;
+    } dt_imageio_avif_v1_t;
+
+    const dt_imageio_avif_v1_t *o = (dt_imageio_avif_v1_t *)old_params;
+    dt_imageio_avif_t *n = (dt_imageio_avif_t *)malloc(sizeof(dt_imageio_avif_t));
+
+    n->global = o->global;
+    n->bit_depth = o->bit_depth;
+    n->color_mode = o->color_mode;
+    n->compression_type = o->compression_type;
+    n->quality = o->quality;
+    n->tiling = o->tiling;
+    n->effort = AVIF_EFFORT_BALANCED;
+    n->target_size = 0;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  return NULL;
+}
+
 void *get_params(dt_imageio_module_format_t *self)
 {
   dt_imageio_avif_t *d = (dt_imageio_avif_t *)calloc(1, sizeof(dt_imageio_avif_t));
@@ -651,6 +796,9 @@ void *get_params(dt_imageio_module_format_t *self)
 
   d->tiling = !dt_conf_get_bool("plugins/imageio/format/avif/tiling");
 
+  d->effort = MIN(dt_conf_get_int("plugins/imageio/format/avif/effort"), AVIF_EFFORT_BEST);
+  d->target_size = dt_conf_get_int("plugins/imageio/format/avif/target_size");
+
   return d;
 }
 
@@ -668,6 +816,8 @@ int set_params(dt_imageio_module_format_t *self,
   dt_bauhaus_combobox_set(g->tiling, d->tiling);
   dt_bauhaus_combobox_set(g->compression_type, d->compression_type);
   dt_bauhaus_slider_set(g->quality, d->quality);
+  dt_bauhaus_combobox_set(g->effort, d->effort);
+  dt_bauhaus_slider_set(g->target_size, d->target_size);
 
   return 0;
 }
@@ -749,9 +899,11 @@ static void compression_type_changed(GtkWidget *widget, gpointer user_data)
   {
     case AVIF_COMP_LOSSLESS:
       gtk_widget_set_sensitive(gui->quality, FALSE);
+      gtk_widget_set_sensitive(gui->target_size, FALSE);
       break;
     case AVIF_COMP_LOSSY:
       gtk_widget_set_sensitive(gui->quality, TRUE);
+      gtk_widget_set_sensitive(gui->target_size, TRUE);
       break;
   }
 }
@@ -762,6 +914,18 @@ static void quality_changed(GtkWidget *slider, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/avif/quality", quality);
 }
 
+static void effort_changed(GtkWidget *widget, gpointer user_data)
+{
+  const enum avif_effort_e effort = dt_bauhaus_combobox_get(widget);
+  dt_conf_set_int("plugins/imageio/format/avif/effort", effort);
+}
+
+static void target_size_changed(GtkWidget *slider, gpointer user_data)
+{
+  const uint32_t target_size = (int)dt_bauhaus_slider_get(slider);
+  dt_conf_set_int("plugins/imageio/format/avif/target_size", target_size);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   dt_imageio_avif_gui_t *gui =
@@ -771,6 +935,8 @@ void gui_init(dt_imageio_module_format_t *self)
   const enum avif_tiling_e tiling = !dt_conf_get_bool("plugins/imageio/format/avif/tiling");
   const enum avif_compression_type_e compression_type = dt_conf_get_int("plugins/imageio/format/avif/compression_type");
   const uint32_t quality = dt_conf_get_int("plugins/imageio/format/avif/quality");
+  const enum avif_effort_e effort = dt_conf_get_int("plugins/imageio/format/avif/effort");
+  const uint32_t target_size = dt_conf_get_int("plugins/imageio/format/avif/target_size");
 
   self->gui_data = (void *)gui;
 
@@ -890,15 +1056,56 @@ void gui_init(dt_imageio_module_format_t *self)
   }
   gtk_box_pack_start(GTK_BOX(self->widget), gui->quality, TRUE, TRUE, 0);
 
+  /*
+   * Target size slider
+   */
+  gui->target_size = dt_bauhaus_slider_new_with_range(darktable.bauhaus, DT_GUI_MODULE(NULL),
+                                                      dt_confgen_get_int("plugins/imageio/format/avif/target_size", DT_MIN), /* min */
+                                                      dt_confgen_get_int("plugins/imageio/format/avif/target_size", DT_MAX), /* max */
+                                                      16, /* step */
+                                                      dt_confgen_get_int("plugins/imageio/format/avif/target_size", DT_DEFAULT), /* default */
+                                                      0); /* digits */
+  dt_bauhaus_widget_set_label(gui->target_size, N_("target size"));
+  dt_bauhaus_slider_set_format(gui->target_size, " KiB");
+
+  gtk_widget_set_tooltip_text(gui->target_size,
+          _("lower the quality until files fit this size.\n"
+            "\n"
+            "the quality above is the highest one tried, and the image is\n"
+            "encoded up to 6 times to find it. set to 0 to disable.\n"
+            "\n"
+            "applies only to lossy setting"));
+
+  dt_bauhaus_slider_set(gui->target_size, target_size);
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->target_size, TRUE, TRUE, 0);
+
   switch(compression_type)
   {
     case AVIF_COMP_LOSSLESS:
       gtk_widget_set_sensitive(gui->quality, FALSE);
+      gtk_widget_set_sensitive(gui->target_size, FALSE);
       break;
     case AVIF_COMP_LOSSY:
       break;
   }
 
+  /*
+   * Effort combo box
+   */
+  gui->effort = dt_bauhaus_combobox_new(darktable.bauhaus, DT_GUI_MODULE(NULL));
+  dt_bauhaus_widget_set_label(gui->effort, N_("encoding effort"));
+  dt_bauhaus_combobox_add(gui->effort, _("fast"));
+  dt_bauhaus_combobox_add(gui->effort, _("balanced"));
+  dt_bauhaus_combobox_add(gui->effort, _("best"));
+  dt_bauhaus_combobox_set(gui->effort, effort);
+
+  gtk_widget_set_tooltip_text(gui->effort,
+          _("time spent by the encoder to find a smaller file for the same quality.\n"
+            "\n"
+            "best is several times slower than balanced for a few percents."));
+
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->effort, TRUE, TRUE, 0);
+
   g_signal_connect(G_OBJECT(gui->bit_depth),
                    "value-changed",
                    G_CALLBACK(bit_depth_changed),
@@ -919,6 +1126,14 @@ void gui_init(dt_imageio_module_format_t *self)
                    "value-changed",
                    G_CALLBACK(quality_changed),
                    NULL);
+  g_signal_connect(G_OBJECT(gui->target_size),
+                   "value-changed",
+                   G_CALLBACK(target_size_changed),
+                   NULL);
+  g_signal_connect(G_OBJECT(gui->effort),
+                   "value-changed",
+                   G_CALLBACK(effort_changed),
+                   NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -934,12 +1149,16 @@ void gui_reset(dt_imageio_module_format_t *self)
   const enum avif_tiling_e tiling = !dt_confgen_get_bool("plugins/imageio/format/avif/tiling", DT_DEFAULT);
   const enum avif_compression_type_e compression_type = dt_confgen_get_int("plugins/imageio/format/avif/compression_type", DT_DEFAULT);
   const uint32_t quality = dt_confgen_get_int("plugins/imageio/format/avif/quality", DT_DEFAULT);
+  const enum avif_effort_e effort = dt_confgen_get_int("plugins/imageio/format/avif/effort", DT_DEFAULT);
+  const uint32_t target_size = dt_confgen_get_int("plugins/imageio/format/avif/target_size", DT_DEFAULT);
 
   dt_bauhaus_combobox_set(gui->bit_depth, 0); //8bpp
   dt_bauhaus_combobox_set(gui->color_mode, color_mode);
   dt_bauhaus_combobox_set(gui->tiling, tiling);
   dt_bauhaus_combobox_set(gui->compression_type, compression_type);
   dt_bauhaus_slider_set(gui->quality, quality);
+  dt_bauhaus_combobox_set(gui->effort, effort);
+  dt_bauhaus_slider_set(gui->target_size, target_size);
 
   compression_type_changed(GTK_WIDGET(gui->compression_type), self);
   quality_changed(GTK_WIDGET(gui->quality), self);
@@ -33,7 +33,7 @@
 #include <webp/encode.h>
 #include <webp/mux.h>
 
-DT_MODULE(2)
+DT_MODULE(3)
 
 typedef enum
 {
@@ -42,6 +42,19 @@ typedef enum
 } comp_type_t;
 
 
+typedef enum
+{
+  effort_fast = 0,
+  effort_balanced = 1,
+  effort_best = 2
+} effort_t;
+
+// encoder method (0 = fastest, 6 = slowest) for each effort
+static const int webp_method[] = { 2, 4, 6 };
+
+// bound on the number of encodes libwebp does to converge on the target size
+#define WEBP_TARGET_SIZE_PASSES 6
+
 typedef enum
 {
   hint_default,
@@ -57,6 +70,8 @@ typedef struct dt_imageio_webp_t
   int comp_type;
   int quality;
   int hint;
+  int effort;
+  int target_size; // KiB, 0 to disable
 } dt_imageio_webp_t;
 
 typedef struct dt_imageio_webp_gui_data_t
@@ -64,6 +79,8 @@ typedef struct dt_imageio_webp_gui_data_t
   GtkWidget *compression;
   GtkWidget *quality;
   GtkWidget *hint;
+  GtkWidget *effort;
+  GtkWidget *target_size;
 } dt_imageio_webp_gui_data_t;
 
 #define _stringify(a) #a
@@ -111,6 +128,12 @@ void init(dt_imageio_module_format_t *self)
   luaA_enum_value(darktable.lua_state.state, hint_t, hint_photo);
   luaA_enum_value(darktable.lua_state.state, hint_t, hint_graphic);
   dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_webp_t, hint, hint_t);
+  luaA_enum(darktable.lua_state.state, effort_t);
+  luaA_enum_value(darktable.lua_state.state, effort_t, effort_fast);
+  luaA_enum_value(darktable.lua_state.state, effort_t, effort_balanced);
+  luaA_enum_value(darktable.lua_state.state, effort_t, effort_best);
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_webp_t, effort, effort_t);
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_webp_t, target_size, int);
 #endif
 }
 void cleanup(dt_imageio_module_format_t *self)
@@ -143,10 +166,18 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
   WebPConfig config;
   if(!WebPConfigPreset(&config, webp_data->hint, (float)webp_data->quality)) goto out;
 
-  // TODO(jinxos): expose more config options in the UI
   config.lossless = webp_data->comp_type;
   config.image_hint = webp_data->hint;
-  config.method = 6;
+  config.method = webp_method[CLAMP(webp_data->effort, effort_fast, effort_best)];
+  config.thread_level = 1;
+
+  // let libwebp search the quality giving the requested file size,
+  // the user quality is only the starting point then.
+  if(!config.lossless && webp_data->target_size > 0)
+  {
+    config.target_size = webp_data->target_size * 1024;
+    config.pass = WEBP_TARGET_SIZE_PASSES;
+  }
 
   // these are to allow for large image export.
   // TODO(jinxos): these values should be adjusted as needed and ideally determined at runtime.
@@ -261,7 +292,7 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 2)
+  if(old_version == 1 && new_version == 3)
   {
     typedef struct dt_imageio_webp_v1_t
     {
@@ -284,6 +315,31 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->comp_type = o->comp_type;
     n->quality = o->quality;
     n->hint = o->hint;
+    n->effort = effort_best;
+    n->target_size = 0;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  else if(old_version == 2 && new_version == 3)
+  {
+    typedef struct dt_imageio_webp_v2_t
+    {
+      dt_imageio_module_data_t global;
+      int comp_type;
+      int quality;
+      int hint;
+    } dt_imageio_webp_v2_t;
+
+    const dt_imageio_webp_v2_t *o = (dt_imageio_webp_v2_t *)old_params;
+    dt_imageio_webp_t *n = (dt_imageio_webp_t *)malloc(sizeof(dt_imageio_webp_t));
+
+    n->global = o->global;
+    n->comp_type = o->comp_type;
+    n->quality = o->quality;
+    n->hint = o->hint;
+    // that's what was hardcoded before
+    n->effort = effort_best;
+    n->target_size = 0;
     *new_size = self->params_size(self);
     return n;
   }
@@ -299,6 +355,8 @@ void *get_params(dt_imageio_module_format_t *self)
   else
     d->quality = 100;
   d->hint = dt_conf_get_int("plugins/imageio/format/webp/hint");
+  d->effort = dt_conf_get_int("plugins/imageio/format/webp/effort");
+  d->target_size = dt_conf_get_int("plugins/imageio/format/webp/target_size");
   return d;
 }
 
@@ -310,6 +368,8 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_bauhaus_combobox_set(g->compression, d->comp_type);
   dt_bauhaus_slider_set(g->quality, d->quality);
   dt_bauhaus_combobox_set(g->hint, d->hint);
+  dt_bauhaus_combobox_set(g->effort, d->effort);
+  dt_bauhaus_slider_set(g->target_size, d->target_size);
   return 0;
 }
 
@@ -349,10 +409,9 @@ static void compression_changed(GtkWidget *widget, gpointer user_data)
   const int comp_type = dt_bauhaus_combobox_get(widget);
   dt_conf_set_int("plugins/imageio/format/webp/comp_type", comp_type);
 
-  if (comp_type == webp_lossless)
-    gtk_widget_set_sensitive(GTK_WIDGET(user_data), FALSE);
-  else
-    gtk_widget_set_sensitive(GTK_WIDGET(user_data), TRUE);
+  dt_imageio_webp_gui_data_t *gui = (dt_imageio_webp_gui_data_t *)user_data;
+  gtk_widget_set_sensitive(gui->quality, comp_type != webp_lossless);
+  gtk_widget_set_sensitive(gui->target_size, comp_type != webp_lossless);
 }
 
 static void quality_changed(GtkWidget *slider, gpointer user_data)
@@ -367,6 +426,18 @@ static void hint_combobox_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/webp/hint", hint);
 }
 
+static void effort_changed(GtkWidget *widget, gpointer user_data)
+{
+  const int effort = dt_bauhaus_combobox_get(widget);
+  dt_conf_set_int("plugins/imageio/format/webp/effort", effort);
+}
+
+static void target_size_changed(GtkWidget *slider, gpointer user_data)
+{
+  const int target_size = (int)dt_bauhaus_slider_get(slider);
+  dt_conf_set_int("plugins/imageio/format/webp/target_size", target_size);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   dt_imageio_webp_gui_data_t *gui = (dt_imageio_webp_gui_data_t *)malloc(sizeof(dt_imageio_webp_gui_data_t));
@@ -374,6 +445,8 @@ void gui_init(dt_imageio_module_format_t *self)
   const int comp_type = dt_conf_get_int("plugins/imageio/format/webp/comp_type");
   const int quality = dt_conf_get_int("plugins/imageio/format/webp/quality");
   const int hint = dt_conf_get_int("plugins/imageio/format/webp/hint");
+  const int effort = dt_conf_get_int("plugins/imageio/format/webp/effort");
+  const int target_size = dt_conf_get_int("plugins/imageio/format/webp/target_size");
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 
@@ -398,10 +471,44 @@ void gui_init(dt_imageio_module_format_t *self)
   gtk_box_pack_start(GTK_BOX(self->widget), gui->quality, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->quality), "value-changed", G_CALLBACK(quality_changed), (gpointer)0);
 
-  g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(compression_changed), (gpointer)gui->quality);
+  gui->target_size = dt_bauhaus_slider_new_with_range(darktable.bauhaus, DT_GUI_MODULE(NULL),
+                                                      dt_confgen_get_int("plugins/imageio/format/webp/target_size", DT_MIN),
+                                                      dt_confgen_get_int("plugins/imageio/format/webp/target_size", DT_MAX),
+                                                      16,
+                                                      dt_confgen_get_int("plugins/imageio/format/webp/target_size", DT_DEFAULT),
+                                                      0);
+  dt_bauhaus_widget_set_label(gui->target_size, N_("target size"));
+  dt_bauhaus_slider_set_format(gui->target_size, " KiB");
+  gtk_widget_set_tooltip_text(gui->target_size,
+                              _("adjust the quality to get files of about this size.\n"
+                                "the quality above is the starting point of the search.\n"
+                                "set to 0 to use the quality as is.\n"
+                                "applies only to lossy setting"));
+  dt_bauhaus_slider_set(gui->target_size, target_size);
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->target_size, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->target_size), "value-changed", G_CALLBACK(target_size_changed), NULL);
+
+  g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(compression_changed), (gpointer)gui);
 
   if (comp_type == webp_lossless)
+  {
     gtk_widget_set_sensitive(gui->quality, FALSE);
+    gtk_widget_set_sensitive(gui->target_size, FALSE);
+  }
+
+  gui->effort = dt_bauhaus_combobox_new(darktable.bauhaus, DT_GUI_MODULE(NULL));
+  dt_bauhaus_widget_set_label(gui->effort, N_("encoding effort"));
+  gtk_widget_set_tooltip_text(gui->effort,
+                              _("time spent by the encoder to find a smaller file for the same quality.\n"
+                                "fast     : for large batches, files are a bit larger\n"
+                                "balanced : most of the gain for a fraction of the time\n"
+                                "best     : smallest files, slowest"));
+  dt_bauhaus_combobox_add(gui->effort, _("fast"));
+  dt_bauhaus_combobox_add(gui->effort, _("balanced"));
+  dt_bauhaus_combobox_add(gui->effort, _("best"));
+  dt_bauhaus_combobox_set(gui->effort, effort);
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->effort, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->effort), "value-changed", G_CALLBACK(effort_changed), NULL);
 
   gui->hint = dt_bauhaus_combobox_new(darktable.bauhaus, DT_GUI_MODULE(NULL));
   dt_bauhaus_widget_set_label(gui->hint, N_("image hint"));
@@ -430,9 +537,13 @@ void gui_reset(dt_imageio_module_format_t *self)
   const int comp_type = dt_confgen_get_int("plugins/imageio/format/webp/comp_type", DT_DEFAULT);
   const int quality = dt_confgen_get_int("plugins/imageio/format/webp/quality", DT_DEFAULT);
   const int hint = dt_confgen_get_int("plugins/imageio/format/webp/hint", DT_DEFAULT);
+  const int effort = dt_confgen_get_int("plugins/imageio/format/webp/effort", DT_DEFAULT);
+  const int target_size = dt_confgen_get_int("plugins/imageio/format/webp/target_size", DT_DEFAULT);
   dt_bauhaus_combobox_set(gui->compression, comp_type);
   dt_bauhaus_slider_set(gui->quality, quality);
   dt_bauhaus_combobox_set(gui->hint, hint);
+  dt_bauhaus_combobox_set(gui->effort, effort);
+  dt_bauhaus_slider_set(gui->target_size, target_size);
 }
 
 int flags(dt_imageio_module_data_t *data)
@@ -31,6 +31,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/imageop_gui.h"
+#include "develop/imageop_math.h"
 #include "develop/tiling.h"
 #include "dtgtk/button.h"
 #include "dtgtk/expander.h"
@@ -72,6 +73,7 @@
 #define LSD_DENSITY_TH 0.7                  // LSD: minimal density of region points in rectangle
 #define LSD_N_BINS 1024                     // LSD: number of bins in pseudo-ordering of gradient modulus
 #define LSD_GAMMA 0.45                      // gamma correction to apply on raw images prior to line detection
+#define LSD_MAX_SIZE 1200                   // largest side of the image used for line detection, in pixels
 #define RANSAC_RUNS 400                     // how many iterations to run in ransac
 #define RANSAC_EPSILON 2                    // starting value for ransac epsilon (in -log10 units)
 #define RANSAC_EPSILON_STEP 1               // step size of epsilon optimization (log10 units)
@@ -478,6 +480,14 @@ typedef struct dt_iop_ashift_gui_data_t
   uint64_t lines_hash;
   uint64_t grid_hash;
   uint64_t buf_hash;
+  // result of the last line detection, before outliers removal, and the hash of its input
+  dt_iop_ashift_line_t *detected_lines;
+  int detected_lines_count;
+  int detected_vertical_count;
+  int detected_horizontal_count;
+  float detected_vertical_weight;
+  float detected_horizontal_weight;
+  uint64_t detected_hash;
   dt_iop_ashift_fitaxis_t lastfit;
   float lastx;
   float lasty;
@@ -1429,7 +1439,7 @@ static void gamma_correct(const float *const in, float *const out, const int wid
 
 // do actual line_detection based on LSD algorithm and return results according
 // to this module's conventions
-static int line_detect(float *in, const int width, const int height, const int x_off, const int y_off,
+static int line_detect(float *in, const int width, const int height, const float x_off, const float y_off,
                        const float scale, dt_iop_ashift_line_t **alines, int *lcount, int *vcount, int *hcount,
                        float *vweight, float *hweight, dt_iop_ashift_enhance_t enhance, const int is_raw)
 {
@@ -1602,6 +1612,15 @@ error:
   return FALSE;
 }
 
+// drop the result of the last line detection
+static void _clear_detected_lines(dt_iop_ashift_gui_data_t *g)
+{
+  free(g->detected_lines);
+  g->detected_lines = NULL;
+  g->detected_lines_count = 0;
+  g->detected_hash = 0;
+}
+
 // get image from buffer, analyze for structure and save results
 static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhance)
 {
@@ -1613,6 +1632,14 @@ static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhan
   int x_off = 0;
   int y_off = 0;
   float scale = 0.0f;
+  const int is_raw = dt_image_is_raw(&module->dev->image_storage);
+
+  // line detection runs on a copy downscaled to at most LSD_MAX_SIZE,
+  // lines are then scaled back to the input buffer coordinates
+  float ds = 1.0f;
+  int ds_width = 0;
+  int ds_height = 0;
+  uint64_t hash = 0;
 
   dt_iop_gui_enter_critical_section(module);
   // read buffer data if they are available
@@ -1624,14 +1651,36 @@ static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhan
     y_off = g->buf_y_off;
     scale = g->buf_scale;
 
+    ds = fminf((float)LSD_MAX_SIZE / (float)MAX(width, height), 1.0f);
+    ds_width = MAX((int)(width * ds), 1);
+    ds_height = MAX((int)(height * ds), 1);
+
+    // the same input with the same settings gives the same lines: don't detect them again
+    hash = dt_hash(g->buf_hash, (const char *)&enhance, sizeof(enhance));
+    hash = dt_hash(hash, (const char *)&is_raw, sizeof(int));
+    hash = dt_hash(hash, (const char *)&width, sizeof(int));
+    hash = dt_hash(hash, (const char *)&height, sizeof(int));
+    hash = dt_hash(hash, (const char *)&x_off, sizeof(int));
+    hash = dt_hash(hash, (const char *)&y_off, sizeof(int));
+    hash = dt_hash(hash, (const char *)&scale, sizeof(float));
+
     // create a temporary buffer to hold image data
-    buffer = malloc(sizeof(float) * 4 * (size_t)width * height);
-    if(buffer != NULL)
-      dt_iop_image_copy_by_size(buffer, g->buf, width, height, 4);
+    if(g->detected_lines == NULL || g->detected_hash != hash)
+    {
+      buffer = malloc(sizeof(float) * 4 * (size_t)ds_width * ds_height);
+      if(buffer != NULL && ds < 1.0f)
+      {
+        const dt_iop_roi_t roi_in = { .x = 0, .y = 0, .width = width, .height = height, .scale = 1.0f };
+        const dt_iop_roi_t roi_out = { .x = 0, .y = 0, .width = ds_width, .height = ds_height, .scale = ds };
+        dt_iop_clip_and_zoom(buffer, g->buf, &roi_out, &roi_in, ds_width, width);
+      }
+      else if(buffer != NULL)
+        dt_iop_image_copy_by_size(buffer, g->buf, width, height, 4);
+    }
   }
   dt_iop_gui_leave_critical_section(module);
 
-  if(buffer == NULL) goto error;
+  if(width == 0 || height == 0) goto error;
 
   // get rid of old structural data
   g->lines_count = 0;
@@ -1640,31 +1689,50 @@ static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhan
   free(g->lines);
   g->lines = NULL;
 
-  dt_iop_ashift_line_t *lines;
-  int lines_count;
-  int vertical_count;
-  int horizontal_count;
-  float vertical_weight;
-  float horizontal_weight;
+  if(buffer != NULL)
+  {
+    _clear_detected_lines(g);
 
-  // get new structural data
-  if(!line_detect(buffer, width, height, x_off, y_off, scale, &lines, &lines_count,
-                  &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
-                  enhance, dt_image_is_raw(&module->dev->image_storage)))
-    goto error;
+    dt_iop_ashift_line_t *lines;
+    int lines_count;
+    int vertical_count;
+    int horizontal_count;
+    float vertical_weight;
+    float horizontal_weight;
+
+    // get new structural data
+    if(!line_detect(buffer, ds_width, ds_height, x_off * ds, y_off * ds, scale * ds, &lines, &lines_count,
+                    &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
+                    enhance, is_raw))
+      goto error;
+
+    g->detected_lines = lines;
+    g->detected_lines_count = lines_count;
+    g->detected_vertical_count = vertical_count;
+    g->detected_horizontal_count = horizontal_count;
+    g->detected_vertical_weight = vertical_weight;
+    g->detected_horizontal_weight = horizontal_weight;
+    g->detected_hash = hash;
+  }
+  else if(g->detected_lines == NULL || g->detected_hash != hash)
+    goto error; // allocation failed
+
+  // outliers removal and user selection alter the lines, work on a copy
+  g->lines = malloc(sizeof(dt_iop_ashift_line_t) * g->detected_lines_count);
+  if(g->lines == NULL) goto error;
+  memcpy(g->lines, g->detected_lines, sizeof(dt_iop_ashift_line_t) * g->detected_lines_count);
 
   // save new structural data
   g->lines_in_width = width;
   g->lines_in_height = height;
   g->lines_x_off = x_off;
   g->lines_y_off = y_off;
-  g->lines_count = lines_count;
-  g->vertical_count = vertical_count;
-  g->horizontal_count = horizontal_count;
-  g->vertical_weight = vertical_weight;
-  g->horizontal_weight = horizontal_weight;
+  g->lines_count = g->detected_lines_count;
+  g->vertical_count = g->detected_vertical_count;
+  g->horizontal_count = g->detected_horizontal_count;
+  g->vertical_weight = g->detected_vertical_weight;
+  g->horizontal_weight = g->detected_horizontal_weight;
   g->lines_version++;
-  g->lines = lines;
 
   free(buffer);
   return TRUE;
@@ -3125,7 +3193,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     const int isflipped = fabs(fmod(alpha + M_PI, M_PI) - M_PI / 2.0f) < M_PI / 4.0f ? 1 : 0;
 
     // did modules prior to this one in pixelpipe have changed? -> check via hash value
-    uint64_t hash = dt_dev_hash(self->dev, self->dev->preview_pipe);
+    const uint64_t hash = dt_dev_pixelpipe_get_upstream_hash(piece);
 
     dt_iop_gui_enter_critical_section(self);
     g->isflipped = isflipped;
@@ -3258,7 +3326,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     const int isflipped = fabs(fmod(alpha + M_PI, M_PI) - M_PI / 2.0f) < M_PI / 4.0f ? 1 : 0;
 
     // do modules coming before this one in pixelpipe have changed? -> check via hash value
-    uint64_t hash = dt_dev_hash(self->dev, self->dev->preview_pipe);
+    const uint64_t hash = dt_dev_pixelpipe_get_upstream_hash(piece);
 
     dt_iop_gui_enter_critical_section(self);
     g->isflipped = isflipped;
@@ -5362,6 +5430,7 @@ void reload_defaults(dt_iop_module_t *module)
     free(g->lines);
     g->lines = NULL;
     g->lines_count =0;
+    _clear_detected_lines(g);
     g->horizontal_count = 0;
     g->vertical_count = 0;
     g->grid_hash = 0;
@@ -5473,6 +5542,9 @@ void gui_init(struct dt_iop_module_t *self)
   g->vertical_count = 0;
   g->horizontal_count = 0;
   g->lines_version = 0;
+  g->detected_lines = NULL;
+  g->detected_lines_count = 0;
+  g->detected_hash = 0;
   g->points = NULL;
   g->points_idx = NULL;
   g->points_lines_count = 0;
@@ -5672,6 +5744,7 @@ void gui_cleanup(struct dt_iop_module_t *self)
 
   dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)self->gui_data;
   if(g->lines) free(g->lines);
+  if(g->detected_lines) free(g->detected_lines);
   if(g->buf) free(g->buf);
   if(g->points) free(g->points);
   if(g->points_idx) free(g->points_idx);
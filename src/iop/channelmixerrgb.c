@@ -25,12 +25,18 @@
 #include "dtgtk/drawingarea.h"
 #include "common/chromatic_adaptation.h"
 #include "common/colorspaces_inline_conversions.h"
+#include "common/act_on.h"
 #include "common/colorchecker.h"
 #include "common/opencl.h"
 #include "common/illuminants.h"
 #include "common/imagebuf.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
 #include "common/iop_profile.h"
+#include "common/mipmap_cache.h"
 #include "control/control.h"
+#include "control/jobs.h"
+#include "control/jobs/control_jobs.h"
 #include "develop/imageop_math.h"
 #include "develop/openmp_maths.h"
 
@@ -79,6 +85,8 @@ DT_MODULE_INTROSPECTION(3, dt_iop_channelmixer_rgb_params_t)
 #define CHROMA_MAX 128.0
 #define TEMP_MIN 1667.
 #define TEMP_MAX 25000.
+// longest side of the images the white balance detection runs on for a selection
+#define DETECT_BATCH_SIZE 1024
 
 typedef enum dt_iop_channelmixer_rgb_version_t
 {
@@ -134,6 +142,16 @@ typedef enum dt_spot_mode_t
   DT_SPOT_MODE_LAST
 } dt_spot_mode_t;
 
+// result of the last color checker profiling, restored if asked again on the same input and settings
+typedef struct dt_iop_channelmixer_rgb_profile_t
+{
+  uint64_t hash;
+  float xy[2];
+  dt_colormatrix_t mix;
+  float *delta_E;
+  gchar *label_text;
+} dt_iop_channelmixer_rgb_profile_t;
+
 typedef struct dt_iop_channelmixer_rgb_gui_data_t
 {
   GtkNotebook *notebook;
@@ -186,6 +204,13 @@ typedef struct dt_iop_channelmixer_rgb_gui_data_t
   GtkWidget *Lch_origin, *Lch_target;
   GtkWidget *use_mixing;
   dt_aligned_pixel_t spot_RGB;
+
+  // g->XYZ holds the white balance detected on this input hash and method
+  uint64_t wb_hash;
+  dt_illuminant_t last_detection; // method used by the detection on selection
+  GtkWidget *detect_selection;
+
+  dt_iop_channelmixer_rgb_profile_t profile;
 } dt_iop_channelmixer_rgb_gui_data_t;
 
 typedef struct dt_iop_channelmixer_rbg_data_t
@@ -1817,6 +1842,55 @@ void validate_color_checker(const float *const restrict in,
   dt_free_align(patches);
 }
 
+// The profiling depends on the input of the module and on everything the user sets up in the GUI for it
+static uint64_t _profile_hash(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_channelmixer_rgb_gui_data_t *g,
+                              const dt_adaptation_t kind)
+{
+  uint64_t hash = dt_dev_pixelpipe_get_upstream_hash(piece);
+  hash = dt_hash(hash, (const char *)&g->checker->type, sizeof(dt_color_checker_targets));
+  hash = dt_hash(hash, (const char *)g->box, sizeof(g->box));
+  hash = dt_hash(hash, (const char *)&g->optimization, sizeof(dt_solving_strategy_t));
+  hash = dt_hash(hash, (const char *)&g->safety_margin, sizeof(float));
+  hash = dt_hash(hash, (const char *)&kind, sizeof(dt_adaptation_t));
+  return hash;
+}
+
+static void _profile_clear(dt_iop_channelmixer_rgb_profile_t *profile)
+{
+  if(profile->delta_E) dt_free_align(profile->delta_E);
+  profile->delta_E = NULL;
+  g_free(profile->label_text);
+  profile->label_text = NULL;
+  profile->hash = 0;
+}
+
+static void _profile_store(dt_iop_channelmixer_rgb_gui_data_t *g, const uint64_t hash)
+{
+  dt_iop_channelmixer_rgb_profile_t *profile = &g->profile;
+  _profile_clear(profile);
+
+  profile->delta_E = dt_alloc_sse_ps(g->checker->patches);
+  if(profile->delta_E == NULL) return;
+  memcpy(profile->delta_E, g->delta_E_in, sizeof(float) * g->checker->patches);
+  memcpy(profile->mix, g->mix, sizeof(dt_colormatrix_t));
+  profile->xy[0] = g->xy[0];
+  profile->xy[1] = g->xy[1];
+  profile->label_text = g_strdup(g->delta_E_label_text);
+  profile->hash = hash;
+}
+
+static void _profile_restore(dt_iop_channelmixer_rgb_gui_data_t *g)
+{
+  const dt_iop_channelmixer_rgb_profile_t *profile = &g->profile;
+  memcpy(g->delta_E_in, profile->delta_E, sizeof(float) * g->checker->patches);
+  memcpy(g->mix, profile->mix, sizeof(dt_colormatrix_t));
+  g->xy[0] = profile->xy[0];
+  g->xy[1] = profile->xy[1];
+  g_free(g->delta_E_label_text);
+  g->delta_E_label_text = g_strdup(profile->label_text);
+  g->profile_ready = TRUE;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
              const void *const restrict ivoid, void *const restrict ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -1859,7 +1933,14 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
     if(g->run_profile && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
     {
       dt_iop_gui_enter_critical_section(self);
-      extract_color_checker(in, out, roi_in, g, RGB_to_XYZ, XYZ_to_RGB, XYZ_to_CAM, data->adaptation);
+      const uint64_t hash = _profile_hash(piece, g, data->adaptation);
+      if(hash != g->profile.hash)
+      {
+        extract_color_checker(in, out, roi_in, g, RGB_to_XYZ, XYZ_to_RGB, XYZ_to_CAM, data->adaptation);
+        _profile_store(g, hash);
+      }
+      else
+        _profile_restore(g);
       g->run_profile = FALSE;
       dt_iop_gui_leave_critical_section(self);
     }
@@ -1868,9 +1949,18 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
     {
       if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
       {
-        // detection on full image only
+        // detection on full image only. The result depends on the region it ran on,
+        // so a zoom or a pan in darkroom has to run it again.
+        uint64_t hash = dt_hash(dt_dev_pixelpipe_get_upstream_hash(piece),
+                                (const char *)&data->illuminant_type, sizeof(dt_illuminant_t));
+        hash = dt_hash(hash, (const char *)roi_in, sizeof(dt_iop_roi_t));
         dt_iop_gui_enter_critical_section(self);
-        auto_detect_WB(in, data->illuminant_type, roi_in->width, roi_in->height, ch, RGB_to_XYZ, g->XYZ);
+        if(hash != g->wb_hash)
+        {
+          auto_detect_WB(in, data->illuminant_type, roi_in->width, roi_in->height, ch, RGB_to_XYZ, g->XYZ);
+          g->wb_hash = hash;
+        }
+        g->last_detection = data->illuminant_type;
         dt_iop_gui_leave_critical_section(self);
       }
 
@@ -2654,6 +2744,226 @@ static void commit_profile_callback(GtkWidget *widget, GdkEventButton *event, gp
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
+/**
+ * White balance detection on a selection.
+ *
+ * Each image is exported in memory, downscaled, up to the input of its first enabled instance of this module,
+ * the illuminant is detected on it the same way the darkroom does, and written in a new history item on top.
+ * Images are spread over a few background jobs running in parallel.
+ **/
+
+typedef struct dt_iop_channelmixer_rgb_detect_job_t
+{
+  GList *imgs;
+  dt_illuminant_t method;
+} dt_iop_channelmixer_rgb_detect_job_t;
+
+typedef struct dt_iop_channelmixer_rgb_detect_format_t
+{
+  dt_imageio_module_data_t parent;
+  dt_illuminant_t method;
+  dt_aligned_pixel_t xyz;
+} dt_iop_channelmixer_rgb_detect_format_t;
+
+static int _detect_bpp(dt_imageio_module_data_t *data)
+{
+  return 32;
+}
+
+static int _detect_levels(dt_imageio_module_data_t *data)
+{
+  return IMAGEIO_RGB | IMAGEIO_FLOAT;
+}
+
+static const char *_detect_mime(dt_imageio_module_data_t *data)
+{
+  return "memory";
+}
+
+static int _detect_write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
+                               dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                               void *exif, int exif_len, int32_t imgid, int num, int total,
+                               dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
+{
+  dt_iop_channelmixer_rgb_detect_format_t *d = (dt_iop_channelmixer_rgb_detect_format_t *)data;
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+
+  // the detection samples patches 4 * OFF px away from the borders
+  if(work_profile == NULL || data->width <= 8 * OFF || data->height <= 8 * OFF) return 1;
+
+  dt_colormatrix_t RGB_to_XYZ;
+  memcpy(RGB_to_XYZ, work_profile->matrix_in, sizeof(RGB_to_XYZ));
+  auto_detect_WB((const float *)in, d->method, data->width, data->height, 4, RGB_to_XYZ, d->xyz);
+  return 0;
+}
+
+// Return TRUE if the image got a new illuminant
+static gboolean _detect_WB_on_image(const int32_t imgid, const dt_illuminant_t method)
+{
+  // the image being edited is detected through the illuminant setting, in darkroom
+  if(dt_dev_is_current_image(darktable.develop, imgid)) return FALSE;
+
+  dt_develop_t _dev = { 0 };
+  dt_develop_t *dev = &_dev;
+  dt_dev_init(dev, FALSE);
+  dev->iop = dt_iop_load_modules_ext(dev, TRUE);
+  dev->image_storage.id = imgid;
+  dt_dev_read_history_ext(dev, imgid, TRUE);
+  dt_dev_pop_history_items_ext(dev, dt_dev_get_history_end(dev));
+
+  // same instance as the one dt_dev_pixelpipe_disable_from() stops at
+  dt_iop_module_t *module = NULL;
+  for(GList *modules = dev->iop; modules && !module; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *mod = (dt_iop_module_t *)modules->data;
+    if(mod->enabled && !strcmp(mod->op, "channelmixerrgb")) module = mod;
+  }
+
+  dt_iop_channelmixer_rgb_params_t *p = module ? (dt_iop_channelmixer_rgb_params_t *)module->params : NULL;
+  gboolean success = p && p->adaptation != DT_ADAPTATION_RGB;
+
+  dt_imageio_module_format_t format = { .mime = _detect_mime,
+                                        .levels = _detect_levels,
+                                        .bpp = _detect_bpp,
+                                        .write_image = _detect_write_image };
+  dt_iop_channelmixer_rgb_detect_format_t dat = { .parent = { 0 }, .method = method };
+  dat.parent.max_width = DETECT_BATCH_SIZE;
+  dat.parent.max_height = DETECT_BATCH_SIZE;
+
+  success = success
+            && !dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, TRUE,
+                                             FALSE, FALSE, FALSE, FALSE, "input:channelmixerrgb", FALSE, FALSE,
+                                             DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL, NULL, 1, 1, NULL);
+
+  if(success)
+  {
+    // The darkroom loads and writes the history of its image from the GUI thread. If the image
+    // got opened there since the job started, leave it alone: checking under the history lock makes
+    // sure it doesn't switch to that image while we write it.
+    dt_pthread_mutex_lock(&darktable.history_threadsafe);
+    success = !dt_dev_is_current_image(darktable.develop, imgid);
+    if(success)
+    {
+      // same as _develop_ui_pipe_finished_callback()
+      p->x = dat.xyz[0];
+      p->y = dat.xyz[1];
+      check_if_close_to_daylight(p->x, p->y, &p->temperature, &p->illuminant, &p->adaptation);
+
+      dt_pthread_mutex_lock(&dev->history_mutex);
+      dt_dev_add_history_item_ext(dev, module, FALSE, TRUE, TRUE, FALSE);
+      dt_dev_write_history_ext(dev->history, dev->iop_order_list, imgid);
+      dt_dev_write_history_end_ext(dt_dev_get_history_end(dev), imgid);
+      dt_pthread_mutex_unlock(&dev->history_mutex);
+    }
+    dt_pthread_mutex_unlock(&darktable.history_threadsafe);
+  }
+
+  dt_dev_cleanup(dev);
+
+  if(success)
+  {
+    dt_dev_append_changed_tag(imgid);
+    dt_control_save_xmp(imgid);
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgid);
+  }
+
+  return success;
+}
+
+static int32_t _detect_WB_job_run(dt_job_t *job)
+{
+  dt_iop_channelmixer_rgb_detect_job_t *params = (dt_iop_channelmixer_rgb_detect_job_t *)dt_control_job_get_params(job);
+  const guint total = g_list_length(params->imgs);
+  char message[512] = { 0 };
+  snprintf(message, sizeof(message),
+           ngettext("detecting white balance of %d image", "detecting white balance of %d images", total), total);
+  dt_control_job_set_progress_message(job, message);
+
+  int done = 0;
+  double fraction = 0.0;
+  for(const GList *l = params->imgs; l && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED; l = g_list_next(l))
+  {
+    if(_detect_WB_on_image(GPOINTER_TO_INT(l->data), params->method)) done++;
+    fraction += 1.0 / total;
+    dt_control_job_set_progress(job, fraction);
+  }
+
+  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+  dt_control_queue_redraw_center();
+  dt_control_log(ngettext("white balance detected on %d image", "white balance detected on %d images", done),
+                 done);
+  return 0;
+}
+
+static void _detect_WB_job_cleanup(void *p)
+{
+  dt_iop_channelmixer_rgb_detect_job_t *params = (dt_iop_channelmixer_rgb_detect_job_t *)p;
+  g_list_free(params->imgs);
+  free(params);
+}
+
+static void _detect_WB_on_list(const GList *imgs, const dt_illuminant_t method)
+{
+  // Leave a worker free for the thumbnails and the other jobs
+  const int n_imgs = g_list_length((GList *)imgs);
+  const int n_jobs = MIN(n_imgs, MAX(dt_worker_threads() - 1, 1));
+  if(n_jobs == 0) return;
+
+  dt_iop_channelmixer_rgb_detect_job_t **params = calloc(n_jobs, sizeof(dt_iop_channelmixer_rgb_detect_job_t *));
+  if(!params) return;
+
+  for(int k = 0; k < n_jobs; k++)
+  {
+    params[k] = calloc(1, sizeof(dt_iop_channelmixer_rgb_detect_job_t));
+    if(params[k]) params[k]->method = method;
+  }
+
+  int i = 0;
+  for(const GList *l = imgs; l; l = g_list_next(l), i++)
+    if(params[i % n_jobs]) params[i % n_jobs]->imgs = g_list_prepend(params[i % n_jobs]->imgs, l->data);
+
+  for(int k = 0; k < n_jobs; k++)
+  {
+    if(!params[k]) continue;
+    params[k]->imgs = g_list_reverse(params[k]->imgs);
+
+    dt_job_t *job = dt_control_job_create(&_detect_WB_job_run, "detect white balance");
+    if(!job)
+    {
+      _detect_WB_job_cleanup(params[k]);
+      continue;
+    }
+    dt_control_job_add_progress(job, _("detect white balance"), TRUE);
+    dt_control_job_set_params(job, params[k], _detect_WB_job_cleanup);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+  }
+
+  free(params);
+}
+
+static void _detect_selection_callback(GtkButton *button, dt_iop_module_t *self)
+{
+  if(darktable.gui->reset) return;
+  dt_iop_channelmixer_rgb_gui_data_t *g = (dt_iop_channelmixer_rgb_gui_data_t *)self->gui_data;
+
+  // The image being edited is detected through the illuminant setting, in darkroom
+  GList *imgs = dt_act_on_get_images();
+  GList *others = NULL;
+  for(const GList *l = imgs; l; l = g_list_next(l))
+    if(!dt_dev_is_current_image(darktable.develop, GPOINTER_TO_INT(l->data)))
+      others = g_list_prepend(others, l->data);
+  others = g_list_reverse(others);
+  g_list_free(imgs);
+
+  if(others)
+    _detect_WB_on_list(others, g->last_detection);
+  else
+    dt_control_log(_("no image selected besides the one being edited"));
+
+  g_list_free(others);
+}
+
 static void _develop_ui_pipe_finished_callback(gpointer instance, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
@@ -2822,6 +3132,7 @@ static void update_illuminants(dt_iop_module_t *self)
     gtk_widget_set_visible(g->illum_led, FALSE);
     gtk_widget_set_visible(g->illum_x, FALSE);
     gtk_widget_set_visible(g->illum_y, FALSE);
+    gtk_widget_set_visible(g->detect_selection, FALSE);
     return;
   }
   else
@@ -2835,6 +3146,7 @@ static void update_illuminants(dt_iop_module_t *self)
     gtk_widget_set_visible(g->illum_fluo, TRUE);
     gtk_widget_set_visible(g->illum_led, TRUE);
     gtk_widget_set_visible(g->illum_x, TRUE);
+    gtk_widget_set_visible(g->detect_selection, TRUE);
   }
 
   // Display only the relevant sliders
@@ -3946,6 +4258,9 @@ void gui_init(struct dt_iop_module_t *self)
   g->delta_E_label_text = NULL;
 
   g->XYZ[0] = NAN;
+  g->wb_hash = 0;
+  g->last_detection = DT_ILLUMINANT_DETECT_SURFACES;
+  g->profile = (dt_iop_channelmixer_rgb_profile_t){ 0 };
 
   DT_DEBUG_CONTROL_SIGNAL_CONNECT(darktable.signals, DT_SIGNAL_DEVELOP_UI_PIPE_FINISHED,
                             G_CALLBACK(_develop_ui_pipe_finished_callback), self);
@@ -4013,6 +4328,13 @@ void gui_init(struct dt_iop_module_t *self)
   g_signal_connect(G_OBJECT(g->illum_y), "value-changed", G_CALLBACK(illum_xy_callback), self);
   gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(g->illum_y), FALSE, FALSE, 0);
 
+  g->detect_selection = dt_action_button_new(NULL, N_("detect on selection"), _detect_selection_callback, self,
+                                             _("detect the illuminant of the other selected images in the background,\n"
+                                               "with the last detection method used here (from surfaces by default),\n"
+                                               "and set it in their first instance of this module."),
+                                             0, 0);
+  gtk_box_pack_start(GTK_BOX(self->widget), g->detect_selection, FALSE, FALSE, 0);
+
   g->gamut = dt_bauhaus_slider_from_params(self, "gamut");
   dt_bauhaus_slider_set_soft_max(g->gamut, 4.f);
 
@@ -4235,6 +4557,7 @@ void gui_cleanup(struct dt_iop_module_t *self)
   }
 
   g_free(g->delta_E_label_text);
+  _profile_clear(&g->profile);
 
   IOP_GUI_FREE;
 }
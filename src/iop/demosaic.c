@@ -240,6 +240,15 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
                                const dt_image_t *const img,
                                const dt_iop_roi_t *const roi_out)
 {
+  // Exports downscaled early (see finalscale): when our output is at most the size of one CFA block
+  // per pixel, binning the blocks loses nothing over a full demosaic followed by downscaling,
+  // and is much cheaper. The raw details mask needs the full demosaic though.
+  const dt_dev_pixelpipe_t *const pipe = piece->pipe;
+  const float block_scale = (pipe->dsc.filters == 9u) ? 1.f / 3.f : .5f;
+  if(pipe->type == DT_DEV_PIXELPIPE_EXPORT && pipe->export_early_scale < 1.f && roi_out->scale <= block_scale
+     && !(pipe->want_detail_mask & DT_DEV_DETAIL_MASK_REQUIRED))
+    return 0;
+
   return DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
 }
 
@@ -619,7 +628,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       dt_get_times(&end_time);
       const float tclock = end_time.clock - start_time.clock;
       const float uclock = end_time.user - start_time.user;
-      fprintf(stderr," [demosaic] process CPU `%s' did %.2fmpix, %.4f secs (%.4f CPU), %.2f pix/us\n",
+      fprintf(stderr," [demosaic] process CPU `%s' did %.2fmpix, %.4f secs (%.4f CPU), %.2f mpix/s\n",
         method2string(demosaicing_method & ~DEMOSAIC_DUAL), mpixels, tclock, uclock, mpixels / tclock);
     }
 
@@ -1004,7 +1013,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     dt_get_times(&end_time);
     const float tclock = end_time.clock - start_time.clock;
     const float uclock = end_time.user - start_time.user;
-    fprintf(stderr," [demosaic] process GPU `%s' did %.2fmpix, %.4f secs (%.4f CPU), %.2f pix/us\n",
+    fprintf(stderr," [demosaic] process GPU `%s' did %.2fmpix, %.4f secs (%.4f CPU), %.2f mpix/s\n",
       method2string(demosaicing_method & ~DEMOSAIC_DUAL), mpixels, tclock, uclock, mpixels / tclock);
   }
   if(!dual)
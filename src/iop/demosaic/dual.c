@@ -61,7 +61,15 @@ static void dual_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict r
 
   const float contrastf = slider2contrast(dual_threshold);
 
-  dt_masks_calc_rawdetail_mask(rgb_data, blend, tmp, width, height, piece->pipe->dsc.temperature.coeffs);
+  // The raw detail mask of the high frequency pass is the one the pipe has just stored for later modules,
+  // from the same demosaiced data and white balance: take it instead of computing it again.
+  const dt_dev_pixelpipe_t *pipe = piece->pipe;
+  if(pipe->rawdetail_mask_data
+     && (pipe->want_detail_mask & ~DT_DEV_DETAIL_MASK_REQUIRED) == DT_DEV_DETAIL_MASK_DEMOSAIC
+     && pipe->rawdetail_mask_roi.width == width && pipe->rawdetail_mask_roi.height == height)
+    memcpy(blend, pipe->rawdetail_mask_data, sizeof(float) * width * height);
+  else
+    dt_masks_calc_rawdetail_mask(rgb_data, blend, tmp, width, height, piece->pipe->dsc.temperature.coeffs);
   dt_masks_calc_detail_mask(blend, blend, tmp, width, height, contrastf, TRUE);
 
   if(dual_mask)
@@ -95,7 +103,10 @@ static void dual_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict r
   if(info)
   {
     dt_get_times(&end_blend);
-    fprintf(stderr," [demosaic] CPU dual blending %.4f secs (%.4f CPU)\n", end_blend.clock - start_blend.clock, end_blend.user - start_blend.user);
+    const float mpixels = (width * height) / 1.0e6;
+    const float tclock = end_blend.clock - start_blend.clock;
+    fprintf(stderr," [demosaic] CPU dual blending %.4f secs (%.4f CPU), %.2f mpix/s\n", tclock,
+            end_blend.user - start_blend.user, mpixels / tclock);
   }
   dt_free_align(tmp);
   dt_free_align(blend);
@@ -1375,6 +1375,9 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   for(int scale = 0; scale < max_scale; scale++)
   {
+    // the pipe throws the output away when cancelled, don't decompose the next scales
+    if(dt_dev_pixelpipe_cancelled(piece->pipe)) break;
+
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
@@ -1614,7 +1617,8 @@ static void process_nlmeans_cpu(dt_dev_pixelpipe_iop_t *piece,
                                       .patch_radius = P,
                                       .search_radius = K,
                                       .decimate = 0,
-                                      .norm = norm2 };
+                                      .norm = norm2,
+                                      .pipe = piece->pipe };
   denoiser(in,ovoid,roi_in,roi_out,&params);
 
   dt_free_align(in);
@@ -884,7 +884,8 @@ static inline gint wavelets_process(const float *const restrict in, float *const
                                     const int has_mask,
                                     float *const restrict HF[MAX_NUM_SCALES],
                                     float *const restrict LF_odd,
-                                    float *const restrict LF_even)
+                                    float *const restrict LF_even,
+                                    dt_dev_pixelpipe_t *const pipe)
 {
   gint success = TRUE;
 
@@ -990,6 +991,13 @@ static inline gint wavelets_process(const float *const restrict in, float *const
 
     if(s == 0) buffer_out = reconstructed;
 
+    // each scale is a full-image PDE solve: stop here if the result is already stale
+    if(dt_dev_pixelpipe_cancelled(pipe))
+    {
+      success = FALSE;
+      break;
+    }
+
     // Compute wavelets low-frequency scales
     heat_PDE_diffusion(HF[s], buffer_in, mask, has_mask, buffer_out, width, height,
                        anisotropy, isotropy_type, regularization,
@@ -1139,9 +1147,10 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     if(it == (int)iterations - 1)
       temp_out = out;
 
-    wavelets_process(temp_in, temp_out, mask,
-                     roi_out->width, roi_out->height,
-                     data, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even);
+    if(!wavelets_process(temp_in, temp_out, mask,
+                         roi_out->width, roi_out->height,
+                         data, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even, piece->pipe))
+      break;
   }
 
 error:
@@ -1413,6 +1422,10 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     }
 
     if(it == (int)iterations - 1) temp_out = dev_out;
+
+    // the pipe discards the output of cancelled modules
+    if(dt_dev_pixelpipe_cancelled(piece->pipe)) break;
+
     err = wavelets_process_cl(devid, temp_in, temp_out, mask, sizes, width, height, data, gd, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even);
     if(err != CL_SUCCESS) goto error;
   }
@@ -56,24 +56,42 @@ int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   return IOP_CS_RGB;
 }
 
+// Scale of our input. Modules before us normally run at full resolution,
+// but exports may ask them to run closer to the output size (see export_early_scale).
+static inline float _input_scale(const dt_dev_pixelpipe_iop_t *const piece, const dt_iop_roi_t *const roi_out)
+{
+  return CLAMP(piece->pipe->export_early_scale, roi_out->scale, 1.0f);
+}
+
+// Resampling from roi_in to roi_out is relative to the input scale
+static inline dt_iop_roi_t _relative_roi_out(const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_roi_t roi = *roi_out;
+  roi.scale = roi_out->scale / roi_in->scale;
+  return roi;
+}
+
 void modify_roi_in(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_out,
                    dt_iop_roi_t *roi_in)
 {
-  *roi_in = *roi_out;
+  const float in_scale = _input_scale(piece, roi_out);
+  const float ratio = in_scale / roi_out->scale;
 
-  roi_in->x /= roi_out->scale;
-  roi_in->y /= roi_out->scale;
+  *roi_in = *roi_out;
+  roi_in->x *= ratio;
+  roi_in->y *= ratio;
   // out = in * scale + .5f to more precisely round to user input in export module:
-  roi_in->width  = (roi_out->width  - .5f)/roi_out->scale;
-  roi_in->height = (roi_out->height - .5f)/roi_out->scale;
-  roi_in->scale = 1.0f;
+  roi_in->width  = (roi_out->width  - .5f) * ratio;
+  roi_in->height = (roi_out->height - .5f) * ratio;
+  roi_in->scale = in_scale;
 }
 
 void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *const in,
                   float *const out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_USERPREF_WARP);
-  dt_interpolation_resample_roi_1c(itor, out, roi_out, in, roi_in);
+  const dt_iop_roi_t roi = _relative_roi_out(roi_in, roi_out);
+  dt_interpolation_resample_roi_1c(itor, out, &roi, in, roi_in);
 }
 
 #ifdef HAVE_OPENCL
@@ -90,7 +108,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   const int devid = piece->pipe->devid;
   cl_int err = -999;
 
-  err = dt_iop_clip_and_zoom_roi_cl(devid, dev_out, dev_in, roi_out, roi_in);
+  const dt_iop_roi_t roi = _relative_roi_out(roi_in, roi_out);
+  err = dt_iop_clip_and_zoom_roi_cl(devid, dev_out, dev_in, &roi, roi_in);
   if(err != CL_SUCCESS) goto error;
 
   return TRUE;
@@ -104,7 +123,8 @@ error:
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_clip_and_zoom_roi(ovoid, ivoid, roi_out, roi_in, roi_out->width, roi_in->width);
+  const dt_iop_roi_t roi = _relative_roi_out(roi_in, roi_out);
+  dt_iop_clip_and_zoom_roi(ovoid, ivoid, &roi, roi_in, roi_out->width, roi_in->width);
 }
 
 void commit_params(dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
@@ -38,11 +38,13 @@
 #include "bauhaus/bauhaus.h"
 #include "common/box_filters.h"
 #include "common/darktable.h"
+#include "common/fast_guided_filter.h"
 #include "common/guided_filter.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
+#include "develop/pixelpipe_hb.h"
 #include "gui/gtk.h"
 
 #include "develop/tiling.h"
@@ -80,10 +82,20 @@ typedef struct dt_iop_hazeremoval_gui_data_t
 {
   GtkWidget *strength;
   GtkWidget *distance;
+} dt_iop_hazeremoval_gui_data_t;
+
+// Longest side of the copy of the input the global statistics are computed on
+#define STATS_SIZE 1024
+// Number of images whose statistics are remembered, for parallel exports
+#define STATS_CACHE 8
+
+// Ambient light and maximal depth of the whole image, for a given input
+typedef struct dt_iop_hazeremoval_stats_t
+{
+  uint64_t hash;
   rgb_pixel A0;
   float distance_max;
-  uint64_t hash;
-} dt_iop_hazeremoval_gui_data_t;
+} dt_iop_hazeremoval_stats_t;
 
 typedef struct dt_iop_hazeremoval_global_data_t
 {
@@ -93,6 +105,9 @@ typedef struct dt_iop_hazeremoval_global_data_t
   int kernel_hazeremoval_box_max_x;
   int kernel_hazeremoval_box_max_y;
   int kernel_hazeremoval_dehaze;
+  dt_pthread_mutex_t stats_lock;
+  dt_iop_hazeremoval_stats_t stats[STATS_CACHE];
+  int stats_next;
 } dt_iop_hazeremoval_global_data_t;
 
 
@@ -150,7 +165,7 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
 
 void init_global(dt_iop_module_so_t *self)
 {
-  dt_iop_hazeremoval_global_data_t *gd = malloc(sizeof(*gd));
+  dt_iop_hazeremoval_global_data_t *gd = calloc(1, sizeof(*gd));
   const int program = 27; // hazeremoval.cl, from programs.conf
   gd->kernel_hazeremoval_transision_map = dt_opencl_create_kernel(program, "hazeremoval_transision_map");
   gd->kernel_hazeremoval_box_min_x = dt_opencl_create_kernel(program, "hazeremoval_box_min_x");
@@ -158,6 +173,7 @@ void init_global(dt_iop_module_so_t *self)
   gd->kernel_hazeremoval_box_max_x = dt_opencl_create_kernel(program, "hazeremoval_box_max_x");
   gd->kernel_hazeremoval_box_max_y = dt_opencl_create_kernel(program, "hazeremoval_box_max_y");
   gd->kernel_hazeremoval_dehaze = dt_opencl_create_kernel(program, "hazeremoval_dehaze");
+  dt_pthread_mutex_init(&gd->stats_lock, NULL);
   self->data = gd;
 }
 
@@ -171,35 +187,16 @@ void cleanup_global(dt_iop_module_so_t *self)
   dt_opencl_free_kernel(gd->kernel_hazeremoval_box_max_x);
   dt_opencl_free_kernel(gd->kernel_hazeremoval_box_max_y);
   dt_opencl_free_kernel(gd->kernel_hazeremoval_dehaze);
+  dt_pthread_mutex_destroy(&gd->stats_lock);
   free(self->data);
   self->data = NULL;
 }
 
 
-void gui_update(struct dt_iop_module_t *self)
-{
-  dt_iop_hazeremoval_gui_data_t *g = (dt_iop_hazeremoval_gui_data_t *)self->gui_data;
-
-  dt_iop_gui_enter_critical_section(self);
-  g->distance_max = NAN;
-  g->A0[0] = NAN;
-  g->A0[1] = NAN;
-  g->A0[2] = NAN;
-  g->hash = 0;
-  dt_iop_gui_leave_critical_section(self);
-}
-
-
 void gui_init(dt_iop_module_t *self)
 {
   dt_iop_hazeremoval_gui_data_t *g = IOP_GUI_ALLOC(hazeremoval);
 
-  g->distance_max = NAN;
-  g->A0[0] = NAN;
-  g->A0[1] = NAN;
-  g->A0[2] = NAN;
-  g->hash = 0;
-
   g->strength = dt_bauhaus_slider_from_params(self, N_("strength"));
   gtk_widget_set_tooltip_text(g->strength, _("amount of haze reduction"));
 
@@ -421,10 +418,66 @@ static float ambient_light(const const_rgb_image img, int w1, rgb_pixel *pA0)
 }
 
 
+// ambient_light() on a copy of the image downscaled to STATS_SIZE:
+// the quantiles don't need the full resolution and the selection is the slow part
+static float ambient_light_lowres(const const_rgb_image img, int w1, rgb_pixel *pA0)
+{
+  const float scale = fminf((float)STATS_SIZE / MAX(img.width, img.height), 1.f);
+  if(scale == 1.f) return ambient_light(img, w1, pA0);
+
+  const int width = MAX((int)(img.width * scale), 1);
+  const int height = MAX((int)(img.height * scale), 1);
+  float *const restrict small = dt_alloc_align_float((size_t)width * height * img.stride);
+  if(!small) return ambient_light(img, w1, pA0);
+
+  interpolate_bilinear(img.data, img.width, img.height, small, width, height, img.stride);
+  const float max_depth = ambient_light((const_rgb_image){ small, width, height, img.stride }, w1, pA0);
+  dt_free_align(small);
+  return max_depth;
+}
+
+
+// The statistics describe the whole image, so they are only stored when computed from the whole image,
+// and the other pipes (darkroom main view, tiles of exports) reuse them for the same input.
+static inline gboolean is_full_frame(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in)
+{
+  return roi_in->x == 0 && roi_in->y == 0
+         && roi_in->width >= (int)(piece->buf_in.width * roi_in->scale) - 1
+         && roi_in->height >= (int)(piece->buf_in.height * roi_in->scale) - 1;
+}
+
+static gboolean get_stats(dt_iop_hazeremoval_global_data_t *gd, const uint64_t hash, rgb_pixel *pA0,
+                          float *distance_max)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&gd->stats_lock);
+  for(int k = 0; k < STATS_CACHE && !found; k++)
+  {
+    if(gd->stats[k].hash != hash) continue;
+    for(int c = 0; c < 3; c++) (*pA0)[c] = gd->stats[k].A0[c];
+    *distance_max = gd->stats[k].distance_max;
+    found = TRUE;
+  }
+  dt_pthread_mutex_unlock(&gd->stats_lock);
+  return found;
+}
+
+static void set_stats(dt_iop_hazeremoval_global_data_t *gd, const uint64_t hash, const rgb_pixel A0,
+                      const float distance_max)
+{
+  dt_pthread_mutex_lock(&gd->stats_lock);
+  dt_iop_hazeremoval_stats_t *stats = &gd->stats[gd->stats_next];
+  stats->hash = hash;
+  for(int c = 0; c < 3; c++) stats->A0[c] = A0[c];
+  stats->distance_max = distance_max;
+  gd->stats_next = (gd->stats_next + 1) % STATS_CACHE;
+  dt_pthread_mutex_unlock(&gd->stats_lock);
+}
+
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_hazeremoval_gui_data_t *const g = (dt_iop_hazeremoval_gui_data_t*)self->gui_data;
   dt_iop_hazeremoval_params_t *d = piece->data;
 
   const int ch = piece->colors;
@@ -450,46 +503,17 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   float distance_max = NAN;
 
   // hazeremoval module needs the color and the haziness (which yields
-  // distance_max) of the most hazy region of the image.  In pixelpipe
-  // FULL we can not reliably get this value as the pixelpipe might
-  // only see part of the image (region of interest).  Therefore, we
-  // try to get A0 and distance_max from the PREVIEW pixelpipe which
-  // luckily stores it for us.
-  if(self->dev->gui_attached && g && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
+  // distance_max) of the most hazy region of the image.  The pipe
+  // might only see part of the image (region of interest, tiles), so
+  // these are computed once on the whole image by whichever pipe gets
+  // it first (usually the preview) and shared by input hash.
+  dt_iop_hazeremoval_global_data_t *gd = (dt_iop_hazeremoval_global_data_t *)self->global_data;
+  const uint64_t hash = dt_dev_pixelpipe_get_upstream_params_hash(piece);
+  if(!get_stats(gd, hash, &A0, &distance_max))
   {
-    dt_iop_gui_enter_critical_section(self);
-    const uint64_t hash = g->hash;
-    dt_iop_gui_leave_critical_section(self);
-    // Note that the case 'hash == 0' on first invocation in a session
-    // implies that g->distance_max is NAN, which initiates special
-    // handling below to avoid inconsistent results.  In all other
-    // cases we make sure that the preview pipe has left us with
-    // proper readings for distance_max and A0.  If data are not yet
-    // there we need to wait (with timeout).
-    if(hash != 0
-       && !dt_dev_sync_pixelpipe_hash(self->dev, piece->pipe, self->iop_order, DT_DEV_TRANSFORM_DIR_BACK_INCL,
-                                      &self->gui_lock, &g->hash))
-      dt_control_log(_("inconsistent output"));
-    dt_iop_gui_enter_critical_section(self);
-    A0[0] = g->A0[0];
-    A0[1] = g->A0[1];
-    A0[2] = g->A0[2];
-    distance_max = g->distance_max;
-    dt_iop_gui_leave_critical_section(self);
-  }
-  // In all other cases we calculate distance_max and A0 here.
-  if(isnan(distance_max)) distance_max = ambient_light(img_in, w1, &A0);
-  // PREVIEW pixelpipe stores values.
-  if(self->dev->gui_attached && g && (piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
-  {
-    uint64_t hash = dt_dev_hash(self->dev, piece->pipe);
-    dt_iop_gui_enter_critical_section(self);
-    g->A0[0] = A0[0];
-    g->A0[1] = A0[1];
-    g->A0[2] = A0[2];
-    g->distance_max = distance_max;
-    g->hash = hash;
-    dt_iop_gui_leave_critical_section(self);
+    // Without the whole image, fall back to the statistics of what we have
+    distance_max = ambient_light_lowres(img_in, w1, &A0);
+    if(is_full_frame(piece, roi_in)) set_stats(gd, hash, A0, distance_max);
   }
 
   // calculate the transition map
@@ -547,7 +571,7 @@ static float ambient_light_cl(struct dt_iop_module_t *self, int devid, cl_mem im
   int err = dt_opencl_read_host_from_device(devid, in, img, width, height, element_size);
   if(err != CL_SUCCESS) goto error;
   const const_rgb_image img_in = (const_rgb_image){ in, width, height, element_size / sizeof(float) };
-  const float max_depth = ambient_light(img_in, w1, pA0);
+  const float max_depth = ambient_light_lowres(img_in, w1, pA0);
   dt_free_align(in);
   return max_depth;
 error:
@@ -692,7 +716,6 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem img_in, cl_mem img_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_hazeremoval_gui_data_t *const g = (dt_iop_hazeremoval_gui_data_t*)self->gui_data;
   dt_iop_hazeremoval_params_t *d = piece->data;
 
   const int ch = piece->colors;
@@ -714,47 +737,13 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   A0[2] = NAN;
   float distance_max = NAN;
 
-  // hazeremoval module needs the color and the haziness (which yields
-  // distance_max) of the most hazy region of the image.  In pixelpipe
-  // FULL we can not reliably get this value as the pixelpipe might
-  // only see part of the image (region of interest).  Therefore, we
-  // try to get A0 and distance_max from the PREVIEW pixelpipe which
-  // luckily stores it for us.
-  if(self->dev->gui_attached && g && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
-  {
-    dt_iop_gui_enter_critical_section(self);
-    const uint64_t hash = g->hash;
-    dt_iop_gui_leave_critical_section(self);
-    // Note that the case 'hash == 0' on first invocation in a session
-    // implies that g->distance_max is NAN, which initiates special
-    // handling below to avoid inconsistent results.  In all other
-    // cases we make sure that the preview pipe has left us with
-    // proper readings for distance_max and A0.  If data are not yet
-    // there we need to wait (with timeout).
-    if(hash != 0
-       && !dt_dev_sync_pixelpipe_hash(self->dev, piece->pipe, self->iop_order, DT_DEV_TRANSFORM_DIR_BACK_INCL,
-                                      &self->gui_lock, &g->hash))
-      dt_control_log(_("inconsistent output"));
-    dt_iop_gui_enter_critical_section(self);
-    A0[0] = g->A0[0];
-    A0[1] = g->A0[1];
-    A0[2] = g->A0[2];
-    distance_max = g->distance_max;
-    dt_iop_gui_leave_critical_section(self);
-  }
-  // In all other cases we calculate distance_max and A0 here.
-  if(isnan(distance_max)) distance_max = ambient_light_cl(self, devid, img_in, w1, &A0);
-  // PREVIEW pixelpipe stores values.
-  if(self->dev->gui_attached && g && (piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
+  // see process()
+  dt_iop_hazeremoval_global_data_t *gd = (dt_iop_hazeremoval_global_data_t *)self->global_data;
+  const uint64_t hash = dt_dev_pixelpipe_get_upstream_params_hash(piece);
+  if(!get_stats(gd, hash, &A0, &distance_max))
   {
-    uint64_t hash = dt_dev_hash(self->dev, piece->pipe);
-    dt_iop_gui_enter_critical_section(self);
-    g->A0[0] = A0[0];
-    g->A0[1] = A0[1];
-    g->A0[2] = A0[2];
-    g->distance_max = distance_max;
-    g->hash = hash;
-    dt_iop_gui_leave_critical_section(self);
+    distance_max = ambient_light_cl(self, devid, img_in, w1, &A0);
+    if(is_full_frame(piece, roi_in)) set_stats(gd, hash, A0, distance_max);
   }
 
   // calculate the transition map
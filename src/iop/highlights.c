@@ -28,6 +28,7 @@
 #include "common/opencl.h"
 #include "common/imagebuf.h"
 #include "common/fast_guided_filter.h"
+#include "common/multigrid.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -63,7 +64,7 @@ static void dump_PFM(const char *filename, const float* out, const uint32_t w, c
 }
 #endif
 
-DT_MODULE_INTROSPECTION(4, dt_iop_highlights_params_t)
+DT_MODULE_INTROSPECTION(5, dt_iop_highlights_params_t)
 
 typedef enum dt_iop_highlights_mode_t
 {
@@ -107,6 +108,8 @@ typedef struct dt_iop_highlights_params_t
   int debugmode;
   // params of v4
   float solid_color; // $MIN: 0.0 $MAX: 1.0 $DEFAULT: 0.5 $DESCRIPTION: "inpaint a flat color"
+  // params of v5
+  gboolean multigrid; // coarse-to-fine guided laplacians, FALSE for edits older than v5 $DEFAULT: TRUE
 } dt_iop_highlights_params_t;
 
 typedef struct dt_iop_highlights_gui_data_t
@@ -140,6 +143,7 @@ typedef struct dt_iop_highlights_global_data_t
   int kernel_filmic_wavelets_detail;
 
   int kernel_interpolate_bilinear;
+  int kernel_multigrid_inject;
 } dt_iop_highlights_global_data_t;
 
 
@@ -175,15 +179,16 @@ int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
                   void *new_params, const int new_version)
 {
-  if(old_version == 1 && new_version == 4)
+  if(old_version == 1 && new_version == 5)
   {
     /*
       params of v2 :
         float clip
       + params of v3
       + params of v4
+      + params of v5
     */
-    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - 5 * sizeof(float) - 2 * sizeof(int) - sizeof(dt_atrous_wavelets_scales_t));
+    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - 5 * sizeof(float) - 2 * sizeof(int) - sizeof(dt_atrous_wavelets_scales_t) - sizeof(gboolean));
     dt_iop_highlights_params_t *n = (dt_iop_highlights_params_t *)new_params;
     n->clip = 1.0f;
     n->noise_level = 0.0f;
@@ -193,9 +198,10 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
     n->iterations = 1;
     n->scales = 5;
     n->solid_color = 0.f;
+    n->multigrid = FALSE;
     return 0;
   }
-  if(old_version == 2 && new_version == 4)
+  if(old_version == 2 && new_version == 5)
   {
     /*
       params of v3 :
@@ -206,8 +212,9 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
         float combine;
         int debugmode;
       + params of v4
+      + params of v5
     */
-    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - 4 * sizeof(float) - 2 * sizeof(int) - sizeof(dt_atrous_wavelets_scales_t));
+    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - 4 * sizeof(float) - 2 * sizeof(int) - sizeof(dt_atrous_wavelets_scales_t) - sizeof(gboolean));
     dt_iop_highlights_params_t *n = (dt_iop_highlights_params_t *)new_params;
     n->noise_level = 0.0f;
     n->reconstructing = 0.4f;
@@ -216,17 +223,32 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
     n->iterations = 1;
     n->scales = 5;
     n->solid_color = 0.f;
+    n->multigrid = FALSE;
     return 0;
   }
-  if(old_version == 3 && new_version == 4)
+  if(old_version == 3 && new_version == 5)
   {
     /*
       params of v4 :
         float solid_color;
+      + params of v5
     */
-    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - sizeof(float));
+    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - sizeof(float) - sizeof(gboolean));
     dt_iop_highlights_params_t *n = (dt_iop_highlights_params_t *)new_params;
     n->solid_color = 0.f;
+    n->multigrid = FALSE;
+    return 0;
+  }
+  if(old_version == 4 && new_version == 5)
+  {
+    /*
+      params of v5 :
+        gboolean multigrid;
+      Existing guided laplacians edits keep rendering with the single-resolution solver.
+    */
+    memcpy(new_params, old_params, sizeof(dt_iop_highlights_params_t) - sizeof(gboolean));
+    dt_iop_highlights_params_t *n = (dt_iop_highlights_params_t *)new_params;
+    n->multigrid = FALSE;
     return 0;
   }
 
@@ -419,10 +441,11 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 
     // Warning : in and out are single-channel in RAW mode
     // in + out + interpolated + ds_interpolated + ds_tmp + 2 * ds_LF + ds_HF + mask + ds_mask
+    // + 2 for the multigrid pyramid levels and upsampling buffer
     if(filters) // RAW
     {
-      tiling->factor = 2.f + 2.f * 4 + 6.f * 4 / DS_FACTOR;
-      tiling->factor_cl =  2.f + 3.f * 4 + 5.f * 4 / DS_FACTOR;
+      tiling->factor = 2.f + 2.f * 4 + 8.f * 4 / DS_FACTOR;
+      tiling->factor_cl =  2.f + 3.f * 4 + 7.f * 4 / DS_FACTOR;
 
       // The wavelets decomposition uses a temp buffer of size 4 x ds_width
       tiling->maxbuf = 1.f / roi_in->height * 4.f / DS_FACTOR;
@@ -1548,6 +1571,44 @@ static inline gint wavelets_process(const float *const restrict in, float
 }
 
 
+// Coarser levels of the multigrid solver for guided laplacians, under the DS_FACTOR downscaling
+#define MULTIGRID_LEVELS 2
+
+typedef struct laplacian_sweep_t
+{
+  float *HF;
+  float *LF_odd;
+  float *LF_even;
+  float *temp;
+  int scales;
+  float noise_level;
+  float solid_color;
+  dt_dev_pixelpipe_t *pipe;
+} laplacian_sweep_t;
+
+static gboolean _laplacian_sweep(float *const restrict image, const float *const restrict mask,
+                                 const size_t width, const size_t height, const int level,
+                                 const int iterations, const gboolean finest, void *user_data)
+{
+  laplacian_sweep_t *sweep = (laplacian_sweep_t *)user_data;
+
+  // wavelets radii are in pixels: each coarser level needs one scale less to cover the same area
+  const int scales = MAX(sweep->scales - level, 1);
+
+  for(int i = 0; i < iterations; i++)
+  {
+    if(dt_dev_pixelpipe_cancelled(sweep->pipe)) return FALSE;
+
+    const int salt = finest && (i == iterations - 1); // add noise on the last iteration only
+    wavelets_process(image, sweep->temp, mask, width, height, scales, sweep->HF, sweep->LF_odd,
+                     sweep->LF_even, DIFFUSE_RECONSTRUCT_RGB, sweep->noise_level, salt, sweep->solid_color);
+    wavelets_process(sweep->temp, image, mask, width, height, scales, sweep->HF, sweep->LF_odd,
+                     sweep->LF_even, DIFFUSE_RECONSTRUCT_CHROMA, sweep->noise_level, salt, sweep->solid_color);
+  }
+
+  return TRUE;
+}
+
 static void process_laplacian_bayer(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                     const void *const restrict ivoid, void *const restrict ovoid,
                                     const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
@@ -1601,13 +1662,20 @@ static void process_laplacian_bayer(struct dt_iop_module_t *self, dt_dev_pixelpi
   interpolate_bilinear(clipping_mask, width, height, ds_clipping_mask, ds_width, ds_height, 4);
   interpolate_bilinear(interpolated, width, height, ds_interpolated, ds_width, ds_height, 4);
 
-  for(int i = 0; i < data->iterations; i++)
+  // Solve coarse-to-fine: the coarsest level propagates colors into large clipped areas
+  // for all the iterations, the finer ones only refine the details.
+  laplacian_sweep_t sweep = { .HF = HF, .LF_odd = LF_odd, .LF_even = LF_even, .temp = temp,
+                              .scales = scales, .noise_level = noise_level,
+                              .solid_color = data->solid_color, .pipe = piece->pipe };
+  const int levels = (data->multigrid && data->iterations > 1) ? MULTIGRID_LEVELS : 0;
+  if(!dt_multigrid_solve(ds_interpolated, ds_clipping_mask, ds_width, ds_height, levels, data->iterations,
+                         MAX(data->iterations / 4, 1), _laplacian_sweep, &sweep)
+     && !dt_dev_pixelpipe_cancelled(piece->pipe))
   {
-    const int salt = (i == data->iterations - 1); // add noise on the last iteration only
-    wavelets_process(ds_interpolated, temp, ds_clipping_mask, ds_width, ds_height, scales, HF, LF_odd,
-                     LF_even, DIFFUSE_RECONSTRUCT_RGB, noise_level, salt, data->solid_color);
-    wavelets_process(temp, ds_interpolated, ds_clipping_mask, ds_width, ds_height, scales, HF, LF_odd,
-                     LF_even, DIFFUSE_RECONSTRUCT_CHROMA, noise_level, salt, data->solid_color);
+    // the coarse levels couldn't be allocated and ds_interpolated is untouched:
+    // fall back to the single-resolution solver
+    dt_print(DT_DEBUG_MEMORY, "[highlights] multigrid solver failed, falling back to single resolution\n");
+    _laplacian_sweep(ds_interpolated, ds_clipping_mask, ds_width, ds_height, 0, data->iterations, TRUE, &sweep);
   }
 
   // Upsample
@@ -1743,6 +1811,100 @@ static inline cl_int wavelets_process_cl(const int devid,
   return err;
 }
 
+static cl_int _interpolate_bilinear_cl(const int devid, dt_iop_highlights_global_data_t *const gd, cl_mem in,
+                                       const int width_in, const int height_in, cl_mem out, const int width_out,
+                                       const int height_out)
+{
+  size_t sizes[] = { ROUNDUPDWD(width_out, devid), ROUNDUPDHT(height_out, devid), 1 };
+  const int RGBa = TRUE;
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 0, sizeof(cl_mem), (void *)&in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 1, sizeof(int), (void *)&width_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 2, sizeof(int), (void *)&height_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 3, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 4, sizeof(int), (void *)&width_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 5, sizeof(int), (void *)&height_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 6, sizeof(int), (void *)&RGBa);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_interpolate_bilinear, sizes);
+}
+
+// OpenCL counterpart of dt_multigrid_solve() with the _laplacian_sweep() solver.
+// HF, LF_odd, LF_even and temp are sized for level 0 and reused by the coarser levels.
+static cl_int _multigrid_laplacian_cl(const int devid, dt_iop_highlights_global_data_t *const gd,
+                                      cl_mem image, cl_mem mask, const int width, const int height,
+                                      const int level, const int levels, const int iterations,
+                                      const int fine_iterations, const int scales, cl_mem HF, cl_mem LF_odd,
+                                      cl_mem LF_even, cl_mem temp, const float noise_level,
+                                      const float solid_color)
+{
+  cl_int err = CL_SUCCESS;
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  const int level_scales = MAX(scales - level, 1);
+  cl_mem ds_image = NULL;
+  cl_mem ds_mask = NULL;
+  cl_mem us_image = NULL;
+
+  if(level < levels)
+  {
+    const int ds_width = width / 2;
+    const int ds_height = height / 2;
+    ds_image = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float) * 4);
+    ds_mask = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float) * 4);
+    us_image = dt_opencl_alloc_device(devid, width, height, sizeof(float) * 4);
+    if(ds_image == NULL || ds_mask == NULL || us_image == NULL)
+    {
+      err = DT_OPENCL_DEFAULT_ERROR;
+      goto error;
+    }
+
+    err = _interpolate_bilinear_cl(devid, gd, image, width, height, ds_image, ds_width, ds_height);
+    if(err != CL_SUCCESS) goto error;
+    err = _interpolate_bilinear_cl(devid, gd, mask, width, height, ds_mask, ds_width, ds_height);
+    if(err != CL_SUCCESS) goto error;
+
+    err = _multigrid_laplacian_cl(devid, gd, ds_image, ds_mask, ds_width, ds_height, level + 1, levels,
+                                  iterations, fine_iterations, scales, HF, LF_odd, LF_even, temp, noise_level,
+                                  solid_color);
+    if(err != CL_SUCCESS) goto error;
+
+    // upsample into temp, inject in masked areas into us_image, then back to image
+    err = _interpolate_bilinear_cl(devid, gd, ds_image, ds_width, ds_height, temp, width, height);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_multigrid_inject, 0, sizeof(cl_mem), (void *)&image);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_multigrid_inject, 1, sizeof(cl_mem), (void *)&temp);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_multigrid_inject, 2, sizeof(cl_mem), (void *)&mask);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_multigrid_inject, 3, sizeof(cl_mem), (void *)&us_image);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_multigrid_inject, 4, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_multigrid_inject, 5, sizeof(int), (void *)&height);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_multigrid_inject, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, us_image, image, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  const int n = (level == levels) ? iterations : fine_iterations;
+  for(int i = 0; i < n; i++)
+  {
+    const int salt = (level == 0) && (i == n - 1); // add noise on the last iteration only
+    err = wavelets_process_cl(devid, image, temp, mask, sizes, width, height, gd, level_scales, HF, LF_odd,
+                              LF_even, DIFFUSE_RECONSTRUCT_RGB, noise_level, salt, solid_color);
+    if(err != CL_SUCCESS) goto error;
+
+    err = wavelets_process_cl(devid, temp, image, mask, sizes, width, height, gd, level_scales, HF, LF_odd,
+                              LF_even, DIFFUSE_RECONSTRUCT_CHROMA, noise_level, salt, solid_color);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+error:
+  if(ds_image) dt_opencl_release_mem_object(ds_image);
+  if(ds_mask) dt_opencl_release_mem_object(ds_mask);
+  if(us_image) dt_opencl_release_mem_object(us_image);
+  return err;
+}
+
 static cl_int process_laplacian_bayer_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                          cl_mem dev_in, cl_mem dev_out,
                                          const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
@@ -1837,17 +1999,13 @@ static cl_int process_laplacian_bayer_cl(struct dt_iop_module_t *self, dt_dev_pi
   err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_interpolate_bilinear, ds_sizes);
   if(err != CL_SUCCESS) goto error;
 
-  for(int i = 0; i < data->iterations; i++)
-  {
-    const int salt = (i == data->iterations - 1); // add noise on the last iteration only
-    err = wavelets_process_cl(devid, ds_interpolated, temp, ds_clipping_mask, ds_sizes, ds_width, ds_height, gd, scales, HF,
-                              LF_odd, LF_even, DIFFUSE_RECONSTRUCT_RGB, noise_level, salt, data->solid_color);
-    if(err != CL_SUCCESS) goto error;
-
-    err = wavelets_process_cl(devid, temp, ds_interpolated, ds_clipping_mask, ds_sizes, ds_width, ds_height, gd, scales, HF,
-                              LF_odd, LF_even, DIFFUSE_RECONSTRUCT_CHROMA, noise_level, salt, data->solid_color);
-    if(err != CL_SUCCESS) goto error;
-  }
+  // Solve coarse-to-fine, same as the CPU path
+  const int levels = (data->multigrid && data->iterations > 1)
+                         ? dt_multigrid_levels(ds_width, ds_height, MULTIGRID_LEVELS) : 0;
+  err = _multigrid_laplacian_cl(devid, gd, ds_interpolated, ds_clipping_mask, ds_width, ds_height, 0, levels,
+                                data->iterations, MAX(data->iterations / 4, 1), scales, HF, LF_odd, LF_even, temp,
+                                noise_level, data->solid_color);
+  if(err != CL_SUCCESS) goto error;
 
   // Upsample
   dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 0, sizeof(cl_mem), (void *)&ds_interpolated);
@@ -2118,6 +2276,7 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_highlights_diffuse_color = dt_opencl_create_kernel(program, "diffuse_color");
   gd->kernel_highlights_false_color = dt_opencl_create_kernel(program, "highlights_false_color");
   gd->kernel_interpolate_bilinear = dt_opencl_create_kernel(program, "interpolate_bilinear");
+  gd->kernel_multigrid_inject = dt_opencl_create_kernel(program, "multigrid_inject");
 
   const int wavelets = 35; // bspline.cl, from programs.conf
   gd->kernel_filmic_bspline_horizontal = dt_opencl_create_kernel(wavelets, "blur_2D_Bspline_horizontal");
@@ -2145,6 +2304,7 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_filmic_wavelets_detail);
 
   dt_opencl_free_kernel(gd->kernel_interpolate_bilinear);
+  dt_opencl_free_kernel(gd->kernel_multigrid_inject);
 
   free(module->data);
   module->data = NULL;
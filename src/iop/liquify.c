@@ -1477,9 +1477,9 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
   if(map == NULL)
     return;
 
-  // 3. apply the map
+  // 3. apply the map, unless the pipe got cancelled while we were building it
 
-  if(map_extent.width != 0 && map_extent.height != 0)
+  if(map_extent.width != 0 && map_extent.height != 0 && !dt_dev_pixelpipe_cancelled(piece->pipe))
     apply_global_distortion_map(module, piece, in, out, roi_in, roi_out, map, &map_extent);
 
   dt_free_align((void *)map);
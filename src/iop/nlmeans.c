@@ -431,7 +431,8 @@ static void process_cpu(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                                       .patch_radius = P,
                                       .search_radius = K,
                                       .decimate = decimate,
-                                      .norm = norm2 };
+                                      .norm = norm2,
+                                      .pipe = piece->pipe };
   denoiser(ivoid,ovoid,roi_in,roi_out,&params);
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
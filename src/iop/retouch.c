@@ -3303,6 +3303,8 @@ static void rt_process_forms(float *layer, dwt_params_t *const wt_p, const int s
   if(wt_p->merge_from_scale == 0 && wt_p->return_layer > 0 && scale != wt_p->return_layer && scale != 0) return;
   // do not process the reconstructed image
   if(scale > wt_p->scales + 1) return;
+  // the pipe throws the output away when cancelled, don't heal or clone on the remaining scales
+  if(dt_dev_pixelpipe_cancelled(piece->pipe)) return;
 
   dt_develop_blend_params_t *bp = (dt_develop_blend_params_t *)piece->blendop_data;
   dt_iop_retouch_params_t *p = (dt_iop_retouch_params_t *)piece->data;
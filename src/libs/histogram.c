@@ -46,6 +46,11 @@
 #define HISTOGRAM_BINS 256
 #define TONES 128
 #define GAMMA 1.f / 1.5f
+// Waveforms and vectorscope are computed from a decimation of the backbuffer
+// to at most this size on its larger side, that's still more than the scope has pixels.
+#define SCOPE_MAX_SIZE 512
+// Columns binned together by a thread in horizontal waveforms
+#define WAVEFORM_BLOCK 16
 
 DT_MODULE(1)
 
@@ -82,6 +87,11 @@ typedef struct dt_lib_histogram_t
 
   dt_lib_histogram_cache_t cache;
   cairo_surface_t *cst;
+
+  // Luv chromaticities of the vectorscope samples, they don't depend on zoom
+  float *uv;
+  size_t uv_samples;
+  uint64_t uv_hash;
 } dt_lib_histogram_t;
 
 const char *name(struct dt_lib_module_t *self)
@@ -160,6 +170,7 @@ void _reset_cache(dt_lib_histogram_t *d)
   d->cache.height = -1;
   d->cache.hash = (uint64_t)-1;
   d->cache.zoom = -1.;
+  d->uv_hash = (uint64_t)-1;
 }
 
 
@@ -249,10 +260,32 @@ uint32_t _find_max_histogram(const uint32_t *const restrict bins, const size_t b
 }
 
 
+static inline size_t _scope_step(const dt_backbuf_t *const backbuf)
+{
+  const size_t max_size = MAX(backbuf->width, backbuf->height);
+  return MAX((max_size + SCOPE_MAX_SIZE - 1) / SCOPE_MAX_SIZE, 1);
+}
+
+static inline size_t _scope_samples(const size_t size, const size_t step)
+{
+  return (size + step - 1) / step;
+}
+
+static inline void _tone_indices(const float *const restrict pixel, uint32_t index[4])
+{
+  for_four_channels(c)
+    index[c] = (uint32_t)CLAMP(roundf(pixel[c] * (TONES - 1)), 0, TONES - 1);
+}
+
+__DT_CLONE_TARGETS__
 static inline void _bin_pixels_waveform(const float *const restrict image, uint32_t *const restrict bins,
-                                        const size_t width, const size_t height, const size_t binning_size,
-                                        const gboolean vertical)
+                                        const size_t width, const size_t height, const size_t step,
+                                        const size_t binning_size, const gboolean vertical)
 {
+  // bins are laid out for the image decimated by step
+  const size_t samples_x = _scope_samples(width, step);
+  const size_t samples_y = _scope_samples(height, step);
+
   // Init
 #ifdef _OPENMP
 #pragma omp parallel for simd default(none) \
@@ -263,30 +296,50 @@ static inline void _bin_pixels_waveform(const float *const restrict image, uint3
   for(size_t k = 0; k < binning_size; k++) bins[k] = 0;
 
   // Process
+  // Each row (vertical) or column (horizontal) of the image owns its bins,
+  // so threads get distinct rows/columns and never write the same bin.
+  if(vertical)
+  {
 #ifdef _OPENMP
-#ifndef _WIN32
-#pragma omp parallel for default(none) \
-        dt_omp_firstprivate(image, height, width, binning_size, vertical) \
-        reduction(+: bins[0: binning_size]) \
-        schedule(static) collapse(3)
-#else
 #pragma omp parallel for default(none) \
-        dt_omp_firstprivate(image, height, width, binning_size, vertical) \
-        shared(bins) \
-        schedule(static) collapse(3)
+        dt_omp_firstprivate(image, bins, width, step, samples_x, samples_y) \
+        schedule(static)
 #endif
+    for(size_t i = 0; i < samples_y; i++)
+    {
+      uint32_t *const restrict row_bins = bins + i * TONES * 4;
+      const float *const restrict row = image + i * step * width * 4;
+      for(size_t j = 0; j < samples_x; j++)
+      {
+        uint32_t DT_ALIGNED_PIXEL index[4];
+        _tone_indices(row + j * step * 4, index);
+        for(size_t c = 0; c < 3; c++) row_bins[index[c] * 4 + c]++;
+      }
+    }
+  }
+  else
+  {
+    // Go through blocks of columns row by row, to read the image in order
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+        dt_omp_firstprivate(image, bins, width, step, samples_x, samples_y) \
+        schedule(static)
 #endif
-  for(size_t i = 0; i < height; i++)
-    for(size_t j = 0; j < width; j++)
-      for(size_t c = 0; c < 3; c++)
+    for(size_t block = 0; block < samples_x; block += WAVEFORM_BLOCK)
+    {
+      const size_t block_end = MIN(block + WAVEFORM_BLOCK, samples_x);
+      for(size_t i = 0; i < samples_y; i++)
       {
-        const float value = image[(i * width + j) * 4 + c];
-        const size_t index = (uint8_t)CLAMP(roundf(value * (TONES - 1)), 0, TONES - 1);
-        if(vertical)
-          bins[((i * (TONES)) + index) * 4 + c]++;
-        else
-          bins[(((TONES - 1) - index) * width + j) * 4 + c]++;
+        const float *const restrict row = image + i * step * width * 4;
+        for(size_t j = block; j < block_end; j++)
+        {
+          uint32_t DT_ALIGNED_PIXEL index[4];
+          _tone_indices(row + j * step * 4, index);
+          for(size_t c = 0; c < 3; c++) bins[(((TONES - 1) - index[c]) * samples_x + j) * 4 + c]++;
+        }
       }
+    }
+  }
 }
 
 static void _create_waveform_image(const uint32_t *const restrict bins, uint8_t *const restrict image,
@@ -383,19 +436,22 @@ static void _paint_parade(cairo_t *cr, uint8_t *const restrict image, const int
 
 static void _process_waveform(dt_backbuf_t *backbuf, cairo_t *cr, const int width, const int height, const gboolean vertical, const gboolean parade)
 {
-  const size_t binning_size = (vertical) ? 4 * TONES * backbuf->height : 4 * TONES * backbuf->width;
+  const size_t step = _scope_step(backbuf);
+  const size_t samples_x = _scope_samples(backbuf->width, step);
+  const size_t samples_y = _scope_samples(backbuf->height, step);
+  const size_t binning_size = (vertical) ? 4 * TONES * samples_y : 4 * TONES * samples_x;
 
   // 1. Pixel binning along columns/rows, aka compute a column/row-wise histogram
   uint32_t *const restrict bins = dt_alloc_align(binning_size * sizeof(uint32_t));
-  _bin_pixels_waveform(backbuf->buffer, bins, backbuf->width, backbuf->height, binning_size, vertical);
+  _bin_pixels_waveform(backbuf->buffer, bins, backbuf->width, backbuf->height, step, binning_size, vertical);
 
   // 2. Paint image.
   // In a 1D histogram, pixel frequencies are shown as height (y axis) for each RGB quantum (x axis).
   // Here, we do a sort of 2D histogram : pixel frequencies are shown as opacity ("z" axis),
   // for each image column (x axis), for each RGB quantum (y axis)
   uint8_t *const restrict image = dt_alloc_align(binning_size * sizeof(uint8_t));
-  const size_t img_width = (vertical) ? TONES : backbuf->width;
-  const size_t img_height = (vertical) ? backbuf->height : TONES;
+  const size_t img_width = (vertical) ? TONES : samples_x;
+  const size_t img_height = (vertical) ? samples_y : TONES;
   const uint32_t overall_max_hist = _find_max_histogram(bins, binning_size);
   _create_waveform_image(bins, image, overall_max_hist, img_width, img_height);
   dt_free_align(bins);
@@ -437,49 +493,112 @@ static float _vectorscope_coord_zoom_to_Luv(const float value, const float zoom)
   return value * (2.f * zoom) / (HISTOGRAM_BINS - 1) - zoom;
 }
 
-static void _bin_pixels_vectorscope(const float *const restrict image, uint32_t *const restrict vectorscope,
-                                    dt_iop_order_iccprofile_info_t *profile,
-                                    const size_t n_pixels, const float zoom)
+static const float *_get_vectorscope_uv(dt_lib_histogram_t *d, const dt_iop_order_iccprofile_info_t *const profile,
+                                        size_t *n_samples)
 {
-  // Init
+  const dt_backbuf_t *const backbuf = d->backbuf;
+  const size_t step = _scope_step(backbuf);
+  const size_t width = backbuf->width;
+  const size_t samples_x = _scope_samples(backbuf->width, step);
+  const size_t samples_y = _scope_samples(backbuf->height, step);
+  *n_samples = samples_x * samples_y;
+
+  // The output profile is part of the backbuffer hash, zooming only needs to rebin
+  if(d->uv && d->uv_hash == backbuf->hash && d->uv_samples == *n_samples) return d->uv;
+
+  if(d->uv) dt_free_align(d->uv);
+  d->uv = dt_alloc_align_float(2 * *n_samples);
+  d->uv_hash = (uint64_t)-1;
+  if(d->uv == NULL) return NULL;
+
+  const float *const restrict image = backbuf->buffer;
+  float *const restrict uv = d->uv;
+
 #ifdef _OPENMP
-#pragma omp parallel for simd default(none) \
-        aligned(vectorscope: 64) \
-        dt_omp_firstprivate(vectorscope) \
-        schedule(static)
+#pragma omp parallel for default(none) \
+        dt_omp_firstprivate(image, uv, width, step, samples_x, samples_y, profile) \
+        schedule(static) collapse(2)
 #endif
-  for(size_t k = 0; k < HISTOGRAM_BINS * HISTOGRAM_BINS; k++) vectorscope[k] = 0;
+  for(size_t i = 0; i < samples_y; i++)
+    for(size_t j = 0; j < samples_x; j++)
+    {
+      dt_aligned_pixel_t XYZ_D50 = { 0.f };
+      dt_aligned_pixel_t xyY = { 0.f };
+      dt_aligned_pixel_t Luv = { 0.f };
+      dt_ioppr_rgb_matrix_to_xyz(image + (i * width + j) * step * 4, XYZ_D50, profile->matrix_in_transposed,
+                                 profile->lut_in, profile->unbounded_coeffs_in, profile->lutsize,
+                                 profile->nonlinearlut);
+      dt_XYZ_to_xyY(XYZ_D50, xyY);
+      dt_xyY_to_Luv(xyY, Luv);
+
+      const size_t k = i * samples_x + j;
+      uv[2 * k] = Luv[1];
+      uv[2 * k + 1] = Luv[2];
+    }
+
+  d->uv_hash = backbuf->hash;
+  d->uv_samples = *n_samples;
+  return d->uv;
+}
+
+__DT_CLONE_TARGETS__
+static void _bin_pixels_vectorscope(const float *const restrict uv, uint32_t *const restrict vectorscope,
+                                    const size_t n_samples, const float zoom)
+{
+  // Every thread bins into its own vectorscope, merged at the end
+  const size_t nthreads = darktable.num_openmp_threads;
+  size_t padded_size;
+  uint32_t *const restrict partial
+      = dt_calloc_perthread(HISTOGRAM_BINS * HISTOGRAM_BINS, sizeof(uint32_t), &padded_size);
+
+  if(partial == NULL)
+  {
+    // out of memory: bin on a single thread, straight into the output
+    memset(vectorscope, 0, sizeof(uint32_t) * HISTOGRAM_BINS * HISTOGRAM_BINS);
+    for(size_t k = 0; k < n_samples; k++)
+    {
+      const size_t U_index = (size_t)CLAMP(roundf(_Luv_to_vectorscope_coord_zoom(uv[2 * k], zoom)), 0, HISTOGRAM_BINS - 1);
+      const size_t V_index = (size_t)CLAMP(roundf(_Luv_to_vectorscope_coord_zoom(uv[2 * k + 1], zoom)), 0, HISTOGRAM_BINS - 1);
+      vectorscope[(HISTOGRAM_BINS - 1 - V_index) * HISTOGRAM_BINS + U_index]++;
+    }
+    return;
+  }
 
 #ifdef _OPENMP
-#ifndef _WIN32
-#pragma omp parallel for default(none) \
-        dt_omp_firstprivate(image, n_pixels, profile, zoom) \
-        reduction(+: vectorscope[0: HISTOGRAM_BINS * HISTOGRAM_BINS]) \
-        schedule(static)
-#else
-#pragma omp parallel for default(none) \
-        dt_omp_firstprivate(image, n_pixels, profile, zoom) \
-        shared(vectorscope) \
-        schedule(static)
+#pragma omp parallel default(none) \
+        dt_omp_firstprivate(uv, n_samples, partial, padded_size, zoom)
 #endif
+  {
+    uint32_t *const restrict local = dt_get_perthread(partial, padded_size);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(size_t k = 0; k < n_samples; k++)
+    {
+      // Luv is sampled between 0 and 100.0f, u and v between +/- 220.f
+      const size_t U_index = (size_t)CLAMP(roundf(_Luv_to_vectorscope_coord_zoom(uv[2 * k], zoom)), 0, HISTOGRAM_BINS - 1);
+      const size_t V_index = (size_t)CLAMP(roundf(_Luv_to_vectorscope_coord_zoom(uv[2 * k + 1], zoom)), 0, HISTOGRAM_BINS - 1);
+
+      // We put V = 0 at the bottom of the image.
+      local[(HISTOGRAM_BINS - 1 - V_index) * HISTOGRAM_BINS + U_index]++;
+    }
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+        aligned(vectorscope: 64) \
+        dt_omp_firstprivate(vectorscope, partial, padded_size, nthreads) \
+        schedule(static)
 #endif
-  for(size_t k = 0; k < n_pixels * 4; k += 4)
+  for(size_t k = 0; k < HISTOGRAM_BINS * HISTOGRAM_BINS; k++)
   {
-    dt_aligned_pixel_t XYZ_D50 = { 0.f };
-    dt_aligned_pixel_t xyY = { 0.f };
-    dt_aligned_pixel_t Luv = { 0.f };
-    dt_ioppr_rgb_matrix_to_xyz(image + k, XYZ_D50, profile->matrix_in_transposed, profile->lut_in, profile->unbounded_coeffs_in,
-                               profile->lutsize, profile->nonlinearlut);
-    dt_XYZ_to_xyY(XYZ_D50, xyY);
-    dt_xyY_to_Luv(xyY, Luv);
-
-    // Luv is sampled between 0 and 100.0f, u and v between +/- 220.f
-    const size_t U_index = (size_t)CLAMP(roundf(_Luv_to_vectorscope_coord_zoom(Luv[1], zoom)), 0, HISTOGRAM_BINS - 1);
-    const size_t V_index = (size_t)CLAMP(roundf(_Luv_to_vectorscope_coord_zoom(Luv[2], zoom)), 0, HISTOGRAM_BINS - 1);
-
-    // We put V = 0 at the bottom of the image.
-    vectorscope[(HISTOGRAM_BINS - 1 - V_index) * HISTOGRAM_BINS + U_index]++;
+    uint32_t sum = 0;
+    for(size_t t = 0; t < nthreads; t++) sum += partial[t * padded_size + k];
+    vectorscope[k] = sum;
   }
+
+  dt_free_align(partial);
 }
 
 static void _create_vectorscope_image(const uint32_t *const restrict vectorscope, uint8_t *const restrict image,
@@ -521,14 +640,18 @@ static void _create_vectorscope_image(const uint32_t *const restrict vectorscope
 }
 
 
-static void _process_vectorscope(dt_backbuf_t *backbuf, cairo_t *cr, const int width, const int height, const float zoom)
+static void _process_vectorscope(dt_lib_histogram_t *d, cairo_t *cr, const int width, const int height, const float zoom)
 {
   dt_iop_order_iccprofile_info_t *profile = darktable.develop->preview_pipe->output_profile_info;
   if(profile == NULL) return;
 
+  size_t n_samples = 0;
+  const float *const restrict uv = _get_vectorscope_uv(d, profile, &n_samples);
+  if(uv == NULL) return;
+
   // 1. Process data
   uint32_t *const restrict vectorscope = dt_alloc_align(HISTOGRAM_BINS * HISTOGRAM_BINS * sizeof(uint32_t));
-  _bin_pixels_vectorscope(backbuf->buffer, vectorscope, profile, backbuf->width * backbuf->height, zoom);
+  _bin_pixels_vectorscope(uv, vectorscope, n_samples, zoom);
 
   const uint32_t max_hist = _find_max_histogram(vectorscope, HISTOGRAM_BINS * HISTOGRAM_BINS);
   uint8_t *const restrict image = dt_alloc_align(4 * HISTOGRAM_BINS * HISTOGRAM_BINS * sizeof(uint8_t));
@@ -767,7 +890,7 @@ gboolean _redraw_surface(dt_lib_histogram_t *d)
     }
     case DT_LIB_HISTOGRAM_SCOPE_VECTORSCOPE:
     {
-      _process_vectorscope(d->backbuf, cr, width, height, d->zoom);
+      _process_vectorscope(d, cr, width, height, d->zoom);
       break;
     }
     default:
@@ -951,6 +1074,7 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_lib_histogram_t *d = self->data;
   _destroy_surface(d);
+  if(d->uv) dt_free_align(d->uv);
   dt_free_align(self->data);
   self->data = NULL;
 }
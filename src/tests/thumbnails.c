@@ -0,0 +1,230 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Stress test for concurrent pipelines.
+ *
+ * Imports the images given on the command line, duplicates each of them a number of times
+ * (so every duplicate gets a fresh default history on first use), then renders thumbnails
+ * for all of them from several threads at once through dt_imageio_export_with_flags().
+ *
+ * Checks that every thumbnail got rendered and that every image ends up with one,
+ * consistent, default history: no duplicated or interleaved rows in main.history.
+ */
+
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define DUPLICATES 16
+#define THREADS 8
+#define THUMB_SIZE 256
+
+typedef struct thumb_data_t
+{
+  dt_imageio_module_data_t head;
+  uint8_t *buf;
+} thumb_data_t;
+
+typedef struct worker_t
+{
+  int32_t *ids;
+  int n_ids;
+  int offset;
+  int failed;
+} worker_t;
+
+static int _levels(dt_imageio_module_data_t *data)
+{
+  return IMAGEIO_RGB | IMAGEIO_INT8;
+}
+
+static int _bpp(dt_imageio_module_data_t *data)
+{
+  return 8;
+}
+
+static int _write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int32_t imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
+                        const gboolean export_masks)
+{
+  thumb_data_t *d = (thumb_data_t *)data;
+  memcpy(d->buf, in, sizeof(uint32_t) * data->width * data->height);
+  return 0;
+}
+
+static gpointer _worker(gpointer user_data)
+{
+  worker_t *w = (worker_t *)user_data;
+  uint8_t *buf = dt_alloc_align(sizeof(uint32_t) * THUMB_SIZE * THUMB_SIZE);
+
+  dt_imageio_module_format_t format = { 0 };
+  format.bpp = _bpp;
+  format.write_image = _write_image;
+  format.levels = _levels;
+
+  // Every thread walks the whole list, starting at a different place,
+  // so the same image is regularly processed by several threads at once.
+  for(int i = 0; i < w->n_ids; i++)
+  {
+    const int32_t imgid = w->ids[(i + w->offset) % w->n_ids];
+    thumb_data_t dat = { 0 };
+    dat.head.max_width = THUMB_SIZE;
+    dat.head.max_height = THUMB_SIZE;
+    dat.buf = buf;
+
+    if(dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, TRUE, FALSE,
+                                    FALSE, FALSE, TRUE, NULL, FALSE, FALSE, DT_COLORSPACE_NONE, NULL,
+                                    DT_INTENT_LAST, NULL, NULL, 1, 1, NULL)
+       || dat.head.width <= 0 || dat.head.height <= 0)
+    {
+      printf("  [FAIL] thumbnail for image %i\n", imgid);
+      w->failed++;
+    }
+  }
+
+  dt_free_align(buf);
+  return NULL;
+}
+
+static int _check_history(const int32_t imgid)
+{
+  sqlite3_stmt *stmt;
+  int failed = 0;
+
+  // history rows must be numbered 0..n-1 without duplicates,
+  // and history_end can't point past them
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT COUNT(*), COUNT(DISTINCT num), IFNULL(MIN(num), 0), IFNULL(MAX(num), -1),"
+                              "       (SELECT history_end FROM main.images WHERE id = ?1)"
+                              " FROM main.history"
+                              " WHERE imgid = ?1",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int count = sqlite3_column_int(stmt, 0);
+    const int distinct = sqlite3_column_int(stmt, 1);
+    const int min_num = sqlite3_column_int(stmt, 2);
+    const int max_num = sqlite3_column_int(stmt, 3);
+    const int history_end = sqlite3_column_int(stmt, 4);
+
+    if(count == 0 || count != distinct || min_num != 0 || max_num != count - 1 || history_end > count)
+    {
+      printf("  [FAIL] image %i: %i history items, %i distinct, num in [%i; %i], history end %i\n", imgid, count,
+             distinct, min_num, max_num, history_end);
+      failed = 1;
+    }
+    else
+      printf("  [OK] image %i: %i history items\n", imgid, count);
+  }
+  else
+    failed = 1;
+
+  sqlite3_finalize(stmt);
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc < 2)
+  {
+    fprintf(stderr, "usage: %s <image> [<image> ...]\n", argv[0]);
+    exit(1);
+  }
+
+  char *argv_override[] = { "ansel-test-thumbnails", "--library", ":memory:", "--conf", "write_sidecar_files=never",
+                            NULL };
+  int argc_override = sizeof(argv_override) / sizeof(*argv_override) - 1;
+
+  // init dt without gui and without data.db:
+  if(dt_init(argc_override, argv_override, FALSE, FALSE, NULL)) exit(1);
+
+  GArray *ids = g_array_new(FALSE, FALSE, sizeof(int32_t));
+  for(int k = 1; k < argc; k++)
+  {
+    gchar *directory = g_path_get_dirname(argv[k]);
+    dt_film_t film;
+    const int filmid = dt_film_new(&film, directory);
+    const int32_t id = dt_image_import(filmid, argv[k], FALSE);
+    g_free(directory);
+    if(!id)
+    {
+      fprintf(stderr, "can't import %s\n", argv[k]);
+      continue;
+    }
+
+    g_array_append_val(ids, id);
+    for(int d = 0; d < DUPLICATES; d++)
+    {
+      const int32_t dup = dt_image_duplicate(id);
+      if(dup > 0) g_array_append_val(ids, dup);
+    }
+  }
+
+  if(ids->len == 0)
+  {
+    g_array_free(ids, TRUE);
+    dt_cleanup();
+    exit(1);
+  }
+
+  printf("rendering %u thumbnails from %i threads\n", ids->len * THREADS, THREADS);
+
+  worker_t workers[THREADS];
+  GThread *threads[THREADS];
+  for(int t = 0; t < THREADS; t++)
+  {
+    workers[t] = (worker_t){ (int32_t *)ids->data, ids->len, t * ids->len / THREADS, 0 };
+    threads[t] = g_thread_new("thumbnails", _worker, &workers[t]);
+  }
+
+  int n_failed = 0;
+  for(int t = 0; t < THREADS; t++)
+  {
+    g_thread_join(threads[t]);
+    n_failed += workers[t].failed;
+  }
+
+  for(guint i = 0; i < ids->len; i++) n_failed += _check_history(g_array_index(ids, int32_t, i));
+
+  printf("%d tests failed\n", n_failed);
+
+  g_array_free(ids, TRUE);
+  dt_cleanup();
+
+  return n_failed > 0 ? 1 : 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -37,6 +37,7 @@
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
+#include "control/jobs/develop_jobs.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -658,6 +659,30 @@ static void _dev_change_image(dt_view_t *self, int32_t imgid)
   dt_view_manager_switch(darktable.view_manager, "darkroom");
 }
 
+// Decode the previous and next images of the collection in background,
+// so switching to them doesn't wait for the raw decoding and the history.
+static void _preload_neighbours(dt_develop_t *dev)
+{
+  const int32_t current_img = dev->image_storage.id;
+  dt_dev_preload_set_anchor(current_img);
+
+  GList *current_collection = dt_collection_get_all(darktable.collection, -1);
+  GList *current_item = g_list_find(current_collection, GINT_TO_POINTER(current_img));
+
+  if(current_item)
+  {
+    // next first, that's the usual culling direction
+    if(current_item->next)
+      dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG,
+                         dt_dev_preload_job_create(GPOINTER_TO_INT(current_item->next->data), current_img));
+    if(current_item->prev)
+      dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG,
+                         dt_dev_preload_job_create(GPOINTER_TO_INT(current_item->prev->data), current_img));
+  }
+
+  g_list_free(current_collection);
+}
+
 static void _view_darkroom_filmstrip_activate_callback(gpointer instance, int32_t imgid, gpointer user_data)
 {
   if(imgid > -1)
@@ -2065,6 +2090,7 @@ void enter(dt_view_t *self)
   DT_DEBUG_CONTROL_SIGNAL_CONNECT(darktable.signals, DT_SIGNAL_VIEWMANAGER_THUMBTABLE_ACTIVATE,
                             G_CALLBACK(_view_darkroom_filmstrip_activate_callback), self);
 
+  _preload_neighbours(dev);
 }
 
 void leave(dt_view_t *self)
@@ -2079,6 +2105,9 @@ void leave(dt_view_t *self)
 
   dt_develop_t *dev = (dt_develop_t *)self->data;
 
+  // Pending preloads are for the neighbours of the image we leave
+  dt_dev_preload_set_anchor(UNKNOWN_IMAGE);
+
   // Restore the selection
   dt_selection_select_single(darktable.selection, dev->image_storage.id);
 
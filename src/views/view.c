@@ -57,6 +57,29 @@ static void dt_view_manager_load_modules(dt_view_manager_t *vm);
 static int dt_view_load_module(void *v, const char *libname, const char *module_name);
 static void dt_view_unload_module(dt_view_t *view);
 
+// Budget of the display-ready thumbnails kept by dt_view_image_get_surface().
+// That's about 2 screens of lighttable at 4K, so scrolling back and forth is only blits.
+#define DT_VIEW_SURFACE_CACHE_SIZE ((size_t)128 << 20)
+
+typedef struct dt_view_surface_cache_entry_t
+{
+  int32_t imgid;
+  dt_mipmap_size_t mip;
+  uint32_t mip_serial;      // dt_mipmap_buffer_t.serial the surface was painted from
+  uint32_t display_serial;  // dt_colorspaces_t.display_transforms_serial it was converted with
+  int width, height;
+  gboolean focus_peaking;
+  cairo_surface_t *surface;
+  size_t size;
+} dt_view_surface_cache_entry_t;
+
+static void _surface_cache_entry_free(gpointer data)
+{
+  dt_view_surface_cache_entry_t *entry = (dt_view_surface_cache_entry_t *)data;
+  cairo_surface_destroy(entry->surface);
+  g_free(entry);
+}
+
 void dt_view_manager_init(dt_view_manager_t *vm)
 {
   /* prepare statements */
@@ -92,6 +115,11 @@ void dt_view_manager_init(dt_view_manager_t *vm)
   vm->current_view = NULL;
   vm->audio.audio_player_id = -1;
   vm->active_images = NULL;
+
+  vm->surface_cache.entries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _surface_cache_entry_free);
+  g_queue_init(&vm->surface_cache.lru);
+  vm->surface_cache.size = 0;
+  dt_pthread_mutex_init(&vm->surface_cache.lock, NULL);
 }
 
 void dt_view_manager_gui_init(dt_view_manager_t *vm)
@@ -106,6 +134,9 @@ void dt_view_manager_gui_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   g_list_free(vm->active_images);
+  g_queue_clear(&vm->surface_cache.lru);
+  g_hash_table_destroy(vm->surface_cache.entries);
+  dt_pthread_mutex_destroy(&vm->surface_cache.lock);
   for(GList *iter = vm->views; iter; iter = g_list_next(iter)) dt_view_unload_module((dt_view_t *)iter->data);
   g_list_free_full(vm->views, free);
   vm->views = NULL;
@@ -628,6 +659,66 @@ void dt_view_manager_scrollbar_changed(dt_view_manager_t *vm, double x, double y
     vm->current_view->scrollbar_changed(vm->current_view, x, y);
 }
 
+// Return a new reference on the cached surface if it still matches the mipmap buffer and the display profile.
+// Surfaces are shared, so the callers must not draw on them.
+static cairo_surface_t *_surface_cache_get(const dt_view_surface_cache_entry_t *key)
+{
+  dt_view_manager_t *vm = darktable.view_manager;
+  cairo_surface_t *surface = NULL;
+
+  dt_pthread_mutex_lock(&vm->surface_cache.lock);
+  dt_view_surface_cache_entry_t *entry
+      = g_hash_table_lookup(vm->surface_cache.entries, GINT_TO_POINTER(key->imgid));
+  if(entry && entry->mip == key->mip && entry->mip_serial == key->mip_serial
+     && entry->display_serial == key->display_serial && entry->width == key->width
+     && entry->height == key->height && entry->focus_peaking == key->focus_peaking)
+  {
+    surface = cairo_surface_reference(entry->surface);
+
+    // most recently used goes last
+    GList *link = g_queue_find(&vm->surface_cache.lru, entry);
+    g_queue_unlink(&vm->surface_cache.lru, link);
+    g_queue_push_tail_link(&vm->surface_cache.lru, link);
+  }
+  dt_pthread_mutex_unlock(&vm->surface_cache.lock);
+
+  return surface;
+}
+
+static void _surface_cache_remove(dt_view_manager_t *vm, dt_view_surface_cache_entry_t *entry)
+{
+  g_queue_remove(&vm->surface_cache.lru, entry);
+  vm->surface_cache.size -= entry->size;
+  g_hash_table_remove(vm->surface_cache.entries, GINT_TO_POINTER(entry->imgid));
+}
+
+static void _surface_cache_set(const dt_view_surface_cache_entry_t *key, cairo_surface_t *surface)
+{
+  dt_view_manager_t *vm = darktable.view_manager;
+  const size_t size = (size_t)cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+  if(size > DT_VIEW_SURFACE_CACHE_SIZE / 4) return;
+
+  dt_view_surface_cache_entry_t *entry = g_new(dt_view_surface_cache_entry_t, 1);
+  *entry = *key;
+  entry->surface = cairo_surface_reference(surface);
+  entry->size = size;
+
+  dt_pthread_mutex_lock(&vm->surface_cache.lock);
+
+  // one surface per image: it's superseded by the new one
+  dt_view_surface_cache_entry_t *old = g_hash_table_lookup(vm->surface_cache.entries, GINT_TO_POINTER(key->imgid));
+  if(old) _surface_cache_remove(vm, old);
+
+  while(vm->surface_cache.size + size > DT_VIEW_SURFACE_CACHE_SIZE && !g_queue_is_empty(&vm->surface_cache.lru))
+    _surface_cache_remove(vm, g_queue_peek_head(&vm->surface_cache.lru));
+
+  g_hash_table_insert(vm->surface_cache.entries, GINT_TO_POINTER(key->imgid), entry);
+  g_queue_push_tail(&vm->surface_cache.lru, entry);
+  vm->surface_cache.size += size;
+
+  dt_pthread_mutex_unlock(&vm->surface_cache.lock);
+}
+
 dt_view_surface_value_t dt_view_image_get_surface(int32_t imgid, int width, int height, cairo_surface_t **surface,
                                                   const gboolean quality)
 {
@@ -664,6 +755,31 @@ dt_view_surface_value_t dt_view_image_get_surface(int32_t imgid, int width, int
   const int img_height = roundf(buf_ht * scale);
   // due to the forced rounding above, we need to recompute scaling
   scale = fmaxf(img_width / (float)buf_wd, img_height / (float)buf_ht);
+
+  // the color conversion and the scaling are the expensive part: reuse them if nothing changed since last time.
+  // The mipmap serial changes each time the thumbnail is regenerated, which covers history edits.
+  pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
+  const uint32_t display_serial = darktable.color_profiles->display_transforms_serial;
+  pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+
+  const dt_view_surface_cache_entry_t key = { .imgid = imgid,
+                                              .mip = buf.size,
+                                              .mip_serial = buf.serial,
+                                              .display_serial = display_serial,
+                                              .width = img_width,
+                                              .height = img_height,
+                                              .focus_peaking = darktable.gui->show_focus_peaking };
+
+  // only complete thumbnails are cached, smaller ones will be replaced soon
+  const gboolean cacheable = (mip == buf.size) && buf_wd > 8 && buf_ht > 8;
+  if(cacheable && (*surface = _surface_cache_get(&key)))
+  {
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    dt_print(DT_DEBUG_LIGHTTABLE, "[dt_view_image_get_surface]  id %i, mip code %i, surf %ix%i from cache\n", imgid,
+             mip, img_width, img_height);
+    return DT_VIEW_SURFACE_OK;
+  }
+
   *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, img_width, img_height);
 
   // we transfer cached image on a cairo_surface (with colorspace transform if needed)
@@ -779,6 +895,8 @@ dt_view_surface_value_t dt_view_image_get_surface(int32_t imgid, int width, int
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
   if(rgbbuf) free(rgbbuf);
 
+  if(cacheable && ret == DT_VIEW_SURFACE_OK) _surface_cache_set(&key, *surface);
+
   // logs
   if((darktable.unmuted & (DT_DEBUG_LIGHTTABLE | DT_DEBUG_PERF)) == (DT_DEBUG_LIGHTTABLE | DT_DEBUG_PERF))
   {
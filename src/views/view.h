@@ -188,6 +188,15 @@ typedef struct dt_view_manager_t
     sqlite3_stmt *get_grouped;
   } statements;
 
+  // display-ready thumbnail surfaces, see dt_view_image_get_surface()
+  struct
+  {
+    GHashTable *entries; // imgid -> struct dt_view_surface_cache_entry_t
+    GQueue lru;          // least recently used first
+    size_t size;         // bytes of all cached surfaces
+    dt_pthread_mutex_t lock;
+  } surface_cache;
+
   struct
   {
     GPid audio_player_pid;   // the pid of the child process